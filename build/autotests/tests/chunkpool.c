@@ -0,0 +1,115 @@
+#include <common.h>
+
+#include <pthread.h>
+
+#define NUMCHUNKS 1000
+
+static volatile int step=0;
+static t_iemnet_chunk*orphan=NULL;
+static unsigned long adopted_hits=0;
+
+/* leaves a chunk behind, that is released after the thread has terminated */
+static void*first_thread(void*arg) {
+  unsigned char data[100];
+  orphan=iemnet__chunk_create_data(sizeof(data), data);
+  return arg;
+}
+/* re-uses the pool of the first thread, so it gets the orphaned chunk back */
+static void*second_thread(void*arg) {
+  unsigned char data[100];
+  unsigned long hits0=0, hits=0;
+  t_iemnet_chunk*first=iemnet__chunk_create_data(sizeof(data), data);
+  t_iemnet_chunk*chunk=NULL;
+  step=1;
+  while(step!=2)
+    usleep(1000);
+  /* the free list is empty, the released chunk is still 'remote' */
+  iemnet__chunkpool_stats(&hits0, NULL);
+  chunk=iemnet__chunk_create_data(sizeof(data), data);
+  iemnet__chunkpool_stats(&hits, NULL);
+  iemnet__chunk_destroy(chunk);
+  iemnet__chunk_destroy(first);
+  adopted_hits=hits-hits0;
+  return arg;
+}
+
+void chunkpool_setup(void) {
+  unsigned long hits0=0, misses0=0;
+  unsigned long hits=0, misses=0;
+  unsigned char data[512];
+  unsigned int i;
+
+  /* warm up the pool */
+  t_iemnet_chunk*chunk=iemnet__chunk_create_data(sizeof(data), data);
+  fail_if(!chunk, __LINE__, "unable to create chunk");
+  iemnet__chunk_destroy(chunk);
+
+  iemnet__chunkpool_stats(&hits0, &misses0);
+  for(i=0; i<NUMCHUNKS; i++) {
+    data[0]=i;
+    chunk=iemnet__chunk_create_data(sizeof(data), data);
+    fail_if(!chunk, __LINE__, "unable to create chunk#%d", i);
+    fail_if(chunk->size != sizeof(data), __LINE__, "size mismatch %d!=%d", chunk->size, sizeof(data));
+    fail_if(chunk->data[0] != (i&0xFF), __LINE__, "data mismatch");
+    iemnet__chunk_destroy(chunk);
+  }
+  iemnet__chunkpool_stats(&hits, &misses);
+
+  /* in a steady state, all chunks must come from the pool */
+  fail_if(misses != misses0, __LINE__, "%lu pool misses", misses-misses0);
+  fail_if(hits-hits0 != NUMCHUNKS, __LINE__, "%lu pool hits", hits-hits0);
+
+  /* shared chunks keep the payload alive */
+  data[0]=42;
+  chunk=iemnet__chunk_create_data(sizeof(data), data);
+  {
+    t_iemnet_chunk*shared=iemnet__chunk_share(chunk);
+    fail_if(!shared, __LINE__, "unable to share chunk");
+    fail_if(shared->data != chunk->data, __LINE__, "payload has been copied");
+    iemnet__chunk_destroy(chunk);
+    fail_if(shared->data[0] != 42, __LINE__, "payload has been freed");
+    iemnet__chunk_destroy(shared);
+  }
+
+  /* borrowed chunks neither allocate nor copy, but sharing them copies */
+  iemnet__chunkpool_stats(&hits0, &misses0);
+  {
+    t_iemnet_chunk borrowed;
+    t_iemnet_chunk*shared=NULL;
+    data[0]=23;
+    chunk=iemnet__chunk_borrow(&borrowed, sizeof(data), data, NULL);
+    fail_if(chunk != &borrowed, __LINE__, "unable to borrow chunk");
+    fail_if(chunk->data != data, __LINE__, "payload has been copied");
+    iemnet__chunkpool_stats(&hits, &misses);
+    fail_if(hits+misses != hits0+misses0, __LINE__, "borrowing allocated memory");
+    shared=iemnet__chunk_share(chunk);
+    iemnet__chunk_destroy(chunk);
+    fail_if(!shared, __LINE__, "unable to share borrowed chunk");
+    fail_if(shared->data == data, __LINE__, "borrowed payload has not been copied");
+    data[0]=0;
+    fail_if(shared->data[0] != 23, __LINE__, "payload mismatch");
+    iemnet__chunk_destroy(shared);
+  }
+
+  /* pools of terminated threads are re-used (and keep their statistics) */
+  {
+    pthread_t thread;
+    fail_if(pthread_create(&thread, NULL, first_thread, NULL), __LINE__, "unable to create thread");
+    pthread_join(thread, NULL);
+    fail_if(!orphan, __LINE__, "unable to create chunk in thread");
+    iemnet__chunkpool_stats(&hits0, &misses0);
+    fail_if(hits0+misses0 < NUMCHUNKS+2, __LINE__, "statistics of terminated thread are lost");
+
+    fail_if(pthread_create(&thread, NULL, second_thread, NULL), __LINE__, "unable to create thread");
+    while(step!=1)
+      usleep(1000);
+    /* the first chunk of the second thread came out of its pool,
+     * so it must now be the owner */
+    iemnet__chunk_destroy(orphan);
+    step=2;
+    pthread_join(thread, NULL);
+    fail_if(adopted_hits != 1, __LINE__, "pool of terminated thread has not been re-used");
+  }
+
+  pass();
+}
@@ -0,0 +1,68 @@
+#include <common.h>
+
+#define NUMBYTES 1000
+
+static unsigned char expected(t_float f) {
+  if(!(f > 0))
+    return 0;
+  if(f >= 255)
+    return 255;
+  return (unsigned char)f;
+}
+
+void convert_setup(void) {
+  t_atom atoms[NUMBYTES];
+  t_float values[NUMBYTES];
+  t_iemnet_chunk*chunk=NULL;
+  t_iemnet_floatlist*list=NULL;
+  unsigned int i;
+
+  for(i=0; i<NUMBYTES; i++) {
+    t_float f = (t_float)i * 0.75 - 200.;
+    values[i] = f;
+    SETFLOAT(atoms+i, f);
+  }
+  /* a few special values */
+  values[17] = 0;
+  SETSYMBOL(atoms+17, gensym("foo"));
+  values[18] = 255.99;
+  SETFLOAT(atoms+18, values[18]);
+  values[19] = 1e30;
+  SETFLOAT(atoms+19, values[19]);
+
+  printf("using %s conversion\n", iemnet__convert_name());
+
+  /* odd sizes, so we also hit the scalar tails */
+  chunk=iemnet__chunk_create_list(NUMBYTES-3, atoms);
+  fail_if(!chunk, __LINE__, "unable to create chunk");
+  for(i=0; i<chunk->size; i++) {
+    fail_if(chunk->data[i] != expected(values[i]), __LINE__,
+            "byte#%d: %d != %d (%f)", i, chunk->data[i], expected(values[i]), values[i]);
+  }
+
+  list=iemnet__chunk2list(chunk, list);
+  fail_if(!list, __LINE__, "unable to convert chunk");
+  fail_if(list->argc != chunk->size, __LINE__, "size mismatch %d!=%d", list->argc, chunk->size);
+  for(i=0; i<list->argc; i++) {
+    fail_if(A_FLOAT != list->argv[i].a_type, __LINE__, "atom#%d is not a float", i);
+    fail_if(atom_getfloat(list->argv+i) != chunk->data[i], __LINE__,
+            "atom#%d: %f != %d", i, atom_getfloat(list->argv+i), chunk->data[i]);
+  }
+
+  /* pre-converted chunks hand out their own atoms */
+  fail_if(!iemnet__chunk_convert(chunk), __LINE__, "unable to pre-convert chunk");
+  {
+    t_iemnet_floatlist*dummy=list;
+    t_atom*argv=iemnet__chunk2atoms(chunk, &dummy);
+    fail_if(argv != chunk->atoms, __LINE__, "pre-converted atoms not used");
+    fail_if(dummy != list, __LINE__, "list has been touched");
+    for(i=0; i<chunk->size; i++) {
+      fail_if(atom_getfloat(argv+i) != chunk->data[i], __LINE__,
+              "atom#%d: %f != %d", i, atom_getfloat(argv+i), chunk->data[i]);
+    }
+  }
+  iemnet__chunk_destroy(chunk);
+  iemnet__floatlist_destroy(list);
+
+  pass();
+}
@@ -0,0 +1,57 @@
+#include <common.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NUMCHUNKS 100
+
+void dgramsend_setup(void) {
+  int sendfd, recvfd;
+  int bufsize=1024*1024;
+  struct sockaddr_in addr;
+  socklen_t addrlen=sizeof(addr);
+  unsigned char data[NUMCHUNKS+1];
+  unsigned int i;
+  t_iemnet_sender*sender=NULL;
+
+  sendfd=socket(AF_INET, SOCK_DGRAM, 0);
+  recvfd=socket(AF_INET, SOCK_DGRAM, 0);
+  skip_if(sendfd<0 || recvfd<0, __LINE__, "unable to create sockets");
+  setsockopt(recvfd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family=AF_INET;
+  addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+  addr.sin_port=0;
+  skip_if(bind(recvfd, (struct sockaddr*)&addr, sizeof(addr)), __LINE__, "unable to bind");
+  skip_if(getsockname(recvfd, (struct sockaddr*)&addr, &addrlen), __LINE__, "unable to get port");
+
+  sender=iemnet__sender_create(sendfd, NULL, NULL, 0);
+  fail_if(!sender, __LINE__, "unable to create sender");
+
+  /* each chunk carries its own destination */
+  for(i=0; i<NUMCHUNKS; i++) {
+    t_iemnet_chunk*chunk;
+    memset(data, i, sizeof(data));
+    chunk=iemnet__chunk_create_data(i+1, data);
+    chunk->addr=ntohl(addr.sin_addr.s_addr);
+    chunk->port=ntohs(addr.sin_port);
+    fail_if(iemnet__sender_send_owned(sender, chunk) < 0,
+            __LINE__, "unable to send chunk#%d", i);
+  }
+
+  /* datagram boundaries must be preserved */
+  for(i=0; i<NUMCHUNKS; i++) {
+    unsigned char buf[NUMCHUNKS+1];
+    int len=recv(recvfd, buf, sizeof(buf), 0);
+    fail_if(len != (int)(i+1), __LINE__, "datagram#%d has %d bytes", i, len);
+    fail_if(buf[0] != i || buf[len-1] != i, __LINE__, "datagram#%d has wrong content", i);
+  }
+
+  iemnet__sender_destroy(sender, 0);
+  close(sendfd);
+  close(recvfd);
+  pass();
+}
@@ -0,0 +1,52 @@
+#include <common.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#define NUMCHUNKS 500
+#define CHUNKSIZE 1000
+
+void nonblocksend_setup(void) {
+  int fds[2];
+  int bufsize=4096;
+  unsigned int i, received=0;
+  unsigned char data[CHUNKSIZE];
+  t_iemnet_sender*sender=NULL;
+
+  skip_if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), __LINE__, "unable to create socketpair");
+  /* a small non-blocking send buffer keeps the sender hitting EAGAIN */
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+  skip_if(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK) < 0,
+          __LINE__, "unable to make socket non-blocking");
+
+  sender=iemnet__sender_create(fds[0], NULL, NULL, 0);
+  fail_if(!sender, __LINE__, "unable to create sender");
+
+  for(i=0; i<NUMCHUNKS; i++) {
+    memset(data, i, sizeof(data));
+    fail_if(iemnet__sender_send_owned(sender,
+                                      iemnet__chunk_create_data(sizeof(data), data)) < 0,
+            __LINE__, "unable to send chunk#%d", i);
+  }
+
+  /* read slowly; nothing may get lost while the sender waits */
+  while(received < NUMCHUNKS*CHUNKSIZE) {
+    unsigned char buf[3000];
+    int j;
+    int len=read(fds[1], buf, sizeof(buf));
+    fail_if(len<=0, __LINE__, "read failed after %d bytes", received);
+    for(j=0; j<len; j++) {
+      unsigned char expected=(received/CHUNKSIZE)&0xFF;
+      fail_if(buf[j] != expected, __LINE__, "byte#%d is %d instead of %d", received, buf[j], expected);
+      received++;
+    }
+    if(!(received % 50000))
+      usleep(1000);
+  }
+
+  iemnet__sender_destroy(sender, 0);
+  close(fds[0]);
+  close(fds[1]);
+  pass();
+}
@@ -0,0 +1,64 @@
+#include <common.h>
+#include <string.h>
+
+#define CHUNKSIZE 100
+
+static t_iemnet_chunk*create(unsigned char id) {
+  unsigned char data[CHUNKSIZE];
+  memset(data, id, sizeof(data));
+  return iemnet__chunk_create_data(sizeof(data), data);
+}
+
+static void fill(t_iemnet_queue*q, unsigned int count) {
+  unsigned int i;
+  for(i=0; i<count; i++) {
+    queue_push(q, create(i));
+  }
+}
+
+static void check(t_iemnet_queue*q, unsigned int first, unsigned int count, int line) {
+  t_iemnet_chunk*c;
+  unsigned int i;
+  int extra;
+  for(i=0; i<count; i++) {
+    c=queue_pop_noblock(q);
+    fail_if(!c, line, "missing chunk#%d", i);
+    fail_if(c->data[0] != first+i, line, "got chunk#%d instead of #%d", c->data[0], first+i);
+    iemnet__chunk_destroy(c);
+  }
+  c=queue_pop_noblock(q);
+  extra=(NULL != c);
+  if(c)
+    iemnet__chunk_destroy(c);
+  fail_if(extra, line, "too many chunks in queue");
+}
+
+void queuelimit_setup(void) {
+  unsigned long chunks=0, bytes=0;
+  t_iemnet_queue*q=queue_create();
+  fail_if(!q, __LINE__, "unable to create queue");
+
+  /* drop the newest chunks */
+  queue_setlimit(q, 5*CHUNKSIZE, IEMNET_OVERFLOW_DROPNEWEST);
+  fill(q, 8);
+  fail_if(queue_getsize(q) != 5*CHUNKSIZE, __LINE__, "queue has %d bytes", queue_getsize(q));
+  queue_getdropped(q, &chunks, &bytes);
+  fail_if(chunks != 3 || bytes != 3*CHUNKSIZE, __LINE__, "dropped %lu chunks (%lu bytes)", chunks, bytes);
+  check(q, 0, 5, __LINE__);
+
+  /* drop the oldest chunks */
+  queue_setlimit(q, 5*CHUNKSIZE, IEMNET_OVERFLOW_DROPOLDEST);
+  fill(q, 8);
+  check(q, 3, 5, __LINE__);
+  queue_getdropped(q, &chunks, &bytes);
+  fail_if(chunks != 6, __LINE__, "dropped %lu chunks", chunks);
+
+  /* an empty queue accepts anything */
+  queue_setlimit(q, CHUNKSIZE/2, IEMNET_OVERFLOW_DISCONNECT);
+  fail_if(queue_push(q, create(0)) != CHUNKSIZE, __LINE__, "oversized chunk rejected");
+  fail_if(queue_push(q, create(1)) >= 0, __LINE__, "overflow not reported");
+  check(q, 0, 1, __LINE__);
+
+  queue_destroy(q);
+  pass();
+}
@@ -0,0 +1,52 @@
+#include <common.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NUMSHARDS 4
+
+static void callback(void*userdata, t_iemnet_chunk*chunk) {
+  (void)userdata;
+  (void)chunk;
+}
+
+void receivershards_setup(void) {
+  int fds[NUMSHARDS];
+  t_iemnet_receiver*receivers[NUMSHARDS];
+  unsigned int destroyed0, destroyed=0, released=0;
+  unsigned int i, wait;
+
+  destroyed0=iemnet__receiver_getdestroyed(NULL);
+  for(i=0; i<NUMSHARDS; i++) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family=AF_INET;
+    addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+    fds[i]=socket(AF_INET, SOCK_DGRAM, 0);
+    skip_if(fds[i]<0, __LINE__, "unable to create socket");
+    skip_if(bind(fds[i], (struct sockaddr*)&addr, sizeof(addr)), __LINE__, "unable to bind socket");
+    receivers[i]=iemnet__receiver_create_shard(fds[i], NULL, callback, 0, i);
+    fail_if(!receivers[i], __LINE__, "unable to create receiver#%d", i);
+  }
+
+  /* the receive threads are idle, but must still let go of the receivers */
+  usleep(100000);
+  for(i=0; i<NUMSHARDS; i++) {
+    iemnet__receiver_destroy(receivers[i], 0);
+  }
+  for(wait=0; wait<200; wait++) {
+    destroyed=iemnet__receiver_getdestroyed(&released) - destroyed0;
+    if(destroyed == released)
+      break;
+    usleep(10000);
+  }
+  fail_if(destroyed != released, __LINE__, "%u of %u receivers still held by their receive thread",
+          destroyed - released, destroyed);
+
+  for(i=0; i<NUMSHARDS; i++) {
+    close(fds[i]);
+  }
+  pass();
+}
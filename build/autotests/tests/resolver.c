@@ -0,0 +1,93 @@
+#include <common.h>
+
+#include <string.h>
+
+static int called = 0;
+static int resolved = 0;
+static uint32_t resolvedaddr = 0;
+static void resolve_callback(void*userdata, int success, uint32_t addr)
+{
+  (void)userdata;
+  called++;
+  resolved = success;
+  resolvedaddr = addr;
+}
+
+/* a DNS where 'slow.test' takes until we let it go */
+static volatile int slow_waiting = 0;
+static volatile int slow_release = 0;
+static volatile int fast_asked = 0;
+static int fake_lookup(const char*host, uint32_t*addr)
+{
+  if(!strcmp(host, "slow.test")) {
+    slow_waiting = 1;
+    while(!slow_release)
+      usleep(1000);
+    *addr = 0x0A000001;
+    return 1;
+  }
+  fast_asked++;
+  *addr = 0x0A000002;
+  return 1;
+}
+
+void resolver_setup(void) {
+  unsigned long hits0 = 0, misses0 = 0;
+  unsigned long hits = 0, misses = 0;
+  unsigned int entries = 0;
+  uint32_t addr = 0;
+  t_iemnet_resolver*r;
+
+  /* numeric addresses are resolved immediately */
+  fail_if(!iemnet__resolve("10.1.2.3", &addr), __LINE__, "unable to resolve numeric address");
+  fail_if(addr != 0x0A010203, __LINE__, "numeric address mismatch %08x", addr);
+
+  r = iemnet__resolver_lookup("192.168.0.1", NULL, resolve_callback);
+  fail_if(r != NULL, __LINE__, "numeric lookup is pending");
+  fail_if(called != 1, __LINE__, "callback called %d times", called);
+  fail_if(!resolved || resolvedaddr != 0xC0A80001, __LINE__, "numeric lookup mismatch %08x", resolvedaddr);
+
+  /* static hosts (like /etc/hosts) are answered from the cache */
+  iemnet__resolver_addhost("iemnet.test", 0x7F000102);
+  iemnet__resolver_getstats(NULL, &hits0, &misses0);
+  r = iemnet__resolver_lookup("iemnet.test", NULL, resolve_callback);
+  fail_if(r != NULL, __LINE__, "cached lookup is pending");
+  fail_if(called != 2, __LINE__, "callback called %d times", called);
+  fail_if(!resolved || resolvedaddr != 0x7F000102, __LINE__, "cached lookup mismatch %08x", resolvedaddr);
+  addr = 0;
+  fail_if(!iemnet__resolve("iemnet.test", &addr), __LINE__, "unable to resolve static host");
+  fail_if(addr != 0x7F000102, __LINE__, "static host mismatch %08x", addr);
+  iemnet__resolver_getstats(&entries, &hits, &misses);
+  fail_if(hits - hits0 != 2, __LINE__, "%lu cache hits", hits - hits0);
+  fail_if(misses != misses0, __LINE__, "%lu cache misses", misses - misses0);
+
+  /* disabling the cache keeps the static hosts */
+  iemnet__resolver_setttl(0);
+  fail_if(iemnet__resolver_getstats(&entries, NULL, NULL) != 0, __LINE__, "cache not disabled");
+  fail_if(entries != 1, __LINE__, "%u cache entries", entries);
+  fail_if(!iemnet__resolve("iemnet.test", &addr), __LINE__, "static host forgotten");
+
+  /* a slow lookup does not hold up the others */
+  {
+    t_iemnet_resolver*slow, *fast;
+    int i;
+    iemnet__resolver_setlookup(fake_lookup);
+    slow = iemnet__resolver_lookup("slow.test", NULL, resolve_callback);
+    fail_if(!slow, __LINE__, "slow lookup is not pending");
+    for(i = 0; i < 2000 && !slow_waiting; i++)
+      usleep(1000);
+    fail_if(!slow_waiting, __LINE__, "slow lookup has not been started");
+    fast = iemnet__resolver_lookup("fast.test", NULL, resolve_callback);
+    fail_if(!fast, __LINE__, "fast lookup is not pending");
+    for(i = 0; i < 2000 && !fast_asked; i++)
+      usleep(1000);
+    fail_if(!fast_asked, __LINE__, "fast lookup is blocked by the slow one");
+    /* (the main thread is not running, so the callbacks would never be called) */
+    iemnet__resolver_cancel(slow);
+    iemnet__resolver_cancel(fast);
+    slow_release = 1;
+    iemnet__resolver_setlookup(NULL);
+  }
+
+  pass();
+}
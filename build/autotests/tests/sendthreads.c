@@ -0,0 +1,65 @@
+#include <common.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define NUMSENDERS 64
+#define NUMCHUNKS 200
+#define CHUNKSIZE 100
+
+void sendthreads_setup(void) {
+  int fds[NUMSENDERS][2];
+  unsigned int received[NUMSENDERS];
+  t_iemnet_sender*senders[NUMSENDERS];
+  int bufsize=4096;
+  unsigned char data[CHUNKSIZE];
+  unsigned int i, j, done=0;
+
+  skip_if(iemnet__sender_setthreads(2) < 0, __LINE__, "shared send threads not supported");
+
+  for(i=0; i<NUMSENDERS; i++) {
+    skip_if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]), __LINE__, "unable to create socketpair");
+    /* a small send buffer makes the senders wait for the socket */
+    setsockopt(fds[i][0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    senders[i]=iemnet__sender_create(fds[i][0], NULL, NULL, 0);
+    fail_if(!senders[i], __LINE__, "unable to create sender#%d", i);
+    received[i]=0;
+  }
+
+  for(j=0; j<NUMCHUNKS; j++) {
+    memset(data, j, sizeof(data));
+    for(i=0; i<NUMSENDERS; i++) {
+      fail_if(iemnet__sender_send_owned(senders[i],
+                                        iemnet__chunk_create_data(sizeof(data), data)) < 0,
+              __LINE__, "unable to send chunk#%d to sender#%d", j, i);
+    }
+  }
+
+  /* every stream must arrive complete and in order */
+  while(done < NUMSENDERS) {
+    for(i=0; i<NUMSENDERS; i++) {
+      unsigned char buf[1000];
+      int k, len;
+      if(received[i] >= NUMCHUNKS*CHUNKSIZE)
+        continue;
+      len=read(fds[i][1], buf, sizeof(buf));
+      fail_if(len<=0, __LINE__, "read#%d failed after %d bytes", i, received[i]);
+      for(k=0; k<len; k++) {
+        unsigned char expected=(received[i]/CHUNKSIZE)&0xFF;
+        fail_if(buf[k] != expected, __LINE__, "byte#%d of stream#%d is %d instead of %d",
+                received[i], i, buf[k], expected);
+        received[i]++;
+      }
+      if(received[i] >= NUMCHUNKS*CHUNKSIZE)
+        done++;
+    }
+  }
+
+  for(i=0; i<NUMSENDERS; i++) {
+    iemnet__sender_destroy(senders[i], 0);
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+  iemnet__sender_setthreads(-1);
+  pass();
+}
@@ -48,11 +48,46 @@ static int consumer(t_iemnet_queue*q) {
   return 0;
 }
 
+static int batchconsumer(t_iemnet_queue*q, unsigned int first, unsigned int count, size_t maxbytes) {
+  t_iemnet_chunk*chunks[64];
+  unsigned int expected=first;
+  count+=first;
+  while(expected<count) {
+    unsigned int i, n;
+    unsigned int maxchunks=(count-expected<64)?(count-expected):64;
+    /* this won't block, as long as there is something in the queue */
+    n=queue_pop_batch(q, chunks, maxchunks, maxbytes);
+    if(!n || n>maxchunks || (maxbytes && n*sizeof(data_t)>maxbytes)) {
+      error("popped %d chunks", n);
+      fail();
+    }
+    for(i=0; i<n; i++) {
+      data_t*data=(data_t*)chunks[i]->data;
+      if(data->count != expected) {
+        error("got chunk#%d instead of #%d", data->count, expected);
+        fail();
+      }
+      expected++;
+      iemnet__chunk_destroy(chunks[i]);
+    }
+  }
+  return 0;
+}
+
 void serialqueue_setup(void) {
   t_iemnet_queue*q=queue_create();
   producer(q, 1000, 1);
   consumer(q);
 
+  /* the ring overflows at some point */
+  producer(q, 3000, 0);
+  batchconsumer(q, 0, 2000, 0);
+  batchconsumer(q, 2000, 1000, 10*sizeof(data_t));
+  if(queue_getsize(q)) {
+    error("queue not empty");
+    fail();
+  }
+
   queue_destroy(q);
   pass();
 }
@@ -0,0 +1,61 @@
+#include <common.h>
+
+#define NUMENTRIES 20000
+
+static int values[NUMENTRIES];
+
+void slotmap_setup(void) {
+  t_iemnet_slotmap*map = iemnet__slotmap_create();
+  unsigned int handles[NUMENTRIES];
+  unsigned int h, stale;
+  int i;
+  fail_if(!map, __LINE__, "unable to create slotmap");
+
+  /* add, get & find */
+  h = iemnet__slotmap_add(map, 42, values+0);
+  fail_if(!h, __LINE__, "unable to add entry");
+  fail_if(iemnet__slotmap_index(h) != 0, __LINE__, "first entry in slot %u", iemnet__slotmap_index(h));
+  fail_if(iemnet__slotmap_get(map, h) != values+0, __LINE__, "get mismatch");
+  fail_if(iemnet__slotmap_find(map, 42) != h, __LINE__, "find mismatch");
+  fail_if(iemnet__slotmap_find(map, 43) != 0, __LINE__, "found unknown key");
+  fail_if(iemnet__slotmap_add(map, 42, values+1) != 0, __LINE__, "added duplicate key");
+  fail_if(iemnet__slotmap_size(map) != 1, __LINE__, "size is %u", iemnet__slotmap_size(map));
+
+  /* removed handles become stale, but the slot is re-used */
+  fail_if(iemnet__slotmap_remove(map, h) != values+0, __LINE__, "remove mismatch");
+  fail_if(iemnet__slotmap_get(map, h) != NULL, __LINE__, "stale handle is valid");
+  fail_if(iemnet__slotmap_remove(map, h) != NULL, __LINE__, "removed stale handle");
+  fail_if(iemnet__slotmap_find(map, 42) != 0, __LINE__, "found removed key");
+  stale = h;
+  h = iemnet__slotmap_add(map, 42, values+1);
+  fail_if(iemnet__slotmap_index(h) != 0, __LINE__, "slot not re-used");
+  fail_if(h == stale, __LINE__, "handle re-used");
+  fail_if(iemnet__slotmap_get(map, stale) != NULL, __LINE__, "stale handle is valid");
+  fail_if(iemnet__slotmap_get(map, h) != values+1, __LINE__, "get mismatch");
+  iemnet__slotmap_remove(map, h);
+  fail_if(iemnet__slotmap_size(map) != 0, __LINE__, "size is %u", iemnet__slotmap_size(map));
+
+  /* grow */
+  for(i = 0; i < NUMENTRIES; i++) {
+    handles[i] = iemnet__slotmap_add(map, 3*i, values+i);
+    fail_if(!handles[i], __LINE__, "unable to add entry #%d", i);
+    fail_if(iemnet__slotmap_index(handles[i]) != (unsigned int)i, __LINE__, "entry #%d in slot %u", i, iemnet__slotmap_index(handles[i]));
+  }
+  fail_if(iemnet__slotmap_size(map) != NUMENTRIES, __LINE__, "size is %u", iemnet__slotmap_size(map));
+  fail_if(iemnet__slotmap_capacity(map) < NUMENTRIES, __LINE__, "capacity is %u", iemnet__slotmap_capacity(map));
+
+  /* remove every other entry; the others must stay where they are */
+  for(i = 0; i < NUMENTRIES; i += 2) {
+    fail_if(iemnet__slotmap_remove(map, handles[i]) != values+i, __LINE__, "remove mismatch #%d", i);
+  }
+  for(i = 0; i < NUMENTRIES; i++) {
+    void*expected = (i & 1) ? (values+i) : NULL;
+    fail_if(iemnet__slotmap_get(map, handles[i]) != expected, __LINE__, "get mismatch #%d", i);
+    fail_if(iemnet__slotmap_at(map, i) != expected, __LINE__, "at mismatch #%d", i);
+    fail_if(iemnet__slotmap_find(map, 3*i) != ((i & 1) ? handles[i] : 0), __LINE__, "find mismatch #%d", i);
+  }
+  fail_if(iemnet__slotmap_size(map) != NUMENTRIES/2, __LINE__, "size is %u", iemnet__slotmap_size(map));
+
+  iemnet__slotmap_destroy(map);
+  pass();
+}
@@ -0,0 +1,48 @@
+#include <common.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define NUMCHUNKS 2000
+#define CHUNKSIZE 100
+
+void streamsend_setup(void) {
+  int fds[2];
+  int bufsize=4096;
+  unsigned int i, received=0;
+  unsigned char data[CHUNKSIZE];
+  t_iemnet_sender*sender=NULL;
+
+  skip_if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), __LINE__, "unable to create socketpair");
+  /* a small send buffer enforces partial writes */
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+  sender=iemnet__sender_create(fds[0], NULL, NULL, 0);
+  fail_if(!sender, __LINE__, "unable to create sender");
+  iemnet__sender_setbatch(sender, 0, 0);
+
+  for(i=0; i<NUMCHUNKS; i++) {
+    memset(data, i, sizeof(data));
+    fail_if(iemnet__sender_send_owned(sender,
+                                      iemnet__chunk_create_data(sizeof(data), data)) < 0,
+            __LINE__, "unable to send chunk#%d", i);
+  }
+
+  /* the byte stream must arrive complete and in order */
+  while(received < NUMCHUNKS*CHUNKSIZE) {
+    unsigned char buf[1000];
+    int j;
+    int len=read(fds[1], buf, sizeof(buf));
+    fail_if(len<=0, __LINE__, "read failed after %d bytes", received);
+    for(j=0; j<len; j++) {
+      unsigned char expected=(received/CHUNKSIZE)&0xFF;
+      fail_if(buf[j] != expected, __LINE__, "byte#%d is %d instead of %d", received, buf[j], expected);
+      received++;
+    }
+  }
+
+  iemnet__sender_destroy(sender, 0);
+  close(fds[0]);
+  close(fds[1]);
+  pass();
+}
@@ -22,7 +22,10 @@
 #define DEBUGLEVEL
 
 #include "iemnet.h"
+#include "iemnet_atomic.h"
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include <pthread.h>
 
@@ -30,6 +33,12 @@
 # include <sys/un.h>
 #endif
 
+#ifdef __linux__
+# include <sys/eventfd.h>
+# include <unistd.h>
+# include <stdint.h>
+#endif
+
 #ifndef PD_VERSION_CODE
 # define PD_VERSION_CODE IEMNET_VERSION(PD_MAJOR_VERSION, PD_MINOR_VERSION, PD_BUGFIX_VERSION)
 #endif
@@ -190,6 +199,95 @@ void iemnet__streamout(t_outlet*outlet, int argc, t_atom*argv, int stream)
   }
 }
 
+static const char*overflow_names[] = {
+  "dropnewest", "dropoldest", "disconnect"
+};
+t_symbol*iemnet__overflow2symbol(t_iemnet_overflow policy)
+{
+  if(policy < 0
+      || (unsigned int)policy >= sizeof(overflow_names)/sizeof(*overflow_names)) {
+    return gensym("");
+  }
+  return gensym(overflow_names[policy]);
+}
+
+int iemnet__sendlimit_parse(const void*x, t_symbol*s, int argc,
+                            t_atom*argv,
+                            unsigned long*maxbytes, t_iemnet_overflow*policy)
+{
+  t_iemnet_overflow newpolicy = *policy;
+  t_float f;
+  if(!argc) {
+    return 0;
+  }
+  if(argc > 2 || A_FLOAT != argv[0].a_type
+      || (argc > 1 && A_SYMBOL != argv[1].a_type)) {
+    goto usage;
+  }
+  f = atom_getfloat(argv);
+  if(f < 0) {
+    goto usage;
+  }
+  if(argc > 1) {
+    t_symbol*name = atom_getsymbol(argv + 1);
+    unsigned int i;
+    for(i = 0; i < sizeof(overflow_names)/sizeof(*overflow_names); i++) {
+      if(gensym(overflow_names[i]) == name) {
+        break;
+      }
+    }
+    if(i >= sizeof(overflow_names)/sizeof(*overflow_names)) {
+      goto usage;
+    }
+    newpolicy = (t_iemnet_overflow)i;
+  }
+  *maxbytes = (unsigned long)f;
+  *policy = newpolicy;
+  return 1;
+
+usage:
+  iemnet_log(x, IEMNET_ERROR,
+             "usage: %s [<maxbytes> [dropnewest|dropoldest|disconnect]]",
+             s->s_name);
+  return -1;
+}
+
+int iemnet__receivebudget_parse(const void*x, t_symbol*s, int argc,
+                                t_atom*argv,
+                                unsigned int*maxpackets, unsigned long*maxbytes)
+{
+  if(!argc) {
+    return 0;
+  }
+  if(argc > 2 || A_FLOAT != argv[0].a_type
+      || (argc > 1 && A_FLOAT != argv[1].a_type)
+      || atom_getfloat(argv) < 0
+      || (argc > 1 && atom_getfloat(argv + 1) < 0)) {
+    iemnet_log(x, IEMNET_ERROR,
+               "usage: %s [<maxpackets> [<maxbytes>]]", s->s_name);
+    return -1;
+  }
+  *maxpackets = (unsigned int)atom_getfloat(argv);
+  if(argc > 1) {
+    *maxbytes = (unsigned long)atom_getfloat(argv + 1);
+  }
+  return 1;
+}
+
+int iemnet__recvbufsize_parse(const void*x, t_symbol*s, int argc,
+                              t_atom*argv, unsigned long*bufsize)
+{
+  if(!argc) {
+    return 0;
+  }
+  if(argc > 1 || A_FLOAT != argv[0].a_type || atom_getfloat(argv) < 0) {
+    iemnet_log(x, IEMNET_ERROR, "usage: %s [<bytes>]", s->s_name);
+    return -1;
+  }
+  *bufsize = (unsigned long)atom_getfloat(argv);
+  return 1;
+}
+
 typedef struct _names {
   t_symbol*name;
   struct _names*next;
@@ -252,6 +350,125 @@ int iemnet__register(const char*name)
 }
 
 
+/* ----------------------------- main thread jobs ------------------------- */
+
+/* helper threads put their jobs into a (lock-free, multi-producer) inbox,
+ * and wake up Pd's main thread via a pollfn, which sets a clock
+ * (clocks are not thread-safe) that runs the jobs.
+ * so the helper threads never need to take Pd's lock.
+ * the main thread is only woken up if the inbox was empty.
+ *
+ * the wakeup is an eventfd on Linux, and a UDP socket connected to itself
+ * elsewhere (as Pd can only poll sockets on W32)
+ */
+static struct {
+  int running;
+  int fd;
+  t_clock*clock; /* runs the jobs */
+  void*volatile inbox; /* jobs to be run (LIFO) */
+} mainjob;
+
+static void mainjob_wake(void)
+{
+#ifdef __linux__
+  uint64_t one = 1;
+  while(write(mainjob.fd, &one, sizeof(one)) < 0 && EINTR == errno);
+#else
+  char one = 1;
+  send(mainjob.fd, &one, sizeof(one), 0);
+#endif
+}
+
+/* runs in Pd's main thread */
+static void mainjob_tick(void*z)
+{
+  t_iemnet_mainjob*job, *prev = NULL;
+  (void)z; /* ignore unused variable */
+  job = (t_iemnet_mainjob*)iemnet_atomic_swapptr(&mainjob.inbox, NULL);
+  /* restore the order in which the jobs were posted */
+  while(job) {
+    t_iemnet_mainjob*next = job->next;
+    job->next = prev;
+    prev = job;
+    job = next;
+  }
+  job = prev;
+  while(job) {
+    /* (the job might free itself) */
+    t_iemnet_mainjob*next = job->next;
+    (job->fn)(job->userdata);
+    job = next;
+  }
+}
+
+/* a helper thread has put something into the inbox */
+static void mainjob_wakeup(void*z, int fd)
+{
+#ifdef __linux__
+  uint64_t count;
+  while(read(fd, &count, sizeof(count)) < 0 && EINTR == errno);
+#else
+  /* (one datagram per wakeup; Pd calls us again if there are more) */
+  char count;
+  recv(fd, &count, sizeof(count), 0);
+#endif
+  (void)z; /* ignore unused variable */
+  clock_delay(mainjob.clock, 0);
+}
+
+int iemnet__mainjob_start(void)
+{
+  if(mainjob.running) {
+    return 1;
+  }
+#ifdef __linux__
+  mainjob.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(mainjob.fd < 0) {
+    return 0;
+  }
+#else
+  {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    mainjob.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(mainjob.fd < 0) {
+      return 0;
+    }
+    if(bind(mainjob.fd, (struct sockaddr*)&addr, sizeof(addr))
+        || getsockname(mainjob.fd, (struct sockaddr*)&addr, &addrlen)
+        || connect(mainjob.fd, (struct sockaddr*)&addr, addrlen)) {
+      sys_closesocket(mainjob.fd);
+      return 0;
+    }
+  }
+#endif
+  mainjob.clock = clock_new(&mainjob, (t_method)mainjob_tick);
+  sys_addpollfn(mainjob.fd, mainjob_wakeup, NULL);
+  mainjob.running = 1;
+  return 1;
+}
+
+void iemnet__mainjob_post(t_iemnet_mainjob*job, t_iemnet_mainjobfn fn,
+                          void*userdata)
+{
+  void*head;
+  job->fn = fn;
+  job->userdata = userdata;
+  do {
+    head = iemnet_atomic_getptr(&mainjob.inbox);
+    job->next = (t_iemnet_mainjob*)head;
+  } while(!iemnet_atomic_casptr(&mainjob.inbox, head, job));
+  if(!head) {
+    /* the inbox was empty, so nobody is going to run the jobs yet */
+    mainjob_wake();
+  }
+}
+
+
 
 
 #ifdef IEMNET_HAVE_DEBUG
@@ -282,6 +499,72 @@ void iemnet_debuglevel(void*x, t_float f)
   firsttime = 0;
 }
 
+void iemnet_poolstats(void*x)
+{
+  unsigned long hits = 0, misses = 0;
+  iemnet__chunkpool_stats(&hits, &misses);
+  iemnet_log(x, IEMNET_NORMAL, "chunkpool: %lu hits, %lu misses",
+             hits, misses);
+}
+
+void iemnet_sendthreads(void*x, t_symbol*s, int argc, t_atom*argv)
+{
+  int numthreads;
+  if(argc) {
+    if(argc > 1 || A_FLOAT != argv->a_type) {
+      iemnet_log(x, IEMNET_ERROR, "usage: %s [<numthreads>]", s->s_name);
+      return;
+    }
+    if(iemnet__sender_setthreads(atom_getint(argv)) < 0
+        && atom_getint(argv) >= 0) {
+      iemnet_log(x, IEMNET_ERROR, "shared send threads are not supported");
+    }
+  }
+  numthreads = iemnet__sender_getthreads();
+  if(numthreads < 0) {
+    iemnet_log(x, IEMNET_NORMAL, "using one send thread per connection");
+  } else {
+    iemnet_log(x, IEMNET_NORMAL, "using %d shared send threads", numthreads);
+  }
+}
+
+void iemnet_receivethread(void*x, t_symbol*s, int argc, t_atom*argv)
+{
+  if(argc) {
+    if(argc > 1 || A_FLOAT != argv->a_type) {
+      iemnet_log(x, IEMNET_ERROR, "usage: %s [<onoff>]", s->s_name);
+      return;
+    }
+    if(!iemnet__receiver_setthread(atom_getint(argv))
+        && atom_getint(argv)) {
+      iemnet_log(x, IEMNET_ERROR, "a shared receive thread is not supported");
+    }
+  }
+  if(iemnet__receiver_getthread()) {
+    iemnet_log(x, IEMNET_NORMAL, "reading sockets in a shared receive thread");
+  } else {
+    iemnet_log(x, IEMNET_NORMAL, "reading sockets in the main thread");
+  }
+}
+
+void iemnet_resolvercache(void*x, t_symbol*s, int argc, t_atom*argv)
+{
+  unsigned int entries = 0;
+  unsigned long hits = 0, misses = 0;
+  float ttl;
+  if(argc) {
+    if(argc > 1 || A_FLOAT != argv->a_type || atom_getfloat(argv) < 0) {
+      iemnet_log(x, IEMNET_ERROR, "usage: %s [<ttl>]", s->s_name);
+      return;
+    }
+    iemnet__resolver_setttl(atom_getfloat(argv));
+  }
+  ttl = iemnet__resolver_getstats(&entries, &hits, &misses);
+  iemnet_log(x, IEMNET_NORMAL,
+             "caching hostnames for %g seconds: %u entries, %lu hits, %lu misses",
+             ttl, entries, hits, misses);
+}
+
 int iemnet_debug(int debuglevel, const char*file, unsigned int line,
                  const char*function)
 {
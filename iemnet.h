@@ -121,10 +121,23 @@ void iemnet__sender_destroy(t_iemnet_sender*, int);
  * \param pointer to a chunk of data to be sent
  * \return the current fill state of the send buffer
  *
- * \note the sender creates a local copy of chunk; the caller has to delete their own copy
+ * \note the sender creates a local reference to chunk (sharing the payload);
+ *       the caller has to delete their own reference
  */
 int iemnet__sender_send(t_iemnet_sender*, t_iemnet_chunk*);
 
+/**
+ * send data over a socket, passing ownership of the chunk to the sender
+ *
+ * \param pointer to a sender object
+ * \param pointer to a chunk of data to be sent
+ * \return the current fill state of the send buffer
+ *
+ * \note the sender takes over the chunk (and will destroy it, even on failure);
+ *       the caller must not access it afterwards
+ */
+int iemnet__sender_send_owned(t_iemnet_sender*, t_iemnet_chunk*);
+
 /**
  * query the fill state of the send buffer
  *
@@ -133,6 +146,70 @@ int iemnet__sender_send(t_iemnet_sender*, t_iemnet_chunk*);
  */
 int iemnet__sender_getsize(t_iemnet_sender*);
 
+/**
+ * limit the size of the send buffer
+ *
+ * \param pointer to a sender object
+ * \param maxbytes maximum number of bytes waiting to be sent (0 means unlimited)
+ * \param policy what to do if sending a chunk would exceed the limit
+ *
+ * \note with IEMNET_OVERFLOW_DISCONNECT, iemnet__sender_send() will return -1
+ *       when the limit is hit (just as if the connection was lost)
+ */
+void iemnet__sender_setlimit(t_iemnet_sender*, unsigned long maxbytes,
+                             t_iemnet_overflow policy);
+
+/**
+ * configure how much data the sender handles at once
+ *
+ * the sender takes all pending chunks (up to the given limits) out of its buffer
+ * in a single go; with stream sockets they are sent with a single system call
+ * (sendmsg()), on Linux datagram sockets use sendmmsg()
+ * (each chunk is still sent as a datagram of its own).
+ *
+ * \param pointer to a sender object
+ * \param maxbytes maximum number of bytes to send at once (0 means unlimited)
+ * \param maxchunks maximum number of chunks to send at once
+ *        (0 selects the default; the value is clamped to what the system supports)
+ */
+void iemnet__sender_setbatch(t_iemnet_sender*, size_t maxbytes,
+                             unsigned int maxchunks);
+
+/**
+ * use a fixed number of shared threads for all (new) senders
+ *
+ * by default, each sender runs a thread of its own.
+ * with shared threads, the senders' sockets are multiplexed with epoll,
+ * which scales to many connections (only available on Linux).
+ * senders with a custom send function always run their own thread.
+ *
+ * \param numthreads number of shared send threads
+ *        (0 for one per CPU core; -1 to use one thread per sender)
+ * \return the number of shared send threads (-1 if disabled or unsupported)
+ *
+ * \note the shared threads are started with the first sender that uses them;
+ *       afterwards their number cannot be changed anymore
+ *       (but they can still be disabled for new senders)
+ */
+int iemnet__sender_setthreads(int numthreads);
+
+/**
+ * query the number of shared send threads
+ *
+ * \return the number of shared send threads (-1 if disabled or unsupported)
+ */
+int iemnet__sender_getthreads(void);
+
+/**
+ * query how much data was dropped because the send buffer was full
+ *
+ * \param pointer to a sender object
+ * \param chunks pointer to store the number of dropped chunks (or NULL)
+ * \param bytes pointer to store the number of dropped bytes (or NULL)
+ */
+void iemnet__sender_getdropped(t_iemnet_sender*,
+                               unsigned long*chunks, unsigned long*bytes);
+
 
 /**
  * calls connect(2) with a timeout.
@@ -143,6 +220,83 @@ int iemnet__sender_getsize(t_iemnet_sender*);
  */
 int iemnet__connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen, float timeout);
 
+/**
+ * default length of the queue of pending connections on listening sockets
+ */
+#define IEMNET_LISTEN_BACKLOG 128
+/**
+ * maximum number of connections to accept per wakeup of a listening socket
+ * (so a flood of connections doesn't stall Pd)
+ */
+#define IEMNET_ACCEPT_BUDGET 64
+
+/**
+ * calls listen(2) on a (bound) TCP socket, and makes it non-blocking,
+ * so iemnet__accept() can be called until the accept queue is empty.
+ * calling this on an already listening socket updates the settings
+ *
+ * \param sockfd the socket
+ * \param backlog length of the queue of pending connections (<=0: IEMNET_LISTEN_BACKLOG)
+ * \param deferaccept only report connections once data has arrived,
+ *        waiting at most this many seconds (0: off; only on systems with TCP_DEFER_ACCEPT)
+ * \return 0 on success, -1 on error
+ */
+int iemnet__listen(int sockfd, int backlog, int deferaccept);
+
+/**
+ * accept a pending connection on a listening socket (see iemnet__listen())
+ *
+ * \param sockfd the listening socket
+ * \param addr pointer to store the address of the peer
+ * \return the new (blocking) socket, -1 if there are no more pending connections,
+ *         or -2 if accept(2) failed
+ */
+int iemnet__accept(int sockfd, struct sockaddr_in*addr);
+
+/**
+ * opaque data type for a connection attempt running in the background
+ */
+typedef struct _iemnet_connector t_iemnet_connector;
+EXTERN_STRUCT _iemnet_connector;
+
+/**
+ * callback function for reporting the result of a connection attempt
+ *
+ * \param userdata pointer to the userdata passed to iemnet__connector_create()
+ * \param sockfd the connected (blocking) TCP socket, or -1 if the attempt failed
+ * \param addr the IPv4 address of the peer (host byte order)
+ *
+ * \note the callback takes over the socket
+ */
+typedef void (*t_iemnet_connectcallback)(void*userdata, int sockfd,
+    long addr);
+
+/**
+ * resolve a hostname and connect to it in a helper thread
+ * the result is reported via the callback (from the main thread);
+ * failures are logged on behalf of 'userdata' (which should be a Pd object)
+ *
+ * \param host the hostname to connect to
+ * \param port the TCP port to connect to
+ * \param timeout timeout in ms (see iemnet__connect())
+ * \param userdata pointer to data that is passed to the callback
+ * \param callback function to call (once) when the attempt has finished
+ * \return pointer to a connector object, or NULL if the thread could not be started
+ */
+t_iemnet_connector*iemnet__connector_create(const char*host,
+    unsigned short port, float timeout,
+    void*userdata, t_iemnet_connectcallback callback);
+
+/**
+ * destroy a connector
+ * this can be called at any time (including from within the callback);
+ * if the connection attempt is still running, it is abandoned
+ * (and the callback will not be called)
+ *
+ * \param pointer to a connector object
+ */
+void iemnet__connector_destroy(t_iemnet_connector*);
+
 
 /* iemnet_receiver.c */
 
@@ -155,6 +309,9 @@ EXTERN_STRUCT _iemnet_receiver;
  * callback function for receiving
  * whenever data arrives at the socket, a callback will be called synchronously
  * if rawdata is NULL, this signifies that the socket has been closed
+ *
+ * \note rawdata is only valid during the callback (it might borrow the
+ *       receiver's buffer); use iemnet__chunk_create_chunk() to keep a copy
  */
 typedef void (*t_iemnet_receivecallback)(void*userdata
     , t_iemnet_chunk*rawdata
@@ -170,10 +327,36 @@ typedef void (*t_iemnet_receivecallback)(void*userdata
  * \param callback a callback function that is called on the caller's side
  * \param subthread bool indicating whether this function is called from a subthread (1) or the mainthread (0)
  *
- * \note the callback will be scheduled in the caller's thread with clock_delay()
+ * \note the callback is always called from Pd's main thread
  */
 t_iemnet_receiver*iemnet__receiver_create(int sock, void*data,
     t_iemnet_receivecallback callback, int subthread);
+
+/**
+ * maximum number of receive threads for sharded sockets
+ */
+#define IEMNET_RECEIVER_MAXSHARDS 16
+
+/**
+ * create a receiver object that is read by a given receive thread
+ *
+ * this is used to spread a number of sockets (e.g. opened with SO_REUSEPORT
+ * on the same port) across several threads, regardless of whether
+ * the shared receive thread is used for other receivers.
+ * shard #0 is the shared receive thread.
+ * if receive threads are not supported (no epoll), the socket is
+ * read by the main thread (just like with iemnet__receiver_create())
+ *
+ * \param sock the (readable) socket to receive from
+ * \param data user data to be passed to callback
+ * \param callback a callback function that is called on the caller's side
+ * \param subthread bool indicating whether this function is called from a subthread (1) or the mainthread (0)
+ * \param shard the receive thread to use (modulo IEMNET_RECEIVER_MAXSHARDS)
+ *
+ * \note the callback is always called from Pd's main thread
+ */
+t_iemnet_receiver*iemnet__receiver_create_shard(int sock, void*data,
+    t_iemnet_receivecallback callback, int subthread, unsigned int shard);
 /**
  * destroy a receiver at a given socket
  * destroying a receiver will free all resources of the receiver
@@ -185,14 +368,242 @@ t_iemnet_receiver*iemnet__receiver_create(int sock, void*data,
  */
 void iemnet__receiver_destroy(t_iemnet_receiver*, int subthread);
 
+/**
+ * query how many destroyed receivers have not been freed yet
+ *
+ * receivers that are read by a receive thread are not freed immediately:
+ * the receive thread first has to let go of them,
+ * and then they are freed by Pd's main thread.
+ *
+ * \param released pointer to store how many of them have already been
+ *        released by their receive thread, and only wait for the main thread
+ *        (or NULL)
+ * \return the number of destroyed receivers that have not been freed yet
+ */
+unsigned int iemnet__receiver_getdestroyed(unsigned int*released);
+
+/**
+ * limit how much is read from the socket at once
+ *
+ * whenever the socket becomes readable, the receiver keeps reading
+ * (and calling the callback) until there is nothing left,
+ * or until the budget is spent (so a flood of data cannot starve Pd)
+ *
+ * \param pointer to a receiver object
+ * \param maxpackets maximum number of reads per tick (0 selects the default)
+ * \param maxbytes maximum number of bytes per tick (0 means unlimited)
+ */
+void iemnet__receiver_setbudget(t_iemnet_receiver*,
+                                unsigned int maxpackets, size_t maxbytes);
+
+/**
+ * query how often the receiver stopped reading because its budget was spent
+ *
+ * \param pointer to a receiver object
+ * \return the number of times the budget was exhausted
+ */
+unsigned long iemnet__receiver_getexhausted(t_iemnet_receiver*);
+
+/**
+ * set the size of the receive buffer
+ *
+ * for streams, this is the maximum number of bytes read at once;
+ * for datagrams, this is the largest datagram that is always read in full.
+ * (datagrams are read in batches of up to 16, each of them getting the
+ * full size, so the buffer takes 16 times the size; the size of the first
+ * datagram of each batch is peeked, so it is read in full even if it is
+ * larger. larger datagrams within a batch are truncated, and reported)
+ *
+ * \param pointer to a receiver object
+ * \param size the size of the buffer in bytes (0 selects the default of 64kB)
+ */
+void iemnet__receiver_setbufsize(t_iemnet_receiver*, size_t size);
+
+/**
+ * query the size of the receive buffer
+ *
+ * \param pointer to a receiver object
+ * \return the requested size of the receive buffer in bytes
+ */
+size_t iemnet__receiver_getbufsize(t_iemnet_receiver*);
+
+/**
+ * read all (new) receivers' sockets in a single shared thread
+ *
+ * by default, the sockets are polled by Pd's main thread.
+ * with the shared receive thread, the sockets are watched with epoll
+ * (only available on Linux) and read outside of the main thread;
+ * the main thread is only woken up to deliver the received chunks.
+ *
+ * \param enable whether to use the shared receive thread for new receivers
+ * \return whether the shared receive thread is used
+ */
+int iemnet__receiver_setthread(int enable);
+
+/**
+ * query whether new receivers use the shared receive thread
+ *
+ * \return whether the shared receive thread is used
+ */
+int iemnet__receiver_getthread(void);
+
+/**
+ * stop (resp. resume) reading from the socket
+ *
+ * while paused, the socket is not watched at all, so the data stays in
+ * the kernel; for TCP/IP the peer is eventually throttled by the
+ * receive window.
+ * data that has already been read is delivered after resuming
+ * (datagrams that have been read in the same batch are still delivered).
+ *
+ * \param pointer to a receiver object
+ * \param pause whether to pause (1) or resume (0) reading
+ *
+ * \note must be called from Pd's main thread
+ */
+void iemnet__receiver_pause(t_iemnet_receiver*, int pause);
+
+/**
+ * query whether reading from the socket is paused
+ *
+ * \param pointer to a receiver object
+ * \return 1 if the receiver is paused, 0 otherwise
+ */
+int iemnet__receiver_ispaused(t_iemnet_receiver*);
+
 /**
  * query the fill state of the receive buffer
  *
  * \param pointer to a receiver object
- * \return the current fill state of the receive buffer
+ * \return the number of bytes that have arrived but have not been delivered yet
+ *         (waiting in the kernel and in iemnet), or -1 if there is no receiver
  */
 int iemnet__receiver_getsize(t_iemnet_receiver*);
 
+/**
+ * query the receive-side backlog in detail
+ *
+ * \param pointer to a receiver object
+ * \param pending pointer to store the number of bytes waiting in the kernel
+ *        (FIONREAD; for datagram sockets this might only be the next datagram)
+ *        (or NULL)
+ * \param buffered pointer to store the number of bytes read by the receive
+ *        thread but not delivered yet (or NULL)
+ * \param highwater pointer to store the largest backlog (pending+buffered)
+ *        seen so far (or NULL)
+ *
+ * \note the high-water mark is sampled whenever the receive budget is spent,
+ *       whenever the receive thread has read something, and on every query
+ */
+void iemnet__receiver_getstats(t_iemnet_receiver*,
+                               unsigned long*pending, unsigned long*buffered,
+                               unsigned long*highwater);
+
+
+/* iemnet_resolver.c */
+
+/**
+ * opaque data type for a hostname lookup running in the background
+ */
+typedef struct _iemnet_resolver t_iemnet_resolver;
+EXTERN_STRUCT _iemnet_resolver;
+
+/**
+ * callback function for reporting the result of a hostname lookup
+ *
+ * \param userdata pointer to the userdata passed to iemnet__resolver_lookup()
+ * \param success 1 if the hostname could be resolved, 0 otherwise
+ * \param addr the resolved IPv4 address (host byte order)
+ */
+typedef void (*t_iemnet_resolvecallback)(void*userdata, int success,
+    uint32_t addr);
+
+/**
+ * resolve a hostname to an IPv4 address (blocking)
+ * numeric addresses and cached hostnames are answered immediately,
+ * everything else is looked up via getaddrinfo() (see iemnet__resolver_setlookup())
+ * and then cached
+ *
+ * \param host the hostname to resolve
+ * \param addr pointer to store the resolved address (host byte order)
+ * \return 1 on success, 0 if the hostname could not be resolved
+ *
+ * \note thread safe (but might block for a long time, so don't call it from the main thread)
+ */
+int iemnet__resolve(const char*host, uint32_t*addr);
+
+/**
+ * resolve a hostname to an IPv4 address without blocking
+ * if the answer is known already (numeric address or cached hostname),
+ * the callback is called before this function returns;
+ * otherwise the hostname is resolved in a helper thread (one per lookup,
+ * so a slow lookup does not hold up the others) and the callback
+ * is called later (from the main thread).
+ * if the lookup cannot be started, the callback is called right away
+ * with success=0 (the hostname is never resolved synchronously)
+ *
+ * \param host the hostname to resolve
+ * \param userdata pointer to data that is passed to the callback
+ * \param callback function to call (once) with the result
+ * \return a handle to the pending lookup (which becomes invalid once the callback is called),
+ *         or NULL if the callback has already been called
+ */
+t_iemnet_resolver*iemnet__resolver_lookup(const char*host, void*userdata,
+    t_iemnet_resolvecallback callback);
+
+/**
+ * cancel a pending lookup; its callback will not be called
+ *
+ * \param pointer to a pending lookup (or NULL)
+ */
+void iemnet__resolver_cancel(t_iemnet_resolver*);
+
+/**
+ * add a static entry to the hostname cache (that never expires),
+ * much like an entry in /etc/hosts
+ *
+ * \param host the hostname
+ * \param addr the IPv4 address (host byte order)
+ */
+void iemnet__resolver_addhost(const char*host, uint32_t addr);
+
+/**
+ * function that asks the DNS for a hostname (blocking)
+ *
+ * \param host the hostname to resolve
+ * \param addr pointer to store the resolved address (host byte order)
+ * \return 1 on success, 0 if the hostname could not be resolved
+ */
+typedef int (*t_iemnet_lookupfunction)(const char*host, uint32_t*addr);
+
+/**
+ * replace the function that asks the DNS for hostnames
+ * that are neither numeric nor cached (e.g. for testing)
+ *
+ * \param lookup the new function (or NULL to use getaddrinfo())
+ *
+ * \note the function is called from helper threads
+ */
+void iemnet__resolver_setlookup(t_iemnet_lookupfunction lookup);
+
+/**
+ * set how long resolved hostnames are cached
+ *
+ * \param ttl time to live in seconds (0 disables the cache)
+ */
+void iemnet__resolver_setttl(float ttl);
+
+/**
+ * query the hostname cache
+ *
+ * \param entries pointer to store the number of cached hostnames (or NULL)
+ * \param hits pointer to store the number of lookups answered from the cache (or NULL)
+ * \param misses pointer to store the number of lookups that had to ask the resolver (or NULL)
+ * \return the time to live of cache entries in seconds
+ */
+float iemnet__resolver_getstats(unsigned int*entries,
+                                unsigned long*hits, unsigned long*misses);
+
 
 /* convenience functions */
 
@@ -288,6 +699,61 @@ void iemnet__numconnout(t_outlet*status_outlet, t_outlet*numconn_outlet,
  */
 void iemnet__streamout(t_outlet*outlet, int argc, t_atom*argv, int stream);
 
+/**
+ * parse the arguments of a 'sendlimit' message
+ * 'sendlimit [<maxbytes> [<policy>]]'
+ * where <policy> is one of 'dropnewest', 'dropoldest' or 'disconnect'
+ *
+ * \param x the object (for error messages)
+ * \param s the selector (for error messages)
+ * \param argc number of arguments
+ * \param argv arguments
+ * \param maxbytes pointer to store the new limit to
+ * \param policy pointer to store the new policy to (left untouched if none is given)
+ * \return 1 if the limit has been set, 0 if there were no arguments, -1 on error
+ */
+int iemnet__sendlimit_parse(const void*x, t_symbol*s, int argc,
+                            t_atom*argv,
+                            unsigned long*maxbytes, t_iemnet_overflow*policy);
+
+/**
+ * parse the arguments of a 'receivebudget' message
+ * 'receivebudget [<maxpackets> [<maxbytes>]]'
+ *
+ * \param x the object (for error messages)
+ * \param s the selector (for error messages)
+ * \param argc number of arguments
+ * \param argv arguments
+ * \param maxpackets pointer to store the new packet budget to
+ * \param maxbytes pointer to store the new byte budget to (left untouched if none is given)
+ * \return 1 if the budget has been set, 0 if there were no arguments, -1 on error
+ */
+int iemnet__receivebudget_parse(const void*x, t_symbol*s, int argc,
+                                t_atom*argv,
+                                unsigned int*maxpackets, unsigned long*maxbytes);
+
+/**
+ * parse the arguments of a 'recvbufsize' message
+ * 'recvbufsize [<bytes>]'
+ *
+ * \param x the object (for error messages)
+ * \param s the selector (for error messages)
+ * \param argc number of arguments
+ * \param argv arguments
+ * \param bufsize pointer to store the new buffer size to
+ * \return 1 if the size has been set, 0 if there were no arguments, -1 on error
+ */
+int iemnet__recvbufsize_parse(const void*x, t_symbol*s, int argc,
+                              t_atom*argv, unsigned long*bufsize);
+
+/**
+ * get the name of an overflow policy
+ *
+ * \param policy the overflow policy
+ * \return the name as used by iemnet__sendlimit_parse()
+ */
+t_symbol*iemnet__overflow2symbol(t_iemnet_overflow policy);
+
 /**
  * register an objectname and printout a banner
  *
@@ -300,6 +766,45 @@ void iemnet__streamout(t_outlet*outlet, int argc, t_atom*argv, int stream);
  */
 int iemnet__register(const char*name);
 
+/**
+ * a job to be run in Pd's main thread (see iemnet__mainjob_post())
+ * embed it into your own data, which must stay valid until the job has run
+ */
+typedef struct _iemnet_mainjob t_iemnet_mainjob;
+/**
+ * function that runs a job (in Pd's main thread)
+ *
+ * \param userdata pointer to the userdata passed to iemnet__mainjob_post()
+ */
+typedef void (*t_iemnet_mainjobfn)(void*userdata);
+struct _iemnet_mainjob {
+  t_iemnet_mainjob*next;
+  t_iemnet_mainjobfn fn;
+  void*userdata;
+};
+
+/**
+ * prepare Pd's main thread for running jobs posted by helper threads
+ * this must be called (at least once) before posting any job
+ *
+ * \return 1 on success, 0 if the main thread cannot be woken up
+ *
+ * \note must be called from the main thread, or with the Pd-lock held
+ */
+int iemnet__mainjob_start(void);
+
+/**
+ * have a function called in Pd's main thread
+ * this can be called from any thread and never takes the Pd-lock;
+ * the jobs are run (in the order they were posted) as soon as possible
+ *
+ * \param job the job to post (it must not be posted again before it has run)
+ * \param fn the function to call
+ * \param userdata pointer to data that is passed to the function
+ */
+void iemnet__mainjob_post(t_iemnet_mainjob*job, t_iemnet_mainjobfn fn,
+                          void*userdata);
+
 
 #if defined(_MSC_VER)
 # define snprintf _snprintf
@@ -339,6 +844,20 @@ int iemnet_debug(int debuglevel, const char*file, unsigned int line,
                  const char*function);
 #define DEBUGMETHOD(c) class_addmethod(c, (t_method)iemnet_debuglevel, gensym("debug"), A_FLOAT, 0)
 
+/* print the chunk pool statistics (hits/misses) to the Pd-console */
+void iemnet_poolstats(void*);
+#define POOLSTATSMETHOD(c) class_addmethod(c, (t_method)iemnet_poolstats, gensym("poolstats"), 0)
+
+/* set/query the number of shared send threads (for all senders) */
+void iemnet_sendthreads(void*, t_symbol*, int, t_atom*);
+#define SENDTHREADSMETHOD(c) class_addmethod(c, (t_method)iemnet_sendthreads, gensym("sendthreads"), A_GIMME, 0)
+/* enable/query the shared receive thread (for all receivers) */
+void iemnet_receivethread(void*, t_symbol*, int, t_atom*);
+#define RECEIVETHREADMETHOD(c) class_addmethod(c, (t_method)iemnet_receivethread, gensym("receivethread"), A_GIMME, 0)
+/* set/query the hostname cache (for all objects) */
+void iemnet_resolvercache(void*, t_symbol*, int, t_atom*);
+#define RESOLVERCACHEMETHOD(c) class_addmethod(c, (t_method)iemnet_resolvercache, gensym("resolvercache"), A_GIMME, 0)
+
 
 
 #ifdef DEBUG
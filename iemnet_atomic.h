@@ -0,0 +1,146 @@
+/* *********************************************+
+ * iemnet
+ *     networking for Pd
+ *
+ *  (c) 2010-2024 IOhannes m zmölnig
+ *           Institute of Electronic Music and Acoustics (IEM)
+ *           University of Music and Dramatic Arts (KUG), Graz, Austria
+ *
+ *  atomic operations
+ *   thin wrappers around the compiler's atomic builtins
+ *   private to the core lib, no need to worry about them outside
+ */
+
+/* ---------------------------------------------------------------------------- */
+
+/* This program is free software; you can redistribute it and/or                */
+/* modify it under the terms of the GNU General Public License                  */
+/* as published by the Free Software Foundation; either version 2               */
+/* of the License, or (at your option) any later version.                       */
+/*                                                                              */
+/* This program is distributed in the hope that it will be useful,              */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of               */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                */
+/* GNU General Public License for more details.                                 */
+/*                                                                              */
+/* You should have received a copy of the GNU General Public License            */
+/* along with this program; if not, see                                         */
+/*     http://www.gnu.org/licenses/                                             */
+/*                                                                              */
+
+/* ---------------------------------------------------------------------------- */
+#ifndef INCLUDE__IEMNET_ATOMIC_H_
+#define INCLUDE__IEMNET_ATOMIC_H_
+
+/*
+ * all loads have acquire semantics, all stores have release semantics,
+ * read-modify-write operations (add, swap, cas) are sequentially consistent.
+ * use iemnet_atomic_fence() where a store must be visible before a
+ * subsequent load (e.g. when deciding whether a waiter needs to be woken up)
+ */
+
+#if defined(_MSC_VER)
+# include <windows.h>
+# define IEMNET_INLINE __inline
+
+static IEMNET_INLINE long iemnet_atomic_get(volatile long*p)
+{
+  long v = *p;
+  MemoryBarrier();
+  return v;
+}
+static IEMNET_INLINE void iemnet_atomic_set(volatile long*p, long v)
+{
+  MemoryBarrier();
+  *p = v;
+}
+/* returns the new value */
+static IEMNET_INLINE long iemnet_atomic_add(volatile long*p, long v)
+{
+  return InterlockedExchangeAdd(p, v) + v;
+}
+/* returns 1 if *p was 'expected' (and is now 'desired'), 0 otherwise */
+static IEMNET_INLINE int iemnet_atomic_cas(volatile long*p, long expected,
+    long desired)
+{
+  return (InterlockedCompareExchange(p, desired, expected) == expected);
+}
+static IEMNET_INLINE void*iemnet_atomic_getptr(void*volatile*p)
+{
+  void*v = *p;
+  MemoryBarrier();
+  return v;
+}
+static IEMNET_INLINE void iemnet_atomic_setptr(void*volatile*p, void*v)
+{
+  MemoryBarrier();
+  *p = v;
+}
+/* returns the old value */
+static IEMNET_INLINE void*iemnet_atomic_swapptr(void*volatile*p, void*v)
+{
+  return InterlockedExchangePointer(p, v);
+}
+static IEMNET_INLINE int iemnet_atomic_casptr(void*volatile*p,
+    void*expected, void*desired)
+{
+  return (InterlockedCompareExchangePointer(p, desired,
+          expected) == expected);
+}
+static IEMNET_INLINE void iemnet_atomic_fence(void)
+{
+  MemoryBarrier();
+}
+
+#elif defined(__GNUC__)
+# define IEMNET_INLINE inline
+
+static IEMNET_INLINE long iemnet_atomic_get(volatile long*p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static IEMNET_INLINE void iemnet_atomic_set(volatile long*p, long v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+/* returns the new value */
+static IEMNET_INLINE long iemnet_atomic_add(volatile long*p, long v)
+{
+  return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+/* returns 1 if *p was 'expected' (and is now 'desired'), 0 otherwise */
+static IEMNET_INLINE int iemnet_atomic_cas(volatile long*p, long expected,
+    long desired)
+{
+  return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static IEMNET_INLINE void*iemnet_atomic_getptr(void*volatile*p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static IEMNET_INLINE void iemnet_atomic_setptr(void*volatile*p, void*v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+/* returns the old value */
+static IEMNET_INLINE void*iemnet_atomic_swapptr(void*volatile*p, void*v)
+{
+  return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+static IEMNET_INLINE int iemnet_atomic_casptr(void*volatile*p,
+    void*expected, void*desired)
+{
+  return __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static IEMNET_INLINE void iemnet_atomic_fence(void)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#else
+# error "iemnet needs atomic operations; unsupported compiler"
+#endif
+
+#endif /* INCLUDE__IEMNET_ATOMIC_H_ */
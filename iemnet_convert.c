@@ -0,0 +1,334 @@
+/* iemnet
+ *
+ * data conversion code
+ *  - converting Pd atoms to bytes (and back)
+ *
+ *  copyright © 2010-2024 IOhannes m zmölnig, IEM
+ */
+
+/* This program is free software; you can redistribute it and/or                */
+/* modify it under the terms of the GNU General Public License                  */
+/* as published by the Free Software Foundation; either version 2               */
+/* of the License, or (at your option) any later version.                       */
+/*                                                                              */
+/* This program is distributed in the hope that it will be useful,              */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of               */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                */
+/* GNU General Public License for more details.                                 */
+/*                                                                              */
+/* You should have received a copy of the GNU General Public License            */
+/* along with this program; if not, see                                         */
+/*     http://www.gnu.org/licenses/                                             */
+/*                                                                              */
+
+#define DEBUGLEVEL 8
+
+#include "iemnet.h"
+#include "iemnet_data.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * converting between atoms and bytes is done for every single byte
+ * that goes through iemnet, so we try to do it with vector instructions.
+ *
+ * the implementation is chosen once (on first use), depending on the CPU.
+ * the vectorized versions write/read whole atoms, so they are only used
+ * if the t_atom layout is the one we expect (a 32bit type-tag followed by
+ * a 32bit float at offset 8; that is: a 64bit single-precision Pd);
+ * everything else uses the scalar fallback.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define IEMNET_CONVERT_SSE2 1
+# include <emmintrin.h>
+#endif
+
+#if defined(IEMNET_CONVERT_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define IEMNET_CONVERT_AVX2 1
+# include <immintrin.h>
+# define IEMNET_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define IEMNET_CONVERT_NEON 1
+# include <arm_neon.h>
+#endif
+
+typedef struct _iemnet_convert {
+  const char*name;
+  void (*atoms2bytes)(unsigned char*dest, const t_atom*src, unsigned int n);
+  void (*bytes2atoms)(t_atom*dest, const unsigned char*src, unsigned int n);
+} t_iemnet_convert;
+
+
+/* ---------------------------- scalar ---------------------------- */
+static unsigned char atom2byte(const t_atom*a)
+{
+  t_float f = (A_FLOAT == a->a_type)?a->a_w.w_float:0;
+  /* this also catches NaN */
+  if(!(f > 0)) {
+    return 0;
+  }
+  if(f >= 255) {
+    return 255;
+  }
+  return (unsigned char)f;
+}
+static void atoms2bytes_scalar(unsigned char*dest, const t_atom*src,
+                               unsigned int n)
+{
+  unsigned int i;
+  for(i = 0; i<n; i++) {
+    dest[i] = atom2byte(src + i);
+  }
+}
+static void bytes2atoms_scalar(t_atom*dest, const unsigned char*src,
+                               unsigned int n)
+{
+  unsigned int i;
+  for(i = 0; i<n; i++) {
+    SETFLOAT(dest + i, src[i]);
+  }
+}
+static const t_iemnet_convert convert_scalar = {
+  "scalar", atoms2bytes_scalar, bytes2atoms_scalar
+};
+
+
+/* ---------------------------- SSE2 ---------------------------- */
+#ifdef IEMNET_CONVERT_SSE2
+/* 4 atoms -> 4 clamped int32 */
+static __m128i atoms2int_sse2(const t_atom*src)
+{
+  const __m128i*a = (const __m128i*)src;
+  const __m128i a0 = _mm_loadu_si128(a + 0);
+  const __m128i a1 = _mm_loadu_si128(a + 1);
+  const __m128i a2 = _mm_loadu_si128(a + 2);
+  const __m128i a3 = _mm_loadu_si128(a + 3);
+  /* [type0 type1 - -], [float0 float1 - -] */
+  const __m128i t01 = _mm_unpacklo_epi32(a0, a1);
+  const __m128i f01 = _mm_unpackhi_epi32(a0, a1);
+  const __m128i t23 = _mm_unpacklo_epi32(a2, a3);
+  const __m128i f23 = _mm_unpackhi_epi32(a2, a3);
+  const __m128i isfloat = _mm_cmpeq_epi32(_mm_unpacklo_epi64(t01, t23),
+                                          _mm_set1_epi32(A_FLOAT));
+  __m128 f = _mm_castsi128_ps(_mm_and_si128(_mm_unpacklo_epi64(f01, f23),
+                              isfloat));
+  /* _mm_max_ps() returns the 2nd operand for NaN */
+  f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(255.f));
+  return _mm_cvttps_epi32(f);
+}
+static void atoms2bytes_sse2(unsigned char*dest, const t_atom*src,
+                             unsigned int n)
+{
+  unsigned int i = 0;
+  for(i = 0; i + 16 <= n; i += 16) {
+    const __m128i b0 = atoms2int_sse2(src + i + 0);
+    const __m128i b1 = atoms2int_sse2(src + i + 4);
+    const __m128i b2 = atoms2int_sse2(src + i + 8);
+    const __m128i b3 = atoms2int_sse2(src + i + 12);
+    _mm_storeu_si128((__m128i*)(dest + i),
+                     _mm_packus_epi16(_mm_packs_epi32(b0, b1),
+                                      _mm_packs_epi32(b2, b3)));
+  }
+  atoms2bytes_scalar(dest + i, src + i, n - i);
+}
+/* 4 int32 -> 4 float atoms */
+static void int2atoms_sse2(t_atom*dest, __m128i d)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i type = _mm_set_epi32(0, A_FLOAT, 0, A_FLOAT);
+  const __m128i f = _mm_castps_si128(_mm_cvtepi32_ps(d));
+  /* [float0 0 float1 0], [float2 0 float3 0] */
+  const __m128i flo = _mm_unpacklo_epi32(f, zero);
+  const __m128i fhi = _mm_unpackhi_epi32(f, zero);
+  __m128i*a = (__m128i*)dest;
+  _mm_storeu_si128(a + 0, _mm_unpacklo_epi64(type, flo));
+  _mm_storeu_si128(a + 1, _mm_unpackhi_epi64(type, flo));
+  _mm_storeu_si128(a + 2, _mm_unpacklo_epi64(type, fhi));
+  _mm_storeu_si128(a + 3, _mm_unpackhi_epi64(type, fhi));
+}
+static void bytes2atoms_sse2(t_atom*dest, const unsigned char*src,
+                             unsigned int n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  unsigned int i = 0;
+  for(i = 0; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    const __m128i w0 = _mm_unpacklo_epi8(v, zero);
+    const __m128i w1 = _mm_unpackhi_epi8(v, zero);
+    int2atoms_sse2(dest + i + 0, _mm_unpacklo_epi16(w0, zero));
+    int2atoms_sse2(dest + i + 4, _mm_unpackhi_epi16(w0, zero));
+    int2atoms_sse2(dest + i + 8, _mm_unpacklo_epi16(w1, zero));
+    int2atoms_sse2(dest + i + 12, _mm_unpackhi_epi16(w1, zero));
+  }
+  bytes2atoms_scalar(dest + i, src + i, n - i);
+}
+static const t_iemnet_convert convert_sse2 = {
+  "SSE2", atoms2bytes_sse2, bytes2atoms_sse2
+};
+#endif /* SSE2 */
+
+
+/* ---------------------------- AVX2 ---------------------------- */
+#ifdef IEMNET_CONVERT_AVX2
+/* 8 int32 -> 8 float atoms */
+IEMNET_TARGET_AVX2
+static void int2atoms_avx2(t_atom*dest, __m256i d)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i type = _mm256_set_epi32(0, A_FLOAT, 0, A_FLOAT,
+                                        0, A_FLOAT, 0, A_FLOAT);
+  const __m256i f = _mm256_castps_si256(_mm256_cvtepi32_ps(d));
+  /* unpacking works per 128bit lane:
+   * [float0 0 float1 0 | float4 0 float5 0], [float2 0 float3 0 | float6 0 float7 0] */
+  const __m256i flo = _mm256_unpacklo_epi32(f, zero);
+  const __m256i fhi = _mm256_unpackhi_epi32(f, zero);
+  /* [atom0|atom4], [atom1|atom5], [atom2|atom6], [atom3|atom7] */
+  const __m256i a04 = _mm256_unpacklo_epi64(type, flo);
+  const __m256i a15 = _mm256_unpackhi_epi64(type, flo);
+  const __m256i a26 = _mm256_unpacklo_epi64(type, fhi);
+  const __m256i a37 = _mm256_unpackhi_epi64(type, fhi);
+  __m256i*a = (__m256i*)dest;
+  _mm256_storeu_si256(a + 0, _mm256_permute2x128_si256(a04, a15, 0x20));
+  _mm256_storeu_si256(a + 1, _mm256_permute2x128_si256(a26, a37, 0x20));
+  _mm256_storeu_si256(a + 2, _mm256_permute2x128_si256(a04, a15, 0x31));
+  _mm256_storeu_si256(a + 3, _mm256_permute2x128_si256(a26, a37, 0x31));
+}
+IEMNET_TARGET_AVX2
+static void bytes2atoms_avx2(t_atom*dest, const unsigned char*src,
+                             unsigned int n)
+{
+  unsigned int i = 0;
+  for(i = 0; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    int2atoms_avx2(dest + i + 0, _mm256_cvtepu8_epi32(v));
+    int2atoms_avx2(dest + i + 8, _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+  }
+  bytes2atoms_scalar(dest + i, src + i, n - i);
+}
+/* reading atoms is a strided gather, which AVX2 doesn't do any faster
+ * than SSE2; so only the expansion gets the wider registers */
+static const t_iemnet_convert convert_avx2 = {
+  "AVX2", atoms2bytes_sse2, bytes2atoms_avx2
+};
+#endif /* AVX2 */
+
+
+/* ---------------------------- NEON ---------------------------- */
+#ifdef IEMNET_CONVERT_NEON
+/* 4 atoms -> 4 clamped uint32 */
+static uint32x4_t atoms2int_neon(const t_atom*src)
+{
+  /* de-interleaves into [types], [-], [floats], [-] */
+  const uint32x4x4_t a = vld4q_u32((const uint32_t*)src);
+  uint32x4_t isfloat = vceqq_u32(a.val[0], vdupq_n_u32(A_FLOAT));
+  float32x4_t f = vreinterpretq_f32_u32(a.val[2]);
+  /* NaN != NaN */
+  isfloat = vandq_u32(isfloat, vceqq_f32(f, f));
+  f = vreinterpretq_f32_u32(vandq_u32(a.val[2], isfloat));
+  f = vminq_f32(vmaxq_f32(f, vdupq_n_f32(0.f)), vdupq_n_f32(255.f));
+  return vcvtq_u32_f32(f);
+}
+static void atoms2bytes_neon(unsigned char*dest, const t_atom*src,
+                             unsigned int n)
+{
+  unsigned int i = 0;
+  for(i = 0; i + 16 <= n; i += 16) {
+    const uint16x8_t w0 = vcombine_u16(vmovn_u32(atoms2int_neon(src + i + 0)),
+                                       vmovn_u32(atoms2int_neon(src + i + 4)));
+    const uint16x8_t w1 = vcombine_u16(vmovn_u32(atoms2int_neon(src + i + 8)),
+                                       vmovn_u32(atoms2int_neon(src + i + 12)));
+    vst1q_u8(dest + i, vcombine_u8(vmovn_u16(w0), vmovn_u16(w1)));
+  }
+  atoms2bytes_scalar(dest + i, src + i, n - i);
+}
+/* 4 uint32 -> 4 float atoms */
+static void int2atoms_neon(t_atom*dest, uint32x4_t d)
+{
+  uint32x4x4_t a;
+  a.val[0] = vdupq_n_u32(A_FLOAT);
+  a.val[1] = vdupq_n_u32(0);
+  a.val[2] = vreinterpretq_u32_f32(vcvtq_f32_u32(d));
+  a.val[3] = a.val[1];
+  /* interleaves into [type 0 float 0] */
+  vst4q_u32((uint32_t*)dest, a);
+}
+static void bytes2atoms_neon(t_atom*dest, const unsigned char*src,
+                             unsigned int n)
+{
+  unsigned int i = 0;
+  for(i = 0; i + 16 <= n; i += 16) {
+    const uint8x16_t v = vld1q_u8(src + i);
+    const uint16x8_t w0 = vmovl_u8(vget_low_u8(v));
+    const uint16x8_t w1 = vmovl_u8(vget_high_u8(v));
+    int2atoms_neon(dest + i + 0, vmovl_u16(vget_low_u16(w0)));
+    int2atoms_neon(dest + i + 4, vmovl_u16(vget_high_u16(w0)));
+    int2atoms_neon(dest + i + 8, vmovl_u16(vget_low_u16(w1)));
+    int2atoms_neon(dest + i + 12, vmovl_u16(vget_high_u16(w1)));
+  }
+  bytes2atoms_scalar(dest + i, src + i, n - i);
+}
+static const t_iemnet_convert convert_neon = {
+  "NEON", atoms2bytes_neon, bytes2atoms_neon
+};
+#endif /* NEON */
+
+
+/* ---------------------------- dispatch ---------------------------- */
+static const t_iemnet_convert*convert_impl = &convert_scalar;
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static int convert_vectorizable(void)
+{
+  return (16 == sizeof(t_atom))
+         && (4 == sizeof(t_atomtype))
+         && (4 == sizeof(t_float))
+         && (8 == offsetof(t_atom, a_w));
+}
+
+static void convert_select(void)
+{
+  const t_iemnet_convert*impl = &convert_scalar;
+  if(convert_vectorizable()) {
+#ifdef IEMNET_CONVERT_SSE2
+    impl = &convert_sse2;
+#endif
+#ifdef IEMNET_CONVERT_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+      impl = &convert_avx2;
+    }
+#endif
+#ifdef IEMNET_CONVERT_NEON
+    impl = &convert_neon;
+#endif
+  }
+  DEBUG("using %s conversion", impl->name);
+  convert_impl = impl;
+}
+
+static const t_iemnet_convert*convert_get(void)
+{
+  pthread_once(&convert_once, convert_select);
+  return convert_impl;
+}
+
+void iemnet__convert_atoms2bytes(unsigned char*dest, const t_atom*src,
+                                 unsigned int n)
+{
+  convert_get()->atoms2bytes(dest, src, n);
+}
+
+void iemnet__convert_bytes2atoms(t_atom*dest, const unsigned char*src,
+                                 unsigned int n)
+{
+  convert_get()->bytes2atoms(dest, src, n);
+}
+
+const char*iemnet__convert_name(void)
+{
+  return convert_get()->name;
+}
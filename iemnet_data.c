@@ -26,11 +26,13 @@
 
 #include "iemnet.h"
 #include "iemnet_data.h"
+#include "iemnet_atomic.h"
 
 #include <stdlib.h>
 
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include <sys/types.h>
 
@@ -96,6 +98,7 @@ t_iemnet_floatlist*iemnet__floatlist_create(unsigned int size)
 t_iemnet_floatlist*iemnet__floatlist_resize(t_iemnet_floatlist*cl,
     unsigned int size)
 {
+  unsigned int argc = size;
   t_atom*tmp;
   if (NULL == cl) {
     return iemnet__floatlist_create(size);
@@ -106,6 +109,14 @@ t_iemnet_floatlist*iemnet__floatlist_resize(t_iemnet_floatlist*cl,
     return cl;
   }
 
+  /* grow exponentially, so we don't have to re-allocate for each
+   * slightly bigger chunk */
+  if(size < 2 * cl->size) {
+    size = 2 * cl->size;
+  }
+
+  /* no need to preserve (or initialize) the old content:
+   * iemnet__chunk2list() overwrites the atoms anyhow */
   tmp = (t_atom*)malloc(size*sizeof(t_atom));
   if(NULL == tmp) {
     return NULL;
@@ -114,27 +125,343 @@ t_iemnet_floatlist*iemnet__floatlist_resize(t_iemnet_floatlist*cl,
   free(cl->argv);
 
   cl->argv = tmp;
-  cl->argc = cl->size = size;
-
-  cl = iemnet__floatlist_init(cl);
+  cl->argc = argc;
+  cl->size = size;
 
   return cl;
 }
 
+/* chunk pool
+ *
+ * chunks are allocated as a single block (the t_iemnet_chunk header
+ * immediately followed by the payload), rounded up to a number of
+ * size classes.
+ * released chunks are kept in per-thread free lists, so in a steady state
+ * no memory has to be allocated at all.
+ *
+ * each thread that allocates chunks owns a pool;
+ * chunks released in the owning thread go straight back into the free list,
+ * chunks released in any other thread (e.g. the sender thread) are pushed
+ * onto a lock-free "remote" stack of the owning pool, which the owner
+ * picks up the next time its free list runs dry.
+ *
+ * when a thread terminates, its pool cannot be freed (there might still be
+ * chunks out there that will be returned to it), so it is 'orphaned' and
+ * handed to the next thread that needs a pool.
+ */
+
+#define CHUNKPOOL_NUMCLASSES 7
+static const size_t chunkpool_classsize[CHUNKPOOL_NUMCLASSES] = {
+  0, /* envelopes without payload (see iemnet__chunk_share()) */
+  64, 256, 1024, 4096, 16384, INBUFSIZE
+};
+/* maximum number of chunks to keep (per class and thread) */
+static const unsigned int chunkpool_classmax[CHUNKPOOL_NUMCLASSES] = {
+  4096, 1024, 512, 256, 64, 16, 8
+};
+
+/* the 'sizeclass' of chunks that do not own their payload
+ * (see iemnet__chunk_borrow()) */
+#define CHUNK_BORROWED -2
+
+typedef struct _iemnet_chunkpool {
+  /* only touched by the owning thread */
+  t_iemnet_chunk*freelist[CHUNKPOOL_NUMCLASSES];
+  unsigned int count[CHUNKPOOL_NUMCLASSES];
+
+  /* chunks released by other threads */
+  void*volatile remote[CHUNKPOOL_NUMCLASSES];
+
+  volatile long hits;
+  volatile long misses;
+  volatile long orphaned; /* the owning thread has terminated */
+
+  struct _iemnet_chunkpool*next; /* list of all pools */
+} t_iemnet_chunkpool;
+
+static pthread_key_t chunkpool_key;
+static pthread_once_t chunkpool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t chunkpool_mtx = PTHREAD_MUTEX_INITIALIZER;
+static t_iemnet_chunkpool*chunkpool_all = NULL;
+/* statistics of the terminated threads (protected by chunkpool_mtx) */
+static unsigned long chunkpool_deadhits = 0;
+static unsigned long chunkpool_deadmisses = 0;
+
+static int chunkpool_getclass(size_t size)
+{
+  int i;
+  for(i = 0; i<CHUNKPOOL_NUMCLASSES; i++) {
+    if(size <= chunkpool_classsize[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void chunkpool_freelist(t_iemnet_chunk*c)
+{
+  while(c) {
+    t_iemnet_chunk*next = c->next;
+    free(c);
+    c = next;
+  }
+}
+
+/* move the chunks released by other threads into the free list
+ * (only call this from the owning thread) */
+static void chunkpool_pickup(t_iemnet_chunkpool*pool, int sizeclass)
+{
+  t_iemnet_chunk*r = (t_iemnet_chunk*)iemnet_atomic_swapptr(
+                       &pool->remote[sizeclass], NULL);
+  while(r) {
+    t_iemnet_chunk*next = r->next;
+    if(pool->count[sizeclass] < chunkpool_classmax[sizeclass]) {
+      r->next = pool->freelist[sizeclass];
+      pool->freelist[sizeclass] = r;
+      pool->count[sizeclass]++;
+    } else {
+      free(r);
+    }
+    r = next;
+  }
+}
+
+/* called when a thread that owns a pool terminates */
+static void chunkpool_orphan(void*p)
+{
+  t_iemnet_chunkpool*pool = (t_iemnet_chunkpool*)p;
+  int i;
+  for(i = 0; i<CHUNKPOOL_NUMCLASSES; i++) {
+    chunkpool_freelist(pool->freelist[i]);
+    pool->freelist[i] = NULL;
+    pool->count[i] = 0;
+  }
+  pthread_mutex_lock(&chunkpool_mtx);
+  chunkpool_deadhits += iemnet_atomic_get(&pool->hits);
+  chunkpool_deadmisses += iemnet_atomic_get(&pool->misses);
+  iemnet_atomic_set(&pool->hits, 0);
+  iemnet_atomic_set(&pool->misses, 0);
+  /* from now on, the pool may be adopted by another thread */
+  iemnet_atomic_set(&pool->orphaned, 1);
+  pthread_mutex_unlock(&chunkpool_mtx);
+  iemnet_atomic_fence();
+  for(i = 0; i<CHUNKPOOL_NUMCLASSES; i++) {
+    chunkpool_freelist((t_iemnet_chunk*)iemnet_atomic_swapptr(
+                         &pool->remote[i], NULL));
+  }
+}
+static void chunkpool_init(void)
+{
+  pthread_key_create(&chunkpool_key, chunkpool_orphan);
+}
+
+/* get the pool of the calling thread (creating it if needed) */
+static t_iemnet_chunkpool*chunkpool_get(void)
+{
+  t_iemnet_chunkpool*pool = NULL;
+  pthread_once(&chunkpool_once, chunkpool_init);
+  pool = (t_iemnet_chunkpool*)pthread_getspecific(chunkpool_key);
+  if(pool) {
+    return pool;
+  }
+
+  /* re-use the pool of a terminated thread */
+  pthread_mutex_lock(&chunkpool_mtx);
+  for(pool = chunkpool_all; pool; pool = pool->next) {
+    if(iemnet_atomic_cas(&pool->orphaned, 1, 0)) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&chunkpool_mtx);
+  if(pool) {
+    int i;
+    for(i = 0; i<CHUNKPOOL_NUMCLASSES; i++) {
+      chunkpool_pickup(pool, i);
+    }
+    pthread_setspecific(chunkpool_key, pool);
+    return pool;
+  }
+
+  pool = (t_iemnet_chunkpool*)calloc(1, sizeof(*pool));
+  if(NULL == pool) {
+    return NULL;
+  }
+  pthread_setspecific(chunkpool_key, pool);
+  pthread_mutex_lock(&chunkpool_mtx);
+  pool->next = chunkpool_all;
+  chunkpool_all = pool;
+  pthread_mutex_unlock(&chunkpool_mtx);
+  return pool;
+}
+
+/* allocate a chunk that can hold 'size' bytes
+ * the payload is left uninitialized
+ */
+static t_iemnet_chunk*chunkpool_alloc(size_t size)
+{
+  t_iemnet_chunkpool*pool = chunkpool_get();
+  t_iemnet_chunk*c = NULL;
+  int sizeclass = chunkpool_getclass(size);
+
+  if(pool && sizeclass >= 0) {
+    if(!pool->freelist[sizeclass]) {
+      /* pick up the chunks that have been released by other threads */
+      chunkpool_pickup(pool, sizeclass);
+    }
+    if((c = pool->freelist[sizeclass])) {
+      pool->freelist[sizeclass] = c->next;
+      pool->count[sizeclass]--;
+      pool->hits++;
+    } else {
+      pool->misses++;
+      c = (t_iemnet_chunk*)malloc(sizeof(t_iemnet_chunk)
+                                  + chunkpool_classsize[sizeclass]);
+    }
+  } else {
+    /* too large to be pooled */
+    if(pool) {
+      pool->misses++;
+    }
+    c = (t_iemnet_chunk*)malloc(sizeof(t_iemnet_chunk) + size);
+    pool = NULL;
+  }
+  if(NULL == c) {
+    return NULL;
+  }
+  c->data = (unsigned char*)(c + 1);
+  c->size = size;
+  c->addr = 0L;
+  c->port = 0;
+  c->family = AF_INET;
+  c->atoms = NULL;
+  c->refcount = 1;
+  c->shared = NULL;
+  c->pool = pool;
+  c->sizeclass = sizeclass;
+  c->next = NULL;
+  return c;
+}
+
+static void chunkpool_release(t_iemnet_chunk*c)
+{
+  t_iemnet_chunkpool*pool = (t_iemnet_chunkpool*)c->pool;
+  int sizeclass = c->sizeclass;
+  if(c->atoms) {
+    free(c->atoms);
+    c->atoms = NULL;
+  }
+  if(NULL == pool) {
+    free(c);
+    return;
+  }
+  if(pool == pthread_getspecific(chunkpool_key)) {
+    /* we are the owner */
+    if(pool->count[sizeclass] < chunkpool_classmax[sizeclass]) {
+      c->next = pool->freelist[sizeclass];
+      pool->freelist[sizeclass] = c;
+      pool->count[sizeclass]++;
+    } else {
+      free(c);
+    }
+    return;
+  }
+
+  /* return the chunk to the owner */
+  do {
+    c->next = (t_iemnet_chunk*)iemnet_atomic_getptr(&pool->remote[sizeclass]);
+  } while(!iemnet_atomic_casptr(&pool->remote[sizeclass], c->next, c));
+
+  if(iemnet_atomic_get(&pool->orphaned)) {
+    /* nobody is going to pick it up */
+    chunkpool_freelist((t_iemnet_chunk*)iemnet_atomic_swapptr(
+                         &pool->remote[sizeclass], NULL));
+  }
+}
+
+void iemnet__chunkpool_stats(unsigned long*hits, unsigned long*misses)
+{
+  t_iemnet_chunkpool*pool = NULL;
+  unsigned long h, m;
+  pthread_mutex_lock(&chunkpool_mtx);
+  h = chunkpool_deadhits;
+  m = chunkpool_deadmisses;
+  for(pool = chunkpool_all; pool; pool = pool->next) {
+    h += iemnet_atomic_get(&pool->hits);
+    m += iemnet_atomic_get(&pool->misses);
+  }
+  pthread_mutex_unlock(&chunkpool_mtx);
+  if(hits) {
+    *hits = h;
+  }
+  if(misses) {
+    *misses = m;
+  }
+}
+
+
+/* drop a reference to a chunk, and free it if it was the last one */
+static void chunk_unref(t_iemnet_chunk*c)
+{
+  /* if we hold the only reference, nobody else can add one */
+  if(1 == iemnet_atomic_get(&c->refcount)
+      || 0 == iemnet_atomic_add(&c->refcount, -1)) {
+    chunkpool_release(c);
+  }
+}
+
 void iemnet__chunk_destroy(t_iemnet_chunk*c)
 {
+  t_iemnet_chunk*shared = NULL;
   if(NULL == c) {
     return;
   }
 
-  if(c->data) {
-    free(c->data);
+  if(CHUNK_BORROWED == c->sizeclass) {
+    /* nothing to free (but the converted atoms) */
+    free(c->atoms);
+    c->atoms = NULL;
+    return;
   }
 
-  c->data = NULL;
-  c->size = 0;
+  shared = c->shared;
+  chunk_unref(c);
+  if(shared) {
+    chunk_unref(shared);
+  }
+}
 
-  free(c);
+t_iemnet_chunk*iemnet__chunk_share(t_iemnet_chunk*c)
+{
+  t_iemnet_chunk*result = NULL;
+  t_iemnet_chunk*payload = NULL;
+  if(NULL == c) {
+    return NULL;
+  }
+  if(CHUNK_BORROWED == c->sizeclass) {
+    /* the payload is only valid for now, so we must copy it */
+    result = iemnet__chunk_create_chunk(c);
+    if(result) {
+      result->family = c->family;
+    }
+    return result;
+  }
+  /* always reference the chunk that owns the payload */
+  payload = c->shared?c->shared:c;
+
+  result = chunkpool_alloc(0);
+  if(NULL == result) {
+    return NULL;
+  }
+  iemnet_atomic_add(&payload->refcount, 1);
+
+  result->data = payload->data;
+  result->size = payload->size;
+  result->shared = payload;
+
+  result->addr = c->addr;
+  result->port = c->port;
+  result->family = c->family;
+  return result;
 }
 
 
@@ -157,30 +484,20 @@ t_iemnet_chunk* iemnet__chunk_create_empty(int size)
   if(size<1) {
     return NULL;
   }
-  result = (t_iemnet_chunk*)malloc(sizeof(t_iemnet_chunk));
+  result = chunkpool_alloc(size);
   if(result) {
-    result->size = size;
-    result->data = (unsigned char*)malloc(sizeof(unsigned char)*size);
-
-    if(NULL == result->data) {
-      result->size = 0;
-      iemnet__chunk_destroy(result);
-      return NULL;
-    }
-
     memset(result->data, 0, result->size);
-
-    result->addr = 0L;
-    result->port = 0;
-    result->family = AF_INET;
-
   }
   return result;
 }
 
 t_iemnet_chunk* iemnet__chunk_create_data(int size, unsigned char*data)
 {
-  t_iemnet_chunk*result = iemnet__chunk_create_empty(size);
+  t_iemnet_chunk*result = NULL;
+  if(size<1) {
+    return NULL;
+  }
+  result = chunkpool_alloc(size);
   if(result) {
     memcpy(result->data, data, result->size);
   }
@@ -200,19 +517,39 @@ t_iemnet_chunk* iemnet__chunk_create_dataaddr(int size,
   return result;
 }
 
+t_iemnet_chunk* iemnet__chunk_borrow(t_iemnet_chunk*c, int size,
+                                     unsigned char*data,
+                                     struct sockaddr_in*addr)
+{
+  if(NULL == c || size<1) {
+    return NULL;
+  }
+  memset(c, 0, sizeof(*c));
+  c->data = data;
+  c->size = size;
+  c->family = AF_INET;
+  c->refcount = 1;
+  c->sizeclass = CHUNK_BORROWED;
+  if(addr) {
+    c->addr = ntohl(addr->sin_addr.s_addr);
+    c->port = ntohs(addr->sin_port);
+    c->family = addr->sin_family;
+  }
+  return c;
+}
+
 t_iemnet_chunk* iemnet__chunk_create_list(int argc, t_atom*argv)
 {
-  int i;
-  t_iemnet_chunk*result = iemnet__chunk_create_empty(argc);
+  t_iemnet_chunk*result = NULL;
+  if(argc<1) {
+    return NULL;
+  }
+  result = chunkpool_alloc(argc);
   if(NULL == result) {
     return NULL;
   }
 
-  for(i = 0; i<argc; i++) {
-    unsigned char c = atom_getint(argv);
-    result->data[i] = c;
-    argv++;
-  }
+  iemnet__convert_atoms2bytes(result->data, argv, argc);
 
   return result;
 }
@@ -235,7 +572,6 @@ t_iemnet_chunk*iemnet__chunk_create_chunk(t_iemnet_chunk*c)
 t_iemnet_floatlist*iemnet__chunk2list(t_iemnet_chunk*c,
                                       t_iemnet_floatlist*dest)
 {
-  unsigned int i;
   if(NULL == c) {
     return NULL;
   }
@@ -244,55 +580,307 @@ t_iemnet_floatlist*iemnet__chunk2list(t_iemnet_chunk*c,
     return NULL;
   }
 
-  for(i = 0; i<c->size; i++) {
-    dest->argv[i].a_w.w_float = c->data[i];
-  }
+  iemnet__convert_bytes2atoms(dest->argv, c->data, c->size);
 
   return dest;
 }
 
+int iemnet__chunk_convert(t_iemnet_chunk*c)
+{
+  if(NULL == c || !c->size) {
+    return 0;
+  }
+  if(NULL == c->atoms) {
+    c->atoms = (t_atom*)malloc(c->size * sizeof(t_atom));
+    if(NULL == c->atoms) {
+      return 0;
+    }
+    iemnet__convert_bytes2atoms(c->atoms, c->data, c->size);
+  }
+  return 1;
+}
+
+t_atom*iemnet__chunk2atoms(t_iemnet_chunk*c, t_iemnet_floatlist**dest)
+{
+  t_iemnet_floatlist*list = NULL;
+  if(NULL == c) {
+    return NULL;
+  }
+  if(c->atoms) {
+    return c->atoms;
+  }
+  list = iemnet__chunk2list(c, *dest);
+  if(NULL == list) {
+    return NULL;
+  }
+  *dest = list;
+  return list->argv;
+}
+
 
 /* queue handling */
 
 /*
- *   using code found at http://newsgroups.derkeiler.com/Archive/Comp/comp.programming.threads/2008-02/msg00502.html
+ * the queue is a single-producer/single-consumer (SPSC) ring buffer:
+ * - the producer (usually Pd's main thread) only ever writes 'tail'
+ * - the consumer (usually the sender thread) advances 'head'
+ * so pushing and popping does not need any locks.
+ * 'head' and 'tail' are free running counters (only masked when indexing
+ * the ring), so 'tail - head' is the number of chunks in the ring.
+ *
+ * the queue can be limited to a number of bytes.
+ * if the limit is exceeded, the producer either discards the new chunk, or
+ * drops the oldest chunks from the queue. in the latter case the producer
+ * also advances 'head', which is why 'head' is only ever changed with
+ * compare-and-swap.
+ *
+ * the ring starts out small (most queues never hold more than a few chunks),
+ * and the producer doubles it whenever it is full, up to QUEUE_RINGMAX slots.
+ * the filled slots are copied over before the new ring is published, and
+ * the old ring is kept until the queue is destroyed, so a consumer that
+ * still looks at the old ring reads the very same chunks.
+ * (the consumer reads 'tail' before the ring, so it never sees a slot
+ * that has only been written to a newer ring.)
+ *
+ * if the ring is full (and cannot grow), chunks are appended to an
+ * (unbounded) overflow list,
+ * which is protected by a mutex. as long as there is anything in the
+ * overflow list, all new chunks go there as well (to keep the order).
+ * the consumer only takes from the overflow list once the ring is empty.
+ *
+ * the mutex/condition pair is also used to put the consumer to sleep,
+ * but the producer only touches them when the consumer is actually
+ * waiting (that is: when the queue goes from empty to non-empty)
  */
 
 
 #ifdef t_iemnet_queue
 # undef t_iemnet_queue
 #endif
+
+#define QUEUE_RINGSIZE 64 /* initial size; must be a power of 2 */
+#define QUEUE_RINGMAX 1024 /* the ring never grows beyond this */
+
 typedef struct _node {
   struct _node*next;
   t_iemnet_chunk*data;
 } t_node;
 
+typedef struct _queuering {
+  struct _queuering*prev; /* the (smaller) ring this one replaced */
+  unsigned long mask; /* number of slots - 1 */
+  struct {
+    t_iemnet_chunk*volatile chunk;
+    /* the size of the chunk
+     * (so the consumer doesn't have to touch chunks it has not claimed yet) */
+    volatile long size;
+  } slot[1];
+} t_queuering;
+
+/* free running ring counters */
+#define QUEUE_INDEX(ring, x) ((unsigned long)(x) & (ring)->mask)
+#define QUEUE_NEXT(x) ((long)((unsigned long)(x) + 1))
+#define QUEUE_COUNT(head, tail) ((unsigned long)(tail) - (unsigned long)(head))
+
 struct _iemnet_queue {
-  t_node*head; /* = 0 */
-  t_node*tail; /* = 0 */
-  pthread_mutex_t mtx;
-  pthread_cond_t cond;
+  t_queuering*volatile ring; /* only replaced by the producer */
+  volatile long head; /* next slot to read; only changed with CAS */
+  volatile long tail; /* next slot to write; only written by the producer */
+
+  t_node*ovhead; /* overflow list (protected by mtx) */
+  t_node*ovtail;
+  volatile long overflow; /* number of chunks in the overflow list */
 
-  int done; /* in cleanup state */
-  int size;
+  volatile long size; /* number of bytes in the queue */
+  volatile long done; /* in cleanup state */
+  volatile long sleeping; /* consumer is waiting for data */
+  volatile long used; /* use counter, so queue_finish can wait for blocking accesses to finish */
 
-  pthread_mutex_t usedmtx;
+  /* only accessed by the producer */
+  long limit; /* maximum number of bytes in the queue (0: unlimited) */
+  t_iemnet_overflow policy; /* what to do when the limit is hit */
+  unsigned long dropped_chunks;
+  unsigned long dropped_bytes;
+
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
   pthread_cond_t usedcond;
-  int used; /* use counter, so queue_finish can wait for blocking accesses to finish */
 };
 
 static void queue_use_increment(t_iemnet_queue* _this)
 {
-  pthread_mutex_lock(&_this->usedmtx);
-  _this->used++;
-  pthread_mutex_unlock(&_this->usedmtx);
+  iemnet_atomic_add(&_this->used, 1);
 }
 static void queue_use_decrement(t_iemnet_queue* _this)
 {
-  pthread_mutex_lock(&_this->usedmtx);
-  _this->used--;
-  pthread_cond_signal(&_this->usedcond);
-  pthread_mutex_unlock(&_this->usedmtx);
+  if(iemnet_atomic_add(&_this->used, -1)) {
+    return;
+  }
+  /* last user gone; if somebody is waiting in queue_finish(), tell them */
+  if(iemnet_atomic_get(&_this->done)) {
+    pthread_mutex_lock(&_this->mtx);
+    pthread_cond_broadcast(&_this->usedcond);
+    pthread_mutex_unlock(&_this->mtx);
+  }
+}
+
+/* wake up the consumer (if it is sleeping) */
+static void queue_wakeup(t_iemnet_queue* _this)
+{
+  iemnet_atomic_fence();
+  if(iemnet_atomic_cas(&_this->sleeping, 1, 0)) {
+    pthread_mutex_lock(&_this->mtx);
+    pthread_cond_signal(&_this->cond);
+    pthread_mutex_unlock(&_this->mtx);
+  }
+}
+
+/* check whether there's anything to pop
+ * (only call this from the consumer)
+ */
+static int queue_isempty(t_iemnet_queue* _this)
+{
+  return ((iemnet_atomic_get(&_this->head) == iemnet_atomic_get(&_this->tail))
+          && !iemnet_atomic_get(&_this->overflow));
+}
+
+/* take up to 'maxchunks' chunks (but no more than 'maxbytes' bytes,
+ * unless it is a single chunk) out of the queue
+ * returns the number of chunks taken (0 if the queue is empty)
+ * (called by the consumer, and by the producer when dropping the oldest chunks)
+ */
+static unsigned int queue_takebatch(t_iemnet_queue* _this,
+                                    t_iemnet_chunk**chunks, unsigned int maxchunks, size_t maxbytes)
+{
+  unsigned int count = 0;
+  long bytes = 0;
+  long head, tail;
+  t_queuering*ring;
+
+  /* claim a range of the ring with a single CAS;
+   * if that fails (the producer dropped the oldest chunks), try again */
+  do {
+    head = iemnet_atomic_get(&_this->head);
+    tail = iemnet_atomic_get(&_this->tail);
+    /* (only after 'tail', so the ring holds all slots up to 'tail') */
+    ring = (t_queuering*)iemnet_atomic_getptr((void*volatile*)&_this->ring);
+    count = 0;
+    bytes = 0;
+    while(count < maxchunks && QUEUE_COUNT(head, tail) > count) {
+      unsigned long index = QUEUE_INDEX(ring, (unsigned long)head + count);
+      long size = iemnet_atomic_get(&ring->slot[index].size);
+      if(count && maxbytes && (size_t)(bytes + size) > maxbytes) {
+        break;
+      }
+      chunks[count] = (t_iemnet_chunk*)iemnet_atomic_getptr((void*volatile*)
+                      &ring->slot[index].chunk);
+      bytes += size;
+      count++;
+    }
+  } while(count && !iemnet_atomic_cas(&_this->head, head,
+                                      (long)((unsigned long)head + count)));
+
+  /* the overflow list only holds chunks newer than those in the ring */
+  if (!count && iemnet_atomic_get(&_this->overflow)) {
+    t_node*n = NULL;
+    pthread_mutex_lock(&_this->mtx);
+    while(count < maxchunks && (n = _this->ovhead)) {
+      if(count && maxbytes && bytes + n->data->size > maxbytes) {
+        break;
+      }
+      if(!(_this->ovhead = n->next)) {
+        _this->ovtail = NULL;
+      }
+      chunks[count++] = n->data;
+      bytes += n->data->size;
+      free(n);
+    }
+    iemnet_atomic_add(&_this->overflow, -(long)count);
+    pthread_mutex_unlock(&_this->mtx);
+  }
+  if(bytes) {
+    iemnet_atomic_add(&_this->size, -bytes);
+  }
+  return count;
+}
+
+/* take a single chunk out of the queue (or NULL if there is none) */
+static t_iemnet_chunk* queue_take(t_iemnet_queue* _this)
+{
+  t_iemnet_chunk*data = NULL;
+  if(queue_takebatch(_this, &data, 1, 0)) {
+    return data;
+  }
+  return NULL;
+}
+
+/* wait until the queue is no longer empty (or done)
+ * (only call this from the consumer)
+ */
+static void queue_wait(t_iemnet_queue* _this)
+{
+  pthread_mutex_lock(&_this->mtx);
+  iemnet_atomic_set(&_this->sleeping, 1);
+  iemnet_atomic_fence();
+  if(queue_isempty(_this) && !iemnet_atomic_get(&_this->done)) {
+    pthread_cond_wait(&_this->cond, &_this->mtx);
+  }
+  /* somebody signaled us, that we should do some work
+   * either the queue has been filled, or we are done...
+   */
+  iemnet_atomic_set(&_this->sleeping, 0);
+  pthread_mutex_unlock(&_this->mtx);
+}
+
+static void queue_drop(t_iemnet_queue* _this, t_iemnet_chunk*data)
+{
+  _this->dropped_chunks++;
+  _this->dropped_bytes += data->size;
+  iemnet__chunk_destroy(data);
+}
+
+/* check whether a chunk of the given size fits into the queue
+ * (an empty queue accepts any chunk, even if it exceeds the limit)
+ */
+static int queue_hasroom(t_iemnet_queue* _this, size_t size)
+{
+  long cursize = iemnet_atomic_get(&_this->size);
+  return (!_this->limit || !cursize
+          || (cursize + (long)size) <= _this->limit);
+}
+
+static t_queuering*queuering_create(unsigned long size)
+{
+  t_queuering*ring = (t_queuering*)calloc(1,
+                     sizeof(t_queuering) + (size - 1) * sizeof(ring->slot[0]));
+  if(ring) {
+    ring->mask = size - 1;
+  }
+  return ring;
+}
+
+/* replace the (full) ring with one twice the size
+ * returns the new ring, or the old one if it cannot grow
+ * (only call this from the producer)
+ */
+static t_queuering*queue_grow(t_iemnet_queue* _this, t_queuering*ring,
+                              long tail)
+{
+  unsigned long size = ring->mask + 1;
+  unsigned long i;
+  t_queuering*newring = NULL;
+  if(size >= QUEUE_RINGMAX || !(newring = queuering_create(size * 2))) {
+    return ring;
+  }
+  for(i = (unsigned long)tail - size; i != (unsigned long)tail; i++) {
+    newring->slot[QUEUE_INDEX(newring, i)].size =
+      ring->slot[QUEUE_INDEX(ring, i)].size;
+    newring->slot[QUEUE_INDEX(newring, i)].chunk =
+      ring->slot[QUEUE_INDEX(ring, i)].chunk;
+  }
+  newring->prev = ring;
+  iemnet_atomic_setptr((void*volatile*)&_this->ring, newring);
+  return newring;
 }
 
 /* push a  chunk into the queue
@@ -303,40 +891,70 @@ int queue_push(
   t_iemnet_chunk* const data
 )
 {
-  t_node* tail;
-  t_node* n = NULL;
+  long tail;
   int size = -1;
+  t_queuering*ring;
   if(NULL == _this) {
     return size;
   }
 
-  pthread_mutex_lock(&_this->mtx);
-  size = _this->size;
-  pthread_mutex_unlock(&_this->mtx);
-
   if(NULL == data) {
-    return size;
+    return iemnet_atomic_get(&_this->size);
   }
 
-  n = (t_node*)malloc(sizeof(t_node));
+  if(!queue_hasroom(_this, data->size)) {
+    switch(_this->policy) {
+    case IEMNET_OVERFLOW_DROPOLDEST:
+      do {
+        t_iemnet_chunk*old = queue_take(_this);
+        if(!old) {
+          break;
+        }
+        queue_drop(_this, old);
+      } while(!queue_hasroom(_this, data->size));
+      break;
+    case IEMNET_OVERFLOW_DISCONNECT:
+      queue_drop(_this, data);
+      return -1;
+    default:
+      queue_drop(_this, data);
+      return iemnet_atomic_get(&_this->size);
+    }
+  }
 
-  n->next = 0;
-  n->data = data;
+  size = iemnet_atomic_add(&_this->size, data->size);
 
-  pthread_mutex_lock(&_this->mtx);
-  if (! (tail = _this->tail)) {
-    _this->head = n;
-  } else {
-    tail->next = n;
+  tail = _this->tail;
+  ring = _this->ring;
+  if(!iemnet_atomic_get(&_this->overflow)
+      && QUEUE_COUNT(iemnet_atomic_get(&_this->head), tail) > ring->mask) {
+    ring = queue_grow(_this, ring, tail);
   }
-  _this->tail = n;
+  if(!iemnet_atomic_get(&_this->overflow)
+      && QUEUE_COUNT(iemnet_atomic_get(&_this->head), tail) <= ring->mask) {
+    iemnet_atomic_set(&ring->slot[QUEUE_INDEX(ring, tail)].size, data->size);
+    iemnet_atomic_setptr((void*volatile*)&ring->slot[QUEUE_INDEX(ring,
+                         tail)].chunk, data);
+    iemnet_atomic_set(&_this->tail, QUEUE_NEXT(tail));
+  } else {
+    /* ring is full (or has been full), use the slow path */
+    t_node*n = (t_node*)malloc(sizeof(t_node));
+    n->next = NULL;
+    n->data = data;
 
-  _this->size += data->size;
-  size = _this->size;
+    pthread_mutex_lock(&_this->mtx);
+    if(_this->ovtail) {
+      _this->ovtail->next = n;
+    } else {
+      _this->ovhead = n;
+    }
+    _this->ovtail = n;
+    iemnet_atomic_add(&_this->overflow, 1);
+    pthread_mutex_unlock(&_this->mtx);
+  }
 
-  /* added new chunk, so tell waiting threads that they can pop the data */
-  pthread_cond_signal(&_this->cond);
-  pthread_mutex_unlock(&_this->mtx);
+  /* added new chunk, so tell a waiting thread that it can pop the data */
+  queue_wakeup(_this);
 
   return size;
 }
@@ -351,88 +969,85 @@ t_iemnet_chunk* queue_pop_block(
   t_iemnet_queue* const _this
 )
 {
-
-  t_node* head = 0;
-  t_iemnet_chunk*data = 0;
+  t_iemnet_chunk*data = NULL;
   if(NULL == _this) {
     return NULL;
   }
 
   queue_use_increment(_this);
-  pthread_mutex_lock(&_this->mtx);
-
-  /* if the queue is empty, wait */
-  while(NULL == _this->head) {
-    pthread_cond_wait(&_this->cond, &_this->mtx);
-    /* somebody signaled us, that we should do some work
-     * either the queue has been filled, or we are done...
-     */
-    if(_this->done) {
-      pthread_mutex_unlock(&_this->mtx);
-      queue_use_decrement(_this);
-      return NULL;
+  while(!iemnet_atomic_get(&_this->done)) {
+    if((data = queue_take(_this))) {
+      break;
     }
-  }
-  /* save the head, below we gonna work on this */
-  head = _this->head;
 
-  /* update _this */
-  if(head) {
-    if (! (_this->head = head->next)) {
-      _this->tail = 0;
-    }
-    if(head->data) {
-      _this->size -= head->data->size;
-    }
+    /* if the queue is empty, wait */
+    queue_wait(_this);
   }
+  queue_use_decrement(_this);
+  return data;
+}
 
-  pthread_mutex_unlock(&_this->mtx);
+/* pop a number of chunks from the queue
+ * if the queue is empty, this will block until
+ *    something has been pushed
+ *   OR the queue is "done" (in which case 0 is returned)
+ */
+unsigned int queue_pop_batch(
+  t_iemnet_queue* const _this,
+  t_iemnet_chunk**chunks,
+  unsigned int maxchunks,
+  size_t maxbytes
+)
+{
+  unsigned int count = 0;
+  if(NULL == _this || NULL == chunks || !maxchunks) {
+    return 0;
+  }
 
-  if(head) {
-    data = head->data;
-    free(head);
-    head = NULL;
+  queue_use_increment(_this);
+  while(!iemnet_atomic_get(&_this->done)) {
+    if((count = queue_takebatch(_this, chunks, maxchunks, maxbytes))) {
+      break;
+    }
+    queue_wait(_this);
   }
   queue_use_decrement(_this);
-  return data;
+  return count;
+}
+/* pop a number of chunks from the queue
+ * if the queue is empty, this will immediately return 0
+ */
+unsigned int queue_pop_batch_noblock(
+  t_iemnet_queue* const _this,
+  t_iemnet_chunk**chunks,
+  unsigned int maxchunks,
+  size_t maxbytes
+)
+{
+  unsigned int count = 0;
+  if(NULL == _this || NULL == chunks || !maxchunks) {
+    return 0;
+  }
+
+  queue_use_increment(_this);
+  count = queue_takebatch(_this, chunks, maxchunks, maxbytes);
+  queue_use_decrement(_this);
+  return count;
 }
 /* pop a chunk from the queue
  * if the queue is empty, this will immediately return NULL
- * (note that despite of the name this does block for synchronization)
  */
 t_iemnet_chunk* queue_pop_noblock(
   t_iemnet_queue* const _this
 )
 {
-  t_node* head = 0;
-  t_iemnet_chunk*data = 0;
+  t_iemnet_chunk*data = NULL;
   if(NULL == _this) {
     return NULL;
   }
 
   queue_use_increment(_this);
-  pthread_mutex_lock(&_this->mtx);
-  if (! (head = _this->head)) {
-    /* empty head */
-    pthread_mutex_unlock(&_this->mtx);
-    queue_use_decrement(_this);
-    return NULL;
-  }
-
-  if (! (_this->head = head->next)) {
-    _this->tail = 0;
-  }
-  if(head && head->data) {
-    _this->size -= head->data->size;
-  }
-
-  pthread_mutex_unlock(&_this->mtx);
-
-  if(head) {
-    data = head->data;
-    free(head);
-    head = NULL;
-  }
+  data = queue_take(_this);
   queue_use_decrement(_this);
   return data;
 }
@@ -446,12 +1061,28 @@ int queue_getsize(t_iemnet_queue* const _this)
 {
   int size = -1;
   if(_this) {
-    pthread_mutex_lock(&_this->mtx);
-    size = _this->size;
-    pthread_mutex_unlock(&_this->mtx);
+    size = iemnet_atomic_get(&_this->size);
   }
   return size;
 }
+void queue_setlimit(t_iemnet_queue* const _this, unsigned long maxbytes,
+                    t_iemnet_overflow policy)
+{
+  if(_this) {
+    _this->limit = (maxbytes > LONG_MAX)?LONG_MAX:(long)maxbytes;
+    _this->policy = policy;
+  }
+}
+void queue_getdropped(t_iemnet_queue* const _this,
+                      unsigned long*chunks, unsigned long*bytes)
+{
+  if(chunks) {
+    *chunks = _this?_this->dropped_chunks:0;
+  }
+  if(bytes) {
+    *bytes = _this?_this->dropped_bytes:0;
+  }
+}
 void queue_finish(t_iemnet_queue* q)
 {
   DEBUG("queue_finish: %x", q);
@@ -459,19 +1090,19 @@ void queue_finish(t_iemnet_queue* q)
     return;
   }
 
+  iemnet_atomic_set(&q->done, 1);
+  iemnet_atomic_fence();
+
   pthread_mutex_lock(&q->mtx);
-  q->done = 1;
   DEBUG("queue signaling: %x", q);
-  pthread_cond_signal(&q->cond);
+  pthread_cond_broadcast(&q->cond);
   DEBUG("queue signaled: %x", q);
-  pthread_mutex_unlock(&q->mtx);
 
   /* wait until queue is no longer used */
-  pthread_mutex_lock(&q->usedmtx);
-  while(q->used) {
-    pthread_cond_wait(&q->usedcond, &q->usedmtx);
+  while(iemnet_atomic_get(&q->used)) {
+    pthread_cond_wait(&q->usedcond, &q->mtx);
   }
-  pthread_mutex_unlock(&q->usedmtx);
+  pthread_mutex_unlock(&q->mtx);
 
   DEBUG("queue_finished: %x", q);
 }
@@ -491,13 +1122,17 @@ void queue_destroy(t_iemnet_queue* q)
     iemnet__chunk_destroy(c);
   }
 
-  q->head = NULL;
-  q->tail = NULL;
+  q->ovhead = NULL;
+  q->ovtail = NULL;
+
+  while(q->ring) {
+    t_queuering*ring = q->ring;
+    q->ring = ring->prev;
+    free(ring);
+  }
 
   pthread_mutex_destroy(&q->mtx);
   pthread_cond_destroy(&q->cond);
-
-  pthread_mutex_destroy(&q->usedmtx);
   pthread_cond_destroy(&q->usedcond);
 
   free(q);
@@ -516,18 +1151,323 @@ t_iemnet_queue* queue_create(void)
     return NULL;
   }
 
-  q->head = NULL;
-  q->tail = NULL;
+  q->ring = queuering_create(QUEUE_RINGSIZE);
+  if(NULL == q->ring) {
+    free(q);
+    return NULL;
+  }
+  q->head = 0;
+  q->tail = 0;
+  q->ovhead = NULL;
+  q->ovtail = NULL;
+  q->overflow = 0;
 
   memcpy(&q->cond, &cond, sizeof(pthread_cond_t));
   memcpy(&q->mtx, &mtx, sizeof(pthread_mutex_t));
-
   memcpy(&q->usedcond, &cond, sizeof(pthread_cond_t));
-  memcpy(&q->usedmtx, &mtx, sizeof(pthread_mutex_t));
 
   q->done = 0;
   q->size = 0;
+  q->sleeping = 0;
   q->used = 0;
+
+  q->limit = 0;
+  q->policy = IEMNET_OVERFLOW_DROPNEWEST;
+  q->dropped_chunks = 0;
+  q->dropped_bytes = 0;
   DEBUG("queue created %x", q);
   return q;
 }
+
+
+/* slotmap
+ *
+ * the entries live in an array of slots that only ever grows;
+ * free slots are kept in a (LIFO) list, so they get re-used quickly
+ * and the slot numbers stay small.
+ * a handle is the slot (+1) combined with the generation of the slot,
+ * which is bumped whenever an entry is removed; so stale handles can be
+ * detected.
+ * the keys are indexed by an open-addressing hash-table (linear probing),
+ * that holds slot+1 (0 being an empty bucket)
+ */
+#define SLOTMAP_INDEXBITS 20
+#define SLOTMAP_INDEXMASK ((1U << SLOTMAP_INDEXBITS) - 1)
+#define SLOTMAP_MAXSLOTS SLOTMAP_INDEXMASK
+#define SLOTMAP_GENERATIONMASK (UINT_MAX >> SLOTMAP_INDEXBITS)
+#define SLOTMAP_MINSLOTS 16
+
+typedef struct _slotmap_slot {
+  void*data; /* NULL if the slot is free */
+  int key;
+  unsigned int generation;
+  unsigned int nextfree; /* slot+1 of the next free slot (0: none) */
+} t_slotmap_slot;
+
+struct _iemnet_slotmap {
+  t_slotmap_slot*slots;
+  unsigned int capacity;
+  unsigned int size;
+  unsigned int freelist; /* slot+1 of the first free slot (0: none) */
+
+  unsigned int*keys; /* hash-table: slot+1 (0: empty bucket) */
+  unsigned int keysize; /* a power of 2, at least twice the capacity */
+};
+
+static unsigned int slotmap_hash(const t_iemnet_slotmap*map, int key)
+{
+  unsigned int h = (unsigned int)key;
+  h ^= h >> 16;
+  h *= 0x45d9f3bU;
+  h ^= h >> 16;
+  return h & (map->keysize - 1);
+}
+
+static void slotmap_keys_insert(t_iemnet_slotmap*map, unsigned int index)
+{
+  unsigned int mask = map->keysize - 1;
+  unsigned int b = slotmap_hash(map, map->slots[index].key);
+  while(map->keys[b]) {
+    b = (b + 1) & mask;
+  }
+  map->keys[b] = index + 1;
+}
+
+/* returns the bucket that holds the key (or keysize if there is none) */
+static unsigned int slotmap_keys_lookup(const t_iemnet_slotmap*map,
+                                        int key)
+{
+  unsigned int mask = map->keysize - 1;
+  unsigned int b;
+  if(!map->keysize) {
+    return 0;
+  }
+  b = slotmap_hash(map, key);
+  while(map->keys[b]) {
+    if(map->slots[map->keys[b] - 1].key == key) {
+      return b;
+    }
+    b = (b + 1) & mask;
+  }
+  return map->keysize;
+}
+
+static void slotmap_keys_remove(t_iemnet_slotmap*map, unsigned int b)
+{
+  /* backward-shift deletion, so we don't need tombstones */
+  unsigned int mask = map->keysize - 1;
+  unsigned int next = (b + 1) & mask;
+  map->keys[b] = 0;
+  while(map->keys[next]) {
+    unsigned int home = slotmap_hash(map,
+                                     map->slots[map->keys[next] - 1].key);
+    /* can the entry at 'next' be moved into the hole at 'b'? */
+    if(((next - home) & mask) >= ((next - b) & mask)) {
+      map->keys[b] = map->keys[next];
+      map->keys[next] = 0;
+      b = next;
+    }
+    next = (next + 1) & mask;
+  }
+}
+
+static int slotmap_grow(t_iemnet_slotmap*map)
+{
+  unsigned int capacity = map->capacity ? (map->capacity * 2) :
+                          SLOTMAP_MINSLOTS;
+  unsigned int keysize = 2 * SLOTMAP_MINSLOTS;
+  t_slotmap_slot*slots;
+  unsigned int*keys;
+  unsigned int i;
+
+  if(map->capacity >= SLOTMAP_MAXSLOTS) {
+    return 0;
+  }
+  if(capacity > SLOTMAP_MAXSLOTS) {
+    capacity = SLOTMAP_MAXSLOTS;
+  }
+  while(keysize < 2 * capacity) {
+    keysize *= 2;
+  }
+
+  keys = (unsigned int*)calloc(keysize, sizeof(*keys));
+  if(!keys) {
+    return 0;
+  }
+  slots = (t_slotmap_slot*)realloc(map->slots, capacity * sizeof(*slots));
+  if(!slots) {
+    free(keys);
+    return 0;
+  }
+  map->slots = slots;
+
+  /* the new slots are pushed in reverse order, so the lowest comes first */
+  for(i = capacity; i > map->capacity; i--) {
+    t_slotmap_slot*s = slots + i - 1;
+    s->data = NULL;
+    s->key = -1;
+    s->generation = 0;
+    s->nextfree = map->freelist;
+    map->freelist = i;
+  }
+  map->capacity = capacity;
+
+  free(map->keys);
+  map->keys = keys;
+  map->keysize = keysize;
+  for(i = 0; i < capacity; i++) {
+    if(slots[i].data) {
+      slotmap_keys_insert(map, i);
+    }
+  }
+  return 1;
+}
+
+/* returns the slot of a valid handle (or capacity if the handle is stale) */
+static unsigned int slotmap_lookup(const t_iemnet_slotmap*map,
+                                   unsigned int handle)
+{
+  unsigned int index = iemnet__slotmap_index(handle);
+  if(!handle || index >= map->capacity) {
+    return map->capacity;
+  }
+  if(!map->slots[index].data
+      || map->slots[index].generation != (handle >> SLOTMAP_INDEXBITS)) {
+    return map->capacity;
+  }
+  return index;
+}
+
+static unsigned int slotmap_makehandle(const t_iemnet_slotmap*map,
+                                       unsigned int index)
+{
+  return (map->slots[index].generation << SLOTMAP_INDEXBITS) | (index + 1);
+}
+
+t_iemnet_slotmap*iemnet__slotmap_create(void)
+{
+  t_iemnet_slotmap*map = (t_iemnet_slotmap*)calloc(1, sizeof(*map));
+  if(map && !slotmap_grow(map)) {
+    free(map);
+    map = NULL;
+  }
+  return map;
+}
+
+void iemnet__slotmap_destroy(t_iemnet_slotmap*map)
+{
+  if(!map) {
+    return;
+  }
+  free(map->slots);
+  free(map->keys);
+  free(map);
+}
+
+unsigned int iemnet__slotmap_add(t_iemnet_slotmap*map, int key, void*data)
+{
+  unsigned int index;
+  t_slotmap_slot*s;
+  if(!map || !data) {
+    return 0;
+  }
+  if(slotmap_keys_lookup(map, key) < map->keysize) {
+    /* duplicate key */
+    return 0;
+  }
+  if(!map->freelist && !slotmap_grow(map)) {
+    return 0;
+  }
+  index = map->freelist - 1;
+  s = map->slots + index;
+  map->freelist = s->nextfree;
+
+  s->data = data;
+  s->key = key;
+  s->nextfree = 0;
+  slotmap_keys_insert(map, index);
+  map->size++;
+  return slotmap_makehandle(map, index);
+}
+
+void*iemnet__slotmap_remove(t_iemnet_slotmap*map, unsigned int handle)
+{
+  unsigned int index, b;
+  t_slotmap_slot*s;
+  void*data;
+  if(!map) {
+    return NULL;
+  }
+  index = slotmap_lookup(map, handle);
+  if(index >= map->capacity) {
+    return NULL;
+  }
+  s = map->slots + index;
+  b = slotmap_keys_lookup(map, s->key);
+  if(b < map->keysize) {
+    slotmap_keys_remove(map, b);
+  }
+
+  data = s->data;
+  s->data = NULL;
+  s->key = -1;
+  s->generation = (s->generation + 1) & SLOTMAP_GENERATIONMASK;
+  s->nextfree = map->freelist;
+  map->freelist = index + 1;
+  map->size--;
+  return data;
+}
+
+void*iemnet__slotmap_get(t_iemnet_slotmap*map, unsigned int handle)
+{
+  unsigned int index;
+  if(!map) {
+    return NULL;
+  }
+  index = slotmap_lookup(map, handle);
+  return (index < map->capacity) ? map->slots[index].data : NULL;
+}
+
+unsigned int iemnet__slotmap_find(t_iemnet_slotmap*map, int key)
+{
+  unsigned int b;
+  if(!map) {
+    return 0;
+  }
+  b = slotmap_keys_lookup(map, key);
+  if(b >= map->keysize) {
+    return 0;
+  }
+  return slotmap_makehandle(map, map->keys[b] - 1);
+}
+
+void*iemnet__slotmap_at(t_iemnet_slotmap*map, unsigned int index)
+{
+  if(!map || index >= map->capacity) {
+    return NULL;
+  }
+  return map->slots[index].data;
+}
+
+unsigned int iemnet__slotmap_handle(t_iemnet_slotmap*map, unsigned int index)
+{
+  if(!map || index >= map->capacity || !map->slots[index].data) {
+    return 0;
+  }
+  return slotmap_makehandle(map, index);
+}
+
+unsigned int iemnet__slotmap_index(unsigned int handle)
+{
+  return (handle & SLOTMAP_INDEXMASK) - 1;
+}
+
+unsigned int iemnet__slotmap_size(t_iemnet_slotmap*map)
+{
+  return map ? map->size : 0;
+}
+
+unsigned int iemnet__slotmap_capacity(t_iemnet_slotmap*map)
+{
+  return map ? map->capacity : 0;
+}
@@ -67,13 +67,36 @@ typedef struct _iemnet_chunk {
   long addr;
   unsigned short port;
   short family; /* AF_INET, AF_INET6 */
+
+  t_atom*atoms; /* the payload as A_FLOATs (if converted, see iemnet__chunk_convert()) */
+
+  /* private: memory management */
+  volatile long refcount;
+  struct _iemnet_chunk*shared; /* the chunk that owns the payload (if not ourselves) */
+  void*pool; /* the pool this chunk was allocated from */
+  int sizeclass;
+  struct _iemnet_chunk*next;
 } t_iemnet_chunk;
 
 /**
  * free a "chunk" (de-allocate memory,...)
+ *
+ * \note the memory is returned to the chunk pool for re-use
  */
 void iemnet__chunk_destroy(t_iemnet_chunk*);
 
+/**
+ * query the chunk pool statistics
+ *
+ * chunks are recycled via per-thread pools;
+ * a 'hit' is a chunk that could be taken from a pool,
+ * a 'miss' is a chunk that had to be allocated from the system
+ *
+ * \param hits pointer to store the number of pool hits (or NULL)
+ * \param misses pointer to store the number of pool misses (or NULL)
+ */
+void iemnet__chunkpool_stats(unsigned long*hits, unsigned long*misses);
+
 /**
  * print a "chunk" to the pd-console
  */
@@ -105,6 +128,22 @@ t_iemnet_chunk*iemnet__chunk_create_data(int size, unsigned char*data);
  */
 t_iemnet_chunk*iemnet__chunk_create_dataaddr(int size, unsigned char*data,
     struct sockaddr_in*addr);
+/**
+ * initialize a caller-provided "chunk" that borrows the given data
+ * (nothing is allocated, and nothing is copied)
+ *
+ * \param c the chunk to initialize (e.g. on the stack)
+ * \param size of data
+ * \param data of size (must stay valid as long as the chunk is used)
+ * \param addr originating address (can be NULL)
+ * \return the initialized chunk (or NULL if there is no data)
+ *
+ * \note iemnet__chunk_destroy() is a no-op for borrowed chunks,
+ *       and iemnet__chunk_share() creates a copy of the payload
+ */
+t_iemnet_chunk*iemnet__chunk_borrow(t_iemnet_chunk*c, int size,
+                                    unsigned char*data,
+                                    struct sockaddr_in*addr);
 /**
  * initialize a "chunk" (allocate memory,...) with given data
  * receiver address will be set to 0
@@ -112,6 +151,8 @@ t_iemnet_chunk*iemnet__chunk_create_dataaddr(int size, unsigned char*data,
  * \param argc size of list
  * \param argv list of atoms containing only "bytes" (t_floats [0..255])
  * \return a new chunk that holds a copy of the list data
+ *
+ * \note values outside [0..255] are clamped, non-float atoms become 0
  */
 t_iemnet_chunk*iemnet__chunk_create_list(int argc, t_atom*argv);
 /**
@@ -123,6 +164,24 @@ t_iemnet_chunk*iemnet__chunk_create_list(int argc, t_atom*argv);
 t_iemnet_chunk*iemnet__chunk_create_chunk(t_iemnet_chunk*source);
 
 
+/**
+ * create a new reference to the payload of a chunk
+ *
+ * the new chunk does not copy the data, but shares it with the source chunk
+ * (the payload is reference counted, and freed when the last chunk
+ * referencing it is destroyed).
+ * the originator/receiver address is copied, and can be changed independently
+ * (so the same payload can be sent to different addresses).
+ *
+ * \param src the source chunk
+ * \return a new chunk that references the source data
+ *
+ * \note once shared, the payload must be considered immutable
+ * \note the new chunk must be destroyed with iemnet__chunk_destroy()
+ */
+t_iemnet_chunk*iemnet__chunk_share(t_iemnet_chunk*source);
+
+
 /**
  * convert a data chunk to a Pd-list of A_FLOATs
  * the destination list will eventually be resized if it is too small to hold the chunk
@@ -134,21 +193,88 @@ t_iemnet_chunk*iemnet__chunk_create_chunk(t_iemnet_chunk*source);
 t_iemnet_floatlist*iemnet__chunk2list(t_iemnet_chunk*c,
                                       t_iemnet_floatlist*dest);
 
+/**
+ * convert the payload of a chunk to A_FLOATs, and store them with the chunk
+ * (so the conversion can be done in another thread than the output)
+ *
+ * \param c the chunk to convert
+ * \return 1 if the chunk holds the converted atoms, else 0
+ *
+ * \note the atoms are freed together with the chunk
+ */
+int iemnet__chunk_convert(t_iemnet_chunk*c);
+
+/**
+ * get the payload of a chunk as A_FLOATs (c->size atoms)
+ * if the chunk has already been converted (see iemnet__chunk_convert()),
+ * its atoms are returned directly;
+ * else the payload is converted into the destination list
+ * (which is eventually resized)
+ *
+ * \param c the chunk to convert
+ * \param dest pointer to the destination list
+ * \return the atoms (or NULL if something went wrong)
+ */
+t_atom*iemnet__chunk2atoms(t_iemnet_chunk*c, t_iemnet_floatlist**dest);
+
+
+/**
+ * convert a list of atoms to bytes
+ * (vectorized if the CPU supports it)
+ *
+ * \param dest the destination buffer (must hold n bytes)
+ * \param src the atoms to convert
+ * \param n number of atoms
+ *
+ * \note values outside [0..255] are clamped, non-float atoms become 0
+ */
+void iemnet__convert_atoms2bytes(unsigned char*dest, const t_atom*src,
+                                 unsigned int n);
+/**
+ * convert bytes to a list of A_FLOAT atoms
+ * (vectorized if the CPU supports it)
+ *
+ * \param dest the destination atoms (must hold n atoms)
+ * \param src the bytes to convert
+ * \param n number of bytes
+ */
+void iemnet__convert_bytes2atoms(t_atom*dest, const unsigned char*src,
+                                 unsigned int n);
+/**
+ * name of the conversion implementation in use
+ * (e.g. "SSE2", "AVX2", "NEON" or "scalar")
+ */
+const char*iemnet__convert_name(void);
+
 
 /**
  * opaque type for a thread safe queue (FIFO)
+ *
+ * the queue is lock-free, but only for a single producer and a single consumer:
+ * all pushes must come from one thread, and all pops from another (or the same) one.
  */
 typedef struct _iemnet_queue t_iemnet_queue;
 EXTERN_STRUCT _iemnet_queue;
 
+/**
+ * what to do if pushing a chunk would exceed the size limit of a queue
+ */
+typedef enum {
+  IEMNET_OVERFLOW_DROPNEWEST = 0, /**< discard the new chunk */
+  IEMNET_OVERFLOW_DROPOLDEST, /**< discard the oldest chunks until the new one fits */
+  IEMNET_OVERFLOW_DISCONNECT /**< discard the new chunk and report an error */
+} t_iemnet_overflow;
+
 /**
  * push data to the FIFO (queue)
  *
  * \param q the queue to push to
  * \param d the pushed data (the queue will only store the pointer to the data; so don't free it yet)
- * \return the fill state of the queue after the push
+ * \return the fill state of the queue after the push,
+ *         -1 if the limit was hit and the overflow policy is IEMNET_OVERFLOW_DISCONNECT
  *
  * \note thread safe
+ * \note chunks that are dropped because of the size limit are destroyed
  */
 int queue_push(t_iemnet_queue* const q, t_iemnet_chunk* const d);
 /**
@@ -157,6 +283,7 @@ int queue_push(t_iemnet_queue* const q, t_iemnet_chunk* const d);
  *  pops data from the stack;
  *  if the stack is empty, this function will block until data is pushed to the stack
  *  if the queue is finalized, this function will return immediately with NULL
+ *  (even if there is still data in the queue)
  *
  * \param q the queue to pop from
  * \return pointer to the popped data; the caller is responsible for freeing the chunk
@@ -175,6 +302,41 @@ t_iemnet_chunk* queue_pop_block(t_iemnet_queue* const q);
  * \note thread safe
  */
 t_iemnet_chunk* queue_pop_noblock(t_iemnet_queue* const);
+/**
+ * \brief pop a number of chunks from the FIFO (queue), blocking
+ *
+ *  pops as many chunks as are available (up to the given limits) at once;
+ *  if the queue is empty, this function will block until data is pushed to the queue
+ *  if the queue is finalized, this function will return immediately with 0
+ *
+ * \param q the queue to pop from
+ * \param chunks array to store the popped chunks to (must hold at least maxchunks elements);
+ *        the caller is responsible for freeing the chunks
+ * \param maxchunks maximum number of chunks to pop
+ * \param maxbytes maximum number of bytes to pop (0 for unlimited);
+ *        a single chunk exceeding this limit is still popped
+ * \return the number of chunks popped
+ *
+ * \note thread safe
+ */
+unsigned int queue_pop_batch(t_iemnet_queue* const q,
+                             t_iemnet_chunk**chunks, unsigned int maxchunks, size_t maxbytes);
+/**
+ * pop a number of chunks from the FIFO (queue), non-blocking
+ *
+ * just like queue_pop_batch(), but if the queue is empty,
+ * this function will immediately return 0
+ *
+ * \param q the queue to pop from
+ * \param chunks array to store the popped chunks to (must hold at least maxchunks elements)
+ * \param maxchunks maximum number of chunks to pop
+ * \param maxbytes maximum number of bytes to pop (0 for unlimited)
+ * \return the number of chunks popped
+ *
+ * \note thread safe
+ */
+unsigned int queue_pop_batch_noblock(t_iemnet_queue* const q,
+                                     t_iemnet_chunk**chunks, unsigned int maxchunks, size_t maxbytes);
 /**
  * get size if queue
  *
@@ -184,6 +346,28 @@ t_iemnet_chunk* queue_pop_noblock(t_iemnet_queue* const);
  * \note thread safe
  */
 int queue_getsize(t_iemnet_queue* const q);
+/**
+ * limit the size of the queue
+ *
+ * \param q the queue
+ * \param maxbytes maximum number of bytes in the queue (0 means unlimited)
+ * \param policy what to do if a push exceeds the limit
+ *
+ * \note only call this from the thread that pushes
+ */
+void queue_setlimit(t_iemnet_queue* const q, unsigned long maxbytes,
+                    t_iemnet_overflow policy);
+/**
+ * get the number of chunks (and bytes) that were dropped due to the size limit
+ *
+ * \param q the queue
+ * \param chunks pointer to store the number of dropped chunks (or NULL)
+ * \param bytes pointer to store the number of dropped bytes (or NULL)
+ *
+ * \note only call this from the thread that pushes
+ */
+void queue_getdropped(t_iemnet_queue* const q,
+                      unsigned long*chunks, unsigned long*bytes);
 /**
  * initiate cleanup process
  *
@@ -208,4 +392,102 @@ void queue_destroy(t_iemnet_queue* q);
 t_iemnet_queue* queue_create(void);
 
 
+/**
+ * a table of connections (or anything else), indexed by small integers
+ *
+ * each entry is referred to by a handle that stays valid until the entry
+ * is removed; handles of removed entries are never confused with new ones
+ * (even though the slot itself gets re-used)
+ * each entry also has an (integer) key (e.g. the socket) it can be found by
+ *
+ * \note not thread safe: only use it from a single thread (the main thread)
+ */
+typedef struct _iemnet_slotmap t_iemnet_slotmap;
+EXTERN_STRUCT _iemnet_slotmap;
+
+/**
+ * create a slotmap
+ *
+ * \return the newly created slotmap; if something went wrong NULL is returned
+ */
+t_iemnet_slotmap*iemnet__slotmap_create(void);
+/**
+ * destroy a slotmap
+ *
+ * \param map the slotmap to destroy
+ *
+ * \note the data stored in the map is NOT freed
+ */
+void iemnet__slotmap_destroy(t_iemnet_slotmap*map);
+/**
+ * add an entry to the slotmap
+ *
+ * \param map the slotmap
+ * \param key the key to find the entry by (must be unique within the map)
+ * \param data the entry (must not be NULL)
+ * \return a handle to the new entry, or 0 if something went wrong
+ */
+unsigned int iemnet__slotmap_add(t_iemnet_slotmap*map, int key, void*data);
+/**
+ * remove an entry from the slotmap
+ *
+ * \param map the slotmap
+ * \param handle the handle of the entry
+ * \return the removed entry, or NULL if the handle is not valid (any more)
+ */
+void*iemnet__slotmap_remove(t_iemnet_slotmap*map, unsigned int handle);
+/**
+ * get an entry from the slotmap
+ *
+ * \param map the slotmap
+ * \param handle the handle of the entry
+ * \return the entry, or NULL if the handle is not valid (any more)
+ */
+void*iemnet__slotmap_get(t_iemnet_slotmap*map, unsigned int handle);
+/**
+ * find an entry by its key
+ *
+ * \param map the slotmap
+ * \param key the key of the entry
+ * \return the handle of the entry, or 0 if there is no such key
+ */
+unsigned int iemnet__slotmap_find(t_iemnet_slotmap*map, int key);
+/**
+ * get the entry in a given slot
+ *
+ * use this (together with iemnet__slotmap_capacity()) to iterate over all entries
+ *
+ * \param map the slotmap
+ * \param index the slot (0..capacity-1)
+ * \return the entry, or NULL if the slot is empty
+ */
+void*iemnet__slotmap_at(t_iemnet_slotmap*map, unsigned int index);
+/**
+ * get the handle of the entry in a given slot
+ *
+ * \param map the slotmap
+ * \param index the slot (0..capacity-1)
+ * \return the handle of the entry, or 0 if the slot is empty
+ */
+unsigned int iemnet__slotmap_handle(t_iemnet_slotmap*map, unsigned int index);
+/**
+ * get the slot of a handle
+ *
+ * slots are small integers (starting at 0) that are re-used
+ * once their entry has been removed
+ *
+ * \param handle a handle as returned by iemnet__slotmap_add()
+ * \return the slot of the handle
+ */
+unsigned int iemnet__slotmap_index(unsigned int handle);
+/**
+ * get the number of entries in the slotmap
+ */
+unsigned int iemnet__slotmap_size(t_iemnet_slotmap*map);
+/**
+ * get the number of slots in the slotmap (used or not)
+ */
+unsigned int iemnet__slotmap_capacity(t_iemnet_slotmap*map);
+
+
 #endif /* INCLUDE__IEMNET_DATA_H_ */
@@ -23,63 +23,884 @@
 
 #define DEBUGLEVEL 4
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* for MSG_DONTWAIT and recvmmsg() */
+# define _GNU_SOURCE
+#endif
+
 #include "iemnet.h"
 #include "iemnet_data.h"
+#include "iemnet_atomic.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <limits.h>
+#ifndef _WIN32
+# include <sys/ioctl.h>
+#endif
+
+#ifdef __linux__
+# define IEMNET_HAVE_EPOLL 1
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <unistd.h>
+# include <stdint.h>
+# include <pthread.h>
+#endif
 
-#define INBUFSIZE 65536L /* was 4096: size of receiving data buffer */
+#if defined(__linux__) && defined(__GLIBC__) \
+  && ((__GLIBC__ > 2) || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 12))
+# define IEMNET_HAVE_RECVMMSG 1
+#endif
+
+#define INBUFSIZE 65536L /* was 4096: default size of the receive buffer */
+
+/* max. number of datagrams to read with a single syscall */
+/* (each datagram gets the full 'bufsize', so the receive buffer of
+ * a datagram socket takes IEMNET_RECVBATCH*bufsize bytes) */
+#define IEMNET_RECVBATCH 16
+
+/* how many packets to read from a socket per tick (resp. wakeup), by default */
+#define IEMNET_RECEIVE_BUDGET_PACKETS 64
+
+/* the receive buffer of a receiver
+ * (only ever touched by the thread that reads the socket)
+ */
+typedef struct _iemnet_recvarena {
+  unsigned char*data;
+  size_t size;
+  size_t bufsize; /* the requested size when the buffer was allocated */
+#ifdef IEMNET_HAVE_RECVMMSG
+  struct mmsghdr msgs[IEMNET_RECVBATCH];
+  struct iovec iov[IEMNET_RECVBATCH];
+  struct sockaddr_in from[IEMNET_RECVBATCH];
+#endif
+} t_iemnet_recvarena;
 
 struct _iemnet_receiver {
   int sockfd; /* owned outside; you must call iemnet__receiver_destroy() before freeing socket yourself */
   void*userdata;
   t_iemnet_receivecallback callback;
+
+  /* how much to read at once */
+  volatile long budgetpackets;
+  volatile long budgetbytes; /* 0: unlimited */
+  volatile long exhausted; /* how often we stopped reading because of the budget */
+  volatile long highwater; /* max. number of bytes seen waiting (in the kernel and in iemnet) */
+
+  volatile long bufsize; /* requested size of the receive buffer */
+  t_iemnet_recvarena*arena; /* the receive buffer (allocated on first read) */
+  volatile long truncated; /* number of datagrams that did not fit */
+  unsigned long truncreported; /* (only touched by the main thread) */
+
+  int socktype; /* SOCK_STREAM, SOCK_DGRAM,... */
+
+  int paused; /* don't read (resp. deliver) anything (main thread only) */
+  int inpoll; /* pollfun() is running (and calling the callback) */
+  int destroyed; /* iemnet__receiver_destroy() was called from the callback */
+
+#ifdef IEMNET_HAVE_EPOLL
+  /* only used if the socket is read by a receive thread */
+  struct _recvthread_worker*worker; /* the thread that reads the socket */
+  t_iemnet_queue*queue; /* chunks that have been read but not delivered yet */
+  volatile long closed; /* the socket was closed (or failed): deliver a NULL chunk */
+  volatile long scheduled; /* in the inbox */
+  volatile long dead; /* iemnet__receiver_destroy() has been called */
+  struct _iemnet_receiver*next; /* in the inbox */
+  struct _iemnet_receiver*nextdead; /* in the 'dying'/'dead' lists (protected by the mutex) */
+#endif
 };
 
 
-static void pollfun(void*z, int fd)
+static int receiver_wouldblock(void)
 {
-  /* read data from socket and call callback */
-  t_iemnet_receiver*rec = (t_iemnet_receiver*)z;
+#ifdef _WIN32
+  return (WSAEWOULDBLOCK == WSAGetLastError());
+#else
+  return (EAGAIN == errno || EWOULDBLOCK == errno);
+#endif
+}
 
-  unsigned char data[INBUFSIZE];
-  unsigned int size = INBUFSIZE;
-  t_iemnet_chunk*chunk = NULL;
-  int result = 0;
-  int local_errno = 0;
+/* number of bytes waiting in the kernel to be read
+ * (for datagram sockets, this is only the size of the next datagram on some systems)
+ */
+static unsigned long receiver_pending(int sockfd)
+{
+#ifdef _WIN32
+  u_long pending = 0;
+  if(ioctlsocket(sockfd, FIONREAD, &pending)) {
+    return 0;
+  }
+  return pending;
+#else
+  int pending = 0;
+  if(ioctl(sockfd, FIONREAD, &pending) < 0 || pending < 0) {
+    return 0;
+  }
+  return pending;
+#endif
+}
 
-  struct sockaddr_in from;
-  socklen_t fromlen = sizeof(from);
+/* number of bytes that have been read, but not delivered yet */
+static unsigned long receiver_buffered(t_iemnet_receiver*rec)
+{
+#ifdef IEMNET_HAVE_EPOLL
+  if(rec->queue) {
+    int size = queue_getsize(rec->queue);
+    return (size > 0)?size:0;
+  }
+#else
+  (void)rec; /* ignore unused variable */
+#endif
+  /* chunks read in the main thread are delivered immediately */
+  return 0;
+}
+
+static void receiver_sethighwater(t_iemnet_receiver*rec, unsigned long size)
+{
+  long highwater;
+  if(size > LONG_MAX) {
+    size = LONG_MAX;
+  }
+  do {
+    highwater = iemnet_atomic_get(&rec->highwater);
+    if((long)size <= highwater) {
+      return;
+    }
+  } while(!iemnet_atomic_cas(&rec->highwater, highwater, (long)size));
+}
+
+/* check whether we have read enough for now */
+static int receiver_budgetspent(t_iemnet_receiver*rec,
+                                unsigned int packets, size_t bytes)
+{
+  long maxbytes = iemnet_atomic_get(&rec->budgetbytes);
+  if(packets >= (unsigned long)iemnet_atomic_get(&rec->budgetpackets)
+      || (maxbytes && bytes >= (size_t)maxbytes)) {
+    iemnet_atomic_add(&rec->exhausted, 1);
+    /* we are leaving data behind, so this is when a backlog builds up */
+    receiver_sethighwater(rec, receiver_pending(rec->sockfd)
+                          + receiver_buffered(rec));
+    return 1;
+  }
+  return 0;
+}
+
+static int receiver_socktype(int sockfd)
+{
+  int socktype = 0;
+  socklen_t socktypelen = sizeof(socktype);
+  if(getsockopt(sockfd, SOL_SOCKET, SO_TYPE, (void*)&socktype, &socktypelen)) {
+    return 0;
+  }
+  return socktype;
+}
+
+/* get the receive buffer, so it holds (at least) 'minsize' bytes
+ * the buffer is re-allocated if the requested size has changed
+ */
+static t_iemnet_recvarena*receiver_arena(t_iemnet_receiver*rec,
+    size_t minsize)
+{
+  t_iemnet_recvarena*arena = rec->arena;
+  size_t bufsize = (size_t)iemnet_atomic_get(&rec->bufsize);
+  if(!arena) {
+    arena = (t_iemnet_recvarena*)calloc(1, sizeof(*arena));
+    if(!arena) {
+      return NULL;
+    }
+    rec->arena = arena;
+  }
+  if(arena->bufsize != bufsize || arena->size < minsize) {
+    size_t size = (minsize > bufsize)?minsize:bufsize;
+    unsigned char*data = (unsigned char*)realloc(arena->data, size);
+    if(!data) {
+      return NULL;
+    }
+    arena->data = data;
+    arena->size = size;
+    arena->bufsize = bufsize;
+  }
+  return arena;
+}
+
+static void receiver_free(t_iemnet_receiver*rec)
+{
+  if(rec->arena) {
+    free(rec->arena->data);
+    free(rec->arena);
+  }
+#ifdef IEMNET_HAVE_EPOLL
+  if(rec->queue) {
+    queue_destroy(rec->queue);
+  }
+#endif
+  memset(rec, 0, sizeof(*rec));
+  rec->sockfd = -1;
+  free(rec);
+}
+
+/* complain (from the main thread) about datagrams that did not fit */
+static void receiver_reporttruncated(t_iemnet_receiver*rec)
+{
+  unsigned long truncated = (unsigned long)iemnet_atomic_get(&rec->truncated);
+  if(truncated != rec->truncreported) {
+    iemnet_log(0, IEMNET_ERROR,
+               "%lu datagram(s) truncated, increase the 'recvbufsize' (currently %ld bytes)",
+               truncated - rec->truncreported, iemnet_atomic_get(&rec->bufsize));
+    rec->truncreported = truncated;
+  }
+}
+
+#ifdef IEMNET_HAVE_RECVMMSG
+/* how many datagrams we may still read without exceeding the budget */
+static unsigned int receiver_batchsize(t_iemnet_receiver*rec,
+                                       unsigned int packets)
+{
+  unsigned long maxpackets = iemnet_atomic_get(&rec->budgetpackets);
+  if(packets < maxpackets && maxpackets - packets < IEMNET_RECVBATCH) {
+    return maxpackets - packets;
+  }
+  return IEMNET_RECVBATCH;
+}
+
+/* read up to 'count' datagrams (with their source addresses)
+ * into the receive buffer with a single syscall
+ * returns the number of datagrams read, or -1 on error
+ *
+ * each datagram can take up to 'bufsize' bytes;
+ * the size of the next datagram is peeked, so it is never truncated
+ * (even if it is larger than 'bufsize').
+ * any following datagram that does not fit is counted as truncated.
+ */
+static int receiver_recvmm(t_iemnet_receiver*rec, unsigned int count)
+{
+  t_iemnet_recvarena*arena;
+  size_t slotsize = (size_t)iemnet_atomic_get(&rec->bufsize);
+  size_t firstsize = slotsize, offset = 0;
+  unsigned int i;
+  int next, result;
+
+  do {
+    next = recv(rec->sockfd, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+  } while(next < 0 && EINTR == errno);
+  if(next < 0) {
+    return -1;
+  }
+  if(firstsize < (size_t)next) {
+    /* only the first slot has to hold an oversized datagram */
+    firstsize = next;
+  }
+  arena = receiver_arena(rec, firstsize + (count - 1) * slotsize);
+  if(!arena) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for(i = 0; i < count; i++) {
+    size_t size = i ? slotsize : firstsize;
+    arena->iov[i].iov_base = arena->data + offset;
+    arena->iov[i].iov_len = size;
+    offset += size;
+    arena->msgs[i].msg_hdr.msg_iov = arena->iov + i;
+    arena->msgs[i].msg_hdr.msg_iovlen = 1;
+    arena->msgs[i].msg_hdr.msg_name = arena->from + i;
+    arena->msgs[i].msg_hdr.msg_namelen = sizeof(arena->from[i]);
+    arena->msgs[i].msg_hdr.msg_flags = 0;
+    arena->msgs[i].msg_len = 0;
+  }
+  do {
+    result = recvmmsg(rec->sockfd, arena->msgs, count, MSG_DONTWAIT, NULL);
+  } while(result < 0 && EINTR == errno);
+  DEBUG("recvmmsg %d datagrams from %d", result, rec->sockfd);
+  for(i = 0; result > 0 && i < (unsigned int)result; i++) {
+    if(arena->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      iemnet_atomic_add(&rec->truncated, 1);
+    }
+  }
+  return result;
+}
+
+static void pollfun_mm(t_iemnet_receiver*rec)
+{
+  unsigned int packets = 0;
+  size_t bytes = 0;
+  while(1) {
+    int i, n = receiver_recvmm(rec, receiver_batchsize(rec, packets));
+    if(n < 0 && receiver_wouldblock()) {
+      /* nothing (more) to read */
+      break;
+    }
+    if(n <= 0) {
+      /* call the callback with a NULL-chunk to signal a disconnect event. */
+      (rec->callback)(rec->userdata, NULL);
+      break;
+    }
+    for(i = 0; i < n; i++) {
+      t_iemnet_recvarena*arena = rec->arena;
+      t_iemnet_chunk chunk;
+      unsigned int len = arena->msgs[i].msg_len;
+      /* the chunk borrows the receive buffer (no copying) */
+      t_iemnet_chunk*c = iemnet__chunk_borrow(&chunk, len,
+                                              (unsigned char*)arena->iov[i].iov_base,
+                                              arena->from + i);
+      (rec->callback)(rec->userdata, c);
+      if(!c || rec->destroyed) {
+        return;
+      }
+      packets++;
+      bytes += len;
+    }
+    /* (datagrams that have been read already are delivered even if paused) */
+    if(rec->paused || receiver_budgetspent(rec, packets, bytes)) {
+      break;
+    }
+  }
+}
+#endif /* IEMNET_HAVE_RECVMMSG */
+
+static void pollfun_recv(t_iemnet_receiver*rec)
+{
+  unsigned int packets = 0;
+  size_t bytes = 0;
 
   int recv_flags = 0;
 #ifdef MSG_DONTWAIT
   recv_flags |= MSG_DONTWAIT;
 #endif
-  errno = 0;
+
+  while(1) {
+    t_iemnet_recvarena*arena = receiver_arena(rec, 0);
+    t_iemnet_chunk chunk;
+    t_iemnet_chunk*c = NULL;
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    int result;
+
+    if(!arena) {
+      iemnet_log(0, IEMNET_ERROR, "unable to allocate %ld bytes receive buffer",
+                 iemnet_atomic_get(&rec->bufsize));
+      break;
+    }
+
+    errno = 0;
+    result = recvfrom(rec->sockfd, (void *)arena->data, arena->size, recv_flags,
+                      (struct sockaddr *)&from, &fromlen);
+    DEBUG("recvfrom %d bytes: %d %p %d", result, rec->sockfd, arena->data,
+          arena->size);
+    DEBUG("errno = %d", errno);
+    if(result < 0) {
+      if(EINTR == errno) {
+        continue;
+      }
+      if(receiver_wouldblock()) {
+        /* nothing (more) to read */
+        break;
+      }
+    }
+    /* the chunk borrows the receive buffer (no copying) */
+    c = iemnet__chunk_borrow(&chunk, result, arena->data, &from);
+
+    /* call the callback with a NULL-chunk to signal a disconnect event. */
+    (rec->callback)(rec->userdata, c);
+
+    if(!c || rec->destroyed || rec->paused) {
+      break;
+    }
+    packets++;
+    bytes += result;
+#ifndef MSG_DONTWAIT
+    /* another read might block */
+    break;
+#endif
+    if(receiver_budgetspent(rec, packets, bytes)) {
+      break;
+    }
+  }
+}
+
+static void pollfun(void*z, int fd)
+{
+  /* read data from socket and call callback */
+  t_iemnet_receiver*rec = (t_iemnet_receiver*)z;
+
   if(fd != rec->sockfd) {
     DEBUG("%s(%p, %d) receives from %d\n", __FUNCTION__, rec, fd,
           rec->sockfd);
   }
 
-  result = recvfrom(rec->sockfd, (void *)data, size, recv_flags,
-                    (struct sockaddr *)&from, &fromlen);
-  local_errno = errno;
-  //fprintf(stderr, "read %d bytes...\n", result);
-  DEBUG("recvfrom %d bytes: %d %p %d", result, rec->sockfd, data, size);
-  DEBUG("errno = %d", local_errno);
-  chunk = iemnet__chunk_create_dataaddr(result, (result>0)?data:NULL, &from);
+  /* keep reading until there's nothing left (or the budget is spent),
+   * rather than waiting for the next poll for each packet */
+  rec->inpoll = 1;
+#ifdef IEMNET_HAVE_RECVMMSG
+  if(SOCK_DGRAM == rec->socktype) {
+    pollfun_mm(rec);
+  } else
+#endif
+    pollfun_recv(rec);
+  rec->inpoll = 0;
+  if(rec->destroyed) {
+    /* the callback has destroyed the receiver */
+    receiver_free(rec);
+    return;
+  }
+  receiver_reporttruncated(rec);
+}
+
 
-  /* call the callback with a NULL-chunk to signal a disconnect event. */
-  (rec->callback)(rec->userdata, chunk);
+#ifdef IEMNET_HAVE_EPOLL
+/* ----------------------------- receive thread ------------------------- */
 
-  iemnet__chunk_destroy(chunk);
+/* a receive thread (owning an epoll set) reads its sockets,
+ * and puts the receivers that have something to deliver into a
+ * (lock-free, multi-producer) inbox.
+ * a clock in Pd's main thread drains the inbox once per tick, and calls
+ * the callbacks; the receive threads never need to take Pd's lock.
+ * (the clock is set from a pollfn, as clocks are not thread-safe)
+ *
+ * the shared receive thread is worker #0; sharded sockets
+ * (see iemnet__receiver_create_shard()) are spread across all workers,
+ * which all use the same inbox.
+ */
+
+#define IEMNET_RECVTHREAD_EVENTS 64
+
+typedef struct _recvthread_worker {
+  int running;
+  pthread_t thread;
+  int epollfd;
+  int wakefd; /* wakes up the receive thread */
+  /* destroyed receivers; the receive thread might still be using them
+   * (protected by the mutex) */
+  t_iemnet_receiver*dying;
+} t_recvthread_worker;
+
+/* protects the 'dying' and 'dead' lists (and the count of destroyed receivers) */
+static pthread_mutex_t recvthread_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+  int wanted; /* use the shared receive thread for new receivers */
+  int running; /* the main thread is ready to drain the inbox */
+  int mainfd; /* wakes up Pd's main thread */
+  t_clock*clock; /* drains the inbox */
+  /* receivers that have something to deliver (LIFO) */
+  void*volatile inbox;
+  /* destroyed receivers that are no longer used by their receive thread */
+  t_iemnet_receiver*dead;
+  /* destroyed receivers that have not been freed yet */
+  unsigned int destroyed;
+
+  t_recvthread_worker workers[IEMNET_RECEIVER_MAXSHARDS];
+} recvthread;
+
+static void recvthread_wake(int fd)
+{
+  uint64_t one = 1;
+  while(write(fd, &one, sizeof(one)) < 0 && EINTR == errno);
 }
 
-t_iemnet_receiver*iemnet__receiver_create(int sock, void*userdata,
-    t_iemnet_receivecallback callback, int subthread)
+/* put the receiver into the inbox (unless it is already there) */
+static void recvthread_schedule(t_iemnet_receiver*rec)
 {
-  t_iemnet_receiver*rec = (t_iemnet_receiver*)malloc(sizeof(
+  void*head;
+  if(iemnet_atomic_get(&rec->dead)
+      || !iemnet_atomic_cas(&rec->scheduled, 0, 1)) {
+    return;
+  }
+  do {
+    head = iemnet_atomic_getptr(&recvthread.inbox);
+    rec->next = (t_iemnet_receiver*)head;
+  } while(!iemnet_atomic_casptr(&recvthread.inbox, head, rec));
+  if(!head) {
+    /* the inbox was empty, so nobody is going to drain it yet */
+    recvthread_wake(recvthread.mainfd);
+  }
+}
+
+#ifdef IEMNET_HAVE_RECVMMSG
+/* read whatever datagrams are available on the socket;
+ * returns 1 if the socket is broken */
+static int recvthread_readmm(t_iemnet_receiver*rec, int*received)
+{
+  unsigned int packets = 0;
+  size_t bytes = 0;
+  while(!*received || !receiver_budgetspent(rec, packets, bytes)) {
+    int i, n = receiver_recvmm(rec, receiver_batchsize(rec, packets));
+    if(n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+      break;
+    }
+    if(n <= 0) {
+      return 1;
+    }
+    for(i = 0; i < n; i++) {
+      t_iemnet_recvarena*arena = rec->arena;
+      unsigned int len = arena->msgs[i].msg_len;
+      /* the chunk outlives the receive buffer, so we have to copy */
+      t_iemnet_chunk*chunk = iemnet__chunk_create_dataaddr(len,
+                             (unsigned char*)arena->iov[i].iov_base,
+                             arena->from + i);
+      if(chunk) {
+        /* spare the main thread the conversion */
+        iemnet__chunk_convert(chunk);
+        queue_push(rec->queue, chunk);
+        *received = 1;
+      }
+      packets++;
+      bytes += len;
+    }
+  }
+  return 0;
+}
+#endif /* IEMNET_HAVE_RECVMMSG */
+
+/* read whatever is available on the socket (one packet at a time);
+ * returns 1 if the socket is broken */
+static int recvthread_recv(t_iemnet_receiver*rec, int*received)
+{
+  unsigned int packets = 0;
+  size_t bytes = 0;
+  /* (the budget keeps busy sockets from starving the others) */
+  while(!*received || !receiver_budgetspent(rec, packets, bytes)) {
+    t_iemnet_recvarena*arena = receiver_arena(rec, 0);
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    t_iemnet_chunk*chunk;
+    int result;
+    if(!arena) {
+      /* try again later */
+      break;
+    }
+    result = recvfrom(rec->sockfd, (void *)arena->data, arena->size,
+                      MSG_DONTWAIT, (struct sockaddr *)&from, &fromlen);
+    if(result < 0) {
+      if(EINTR == errno) {
+        continue;
+      }
+      if(EAGAIN == errno || EWOULDBLOCK == errno) {
+        break;
+      }
+    }
+    if(result <= 0) {
+      /* disconnected (or failed) */
+      return 1;
+    }
+    /* the chunk outlives the receive buffer, so we have to copy */
+    chunk = iemnet__chunk_create_dataaddr(result, arena->data, &from);
+    if(chunk) {
+      /* spare the main thread the conversion */
+      iemnet__chunk_convert(chunk);
+      queue_push(rec->queue, chunk);
+      *received = 1;
+    }
+    packets++;
+    bytes += result;
+  }
+  return 0;
+}
+
+/* read whatever is available on the socket, and tell the main thread */
+static void recvthread_read(t_iemnet_receiver*rec)
+{
+  int closed, received = 0;
+#ifdef IEMNET_HAVE_RECVMMSG
+  if(SOCK_DGRAM == rec->socktype) {
+    closed = recvthread_readmm(rec, &received);
+  } else
+#endif
+    closed = recvthread_recv(rec, &received);
+
+  if(closed && SOCK_STREAM == rec->socktype) {
+    /* a closed stream would wake us up forever */
+    epoll_ctl(rec->worker->epollfd, EPOLL_CTL_DEL, rec->sockfd, NULL);
+  }
+  if(closed) {
+    iemnet_atomic_set(&rec->closed, 1);
+  }
+  if(received) {
+    receiver_sethighwater(rec, receiver_buffered(rec));
+  }
+  if(closed || received) {
+    recvthread_schedule(rec);
+  }
+}
+
+static void*recvthread_thread(void*arg)
+{
+  t_recvthread_worker*w = (t_recvthread_worker*)arg;
+  struct epoll_event events[IEMNET_RECVTHREAD_EVENTS];
+  while(1) {
+    t_iemnet_receiver*dying;
+    int i, n;
+    n = epoll_wait(w->epollfd, events, IEMNET_RECVTHREAD_EVENTS, -1);
+    if(n < 0 && EINTR != errno) {
+      break;
+    }
+    for(i = 0; i < n; i++) {
+      t_iemnet_receiver*rec = (t_iemnet_receiver*)events[i].data.ptr;
+      if(!rec) {
+        uint64_t count;
+        while(read(w->wakefd, &count, sizeof(count)) < 0 && EINTR == errno);
+        continue;
+      }
+      recvthread_read(rec);
+    }
+
+    /* we are done with the events, and receivers are removed from the
+     * epoll set before they are put on the dying list,
+     * so none of them shows up in the next epoll_wait() */
+    pthread_mutex_lock(&recvthread_mtx);
+    dying = w->dying;
+    w->dying = NULL;
+    pthread_mutex_unlock(&recvthread_mtx);
+    if(dying) {
+      /* hand them over to the main thread for freeing */
+      t_iemnet_receiver*last = dying;
+      while(last->nextdead) {
+        last = last->nextdead;
+      }
+      pthread_mutex_lock(&recvthread_mtx);
+      last->nextdead = recvthread.dead;
+      recvthread.dead = dying;
+      pthread_mutex_unlock(&recvthread_mtx);
+      recvthread_wake(recvthread.mainfd);
+    }
+  }
+  return NULL;
+}
+
+/* runs in Pd's main thread (once per tick) */
+static void recvthread_drain(void*z)
+{
+  t_iemnet_receiver*rec, *prev = NULL, *dead;
+  (void)z; /* ignore unused variable */
+
+  /* receivers on the 'dead' list are no longer in use by the receive thread;
+   * so they have been put into the inbox before we take it */
+  pthread_mutex_lock(&recvthread_mtx);
+  dead = recvthread.dead;
+  recvthread.dead = NULL;
+  for(rec = dead; rec; rec = rec->nextdead) {
+    recvthread.destroyed--;
+  }
+  pthread_mutex_unlock(&recvthread_mtx);
+
+  /* only deliver what is ready now
+   * (so a busy socket cannot keep us here forever) */
+  rec = (t_iemnet_receiver*)iemnet_atomic_swapptr(&recvthread.inbox, NULL);
+  /* restore the order in which the receivers became ready */
+  while(rec) {
+    t_iemnet_receiver*next = rec->next;
+    rec->next = prev;
+    prev = rec;
+    rec = next;
+  }
+  rec = prev;
+
+  while(rec) {
+    t_iemnet_receiver*next = rec->next;
+    t_iemnet_chunk*chunk;
+    int closed;
+    /* from now on, the receive thread may put it into the inbox again */
+    iemnet_atomic_set(&rec->scheduled, 0);
+    if(rec->paused) {
+      /* keep everything for later (resuming puts it into the inbox again) */
+      rec = next;
+      continue;
+    }
+    closed = (int)iemnet_atomic_cas(&rec->closed, 1, 0);
+
+    /* the callback might destroy (or pause) this (or any other) receiver */
+    while(!rec->dead && !rec->paused
+          && (chunk = queue_pop_noblock(rec->queue))) {
+      (rec->callback)(rec->userdata, chunk);
+      iemnet__chunk_destroy(chunk);
+    }
+    if(closed && !rec->dead) {
+      if(rec->paused) {
+        /* deliver the disconnect event after all the data */
+        iemnet_atomic_set(&rec->closed, 1);
+      } else {
+        /* call the callback with a NULL-chunk to signal a disconnect event. */
+        (rec->callback)(rec->userdata, NULL);
+      }
+    }
+    if(!rec->dead) {
+      receiver_reporttruncated(rec);
+    }
+    rec = next;
+  }
+
+  while(dead) {
+    t_iemnet_receiver*next = dead->nextdead;
+    receiver_free(dead);
+    dead = next;
+  }
+}
+
+/* the receive thread has put something into the inbox */
+static void recvthread_wakeup(void*z, int fd)
+{
+  uint64_t count;
+  (void)z; /* ignore unused variable */
+  while(read(fd, &count, sizeof(count)) < 0 && EINTR == errno);
+  clock_delay(recvthread.clock, 0);
+}
+
+/* (must be called from the main thread, or with the Pd-lock held) */
+static int recvthread_startmain(void)
+{
+  if(recvthread.running) {
+    return 1;
+  }
+  recvthread.mainfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(recvthread.mainfd < 0) {
+    return 0;
+  }
+  recvthread.clock = clock_new(&recvthread, (t_method)recvthread_drain);
+  sys_addpollfn(recvthread.mainfd, recvthread_wakeup, NULL);
+  recvthread.running = 1;
+  return 1;
+}
+
+/* (must be called from the main thread, or with the Pd-lock held) */
+static t_recvthread_worker*recvthread_start(unsigned int index)
+{
+  t_recvthread_worker*w = recvthread.workers + index;
+  struct epoll_event ev;
+  if(w->running) {
+    return w;
+  }
+  if(!recvthread_startmain()) {
+    return NULL;
+  }
+  w->epollfd = epoll_create1(EPOLL_CLOEXEC);
+  w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(w->epollfd < 0 || w->wakefd < 0) {
+    goto fail;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if(epoll_ctl(w->epollfd, EPOLL_CTL_ADD, w->wakefd, &ev)) {
+    goto fail;
+  }
+  if(pthread_create(&w->thread, 0, recvthread_thread, w)) {
+    goto fail;
+  }
+  w->running = 1;
+  return w;
+fail:
+  if(w->epollfd >= 0) {
+    close(w->epollfd);
+  }
+  if(w->wakefd >= 0) {
+    close(w->wakefd);
+  }
+  return NULL;
+}
+
+/* try to let a receive thread read the socket
+ * if 'shard' is <0, the shared receive thread is used (if it is wanted) */
+static int recvthread_add(t_iemnet_receiver*rec, int shard)
+{
+  struct epoll_event ev;
+  t_recvthread_worker*w;
+  if(shard < 0) {
+    int wanted;
+    pthread_mutex_lock(&recvthread_mtx);
+    wanted = recvthread.wanted;
+    pthread_mutex_unlock(&recvthread_mtx);
+    if(!wanted) {
+      return 0;
+    }
+    shard = 0;
+  }
+  w = recvthread_start(shard % IEMNET_RECEIVER_MAXSHARDS);
+  if(!w) {
+    return 0;
+  }
+  rec->queue = queue_create();
+  if(!rec->queue) {
+    return 0;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = rec;
+  rec->worker = w;
+  if(epoll_ctl(w->epollfd, EPOLL_CTL_ADD, rec->sockfd, &ev)) {
+    rec->worker = NULL;
+    queue_destroy(rec->queue);
+    rec->queue = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/* stop reading the socket; the receiver is freed later */
+static void recvthread_remove(t_iemnet_receiver*rec)
+{
+  t_recvthread_worker*w = rec->worker;
+  epoll_ctl(w->epollfd, EPOLL_CTL_DEL, rec->sockfd, NULL);
+
+  /* no need to deliver anything any more
+   * (but it might still be in the inbox) */
+  iemnet_atomic_set(&rec->dead, 1);
+
+  pthread_mutex_lock(&recvthread_mtx);
+  rec->nextdead = w->dying;
+  w->dying = rec;
+  recvthread.destroyed++;
+  pthread_mutex_unlock(&recvthread_mtx);
+  recvthread_wake(w->wakefd);
+}
+#endif /* IEMNET_HAVE_EPOLL */
+
+int iemnet__receiver_setthread(int enable)
+{
+#ifdef IEMNET_HAVE_EPOLL
+  pthread_mutex_lock(&recvthread_mtx);
+  recvthread.wanted = (enable != 0);
+  pthread_mutex_unlock(&recvthread_mtx);
+  return (enable != 0);
+#else
+  (void)enable; /* ignore unused variable */
+  return 0;
+#endif
+}
+
+int iemnet__receiver_getthread(void)
+{
+  int result = 0;
+#ifdef IEMNET_HAVE_EPOLL
+  pthread_mutex_lock(&recvthread_mtx);
+  result = recvthread.wanted;
+  pthread_mutex_unlock(&recvthread_mtx);
+#endif
+  return result;
+}
+
+unsigned int iemnet__receiver_getdestroyed(unsigned int*released)
+{
+  unsigned int count = 0, done = 0;
+#ifdef IEMNET_HAVE_EPOLL
+  t_iemnet_receiver*rec;
+  pthread_mutex_lock(&recvthread_mtx);
+  count = recvthread.destroyed;
+  for(rec = recvthread.dead; rec; rec = rec->nextdead) {
+    done++;
+  }
+  pthread_mutex_unlock(&recvthread_mtx);
+#endif
+  if(released) {
+    *released = done;
+  }
+  return count;
+}
+
+static t_iemnet_receiver*receiver_create(int sock, void*userdata,
+    t_iemnet_receivecallback callback, int subthread, int shard)
+{
+  t_iemnet_receiver*rec = (t_iemnet_receiver*)calloc(1, sizeof(
                           t_iemnet_receiver));
 
   DEBUG("create new receiver for 0x%X:%d", userdata, sock);
@@ -88,11 +909,19 @@ t_iemnet_receiver*iemnet__receiver_create(int sock, void*userdata,
     rec->sockfd = sock;
     rec->userdata = userdata;
     rec->callback = callback;
+    rec->budgetpackets = IEMNET_RECEIVE_BUDGET_PACKETS;
+    rec->bufsize = INBUFSIZE;
+    rec->socktype = receiver_socktype(sock);
 
     if(subthread) {
       sys_lock();
     }
-    sys_addpollfn(sock, pollfun, rec);
+#ifdef IEMNET_HAVE_EPOLL
+    if(!recvthread_add(rec, shard))
+#else
+    (void)shard; /* ignore unused variable */
+#endif
+      sys_addpollfn(sock, pollfun, rec);
     if(subthread) {
       sys_unlock();
     }
@@ -102,6 +931,17 @@ t_iemnet_receiver*iemnet__receiver_create(int sock, void*userdata,
 
   return rec;
 }
+t_iemnet_receiver*iemnet__receiver_create(int sock, void*userdata,
+    t_iemnet_receivecallback callback, int subthread)
+{
+  return receiver_create(sock, userdata, callback, subthread, -1);
+}
+t_iemnet_receiver*iemnet__receiver_create_shard(int sock, void*userdata,
+    t_iemnet_receivecallback callback, int subthread, unsigned int shard)
+{
+  return receiver_create(sock, userdata, callback, subthread,
+                         shard % IEMNET_RECEIVER_MAXSHARDS);
+}
 void iemnet__receiver_destroy(t_iemnet_receiver*rec, int subthread)
 {
   int sockfd;
@@ -114,7 +954,21 @@ void iemnet__receiver_destroy(t_iemnet_receiver*rec, int subthread)
   if(subthread) {
     sys_lock();
   }
-  sys_rmpollfn(rec->sockfd);
+#ifdef IEMNET_HAVE_EPOLL
+  if(rec->worker) {
+    /* the receive thread might still be using the receiver,
+     * so it is freed once the thread lets go of it */
+    recvthread_remove(rec);
+    if(subthread) {
+      sys_unlock();
+    }
+    DEBUG("[%p] detached receiver %d", rec, sockfd);
+    return;
+  }
+#endif
+  if(!rec->paused) {
+    sys_rmpollfn(rec->sockfd);
+  }
 
   /* FIXXME: read any remaining bytes from the socket */
 
@@ -122,23 +976,126 @@ void iemnet__receiver_destroy(t_iemnet_receiver*rec, int subthread)
     sys_unlock();
   }
 
+  if(rec->inpoll) {
+    /* we are called from the callback; pollfun() frees the receiver */
+    rec->destroyed = 1;
+    rec->userdata = NULL;
+    rec->callback = NULL;
+    return;
+  }
+
   DEBUG("[%p] really destroying receiver %d", sockfd);
   DEBUG("[%p] closed socket %d", rec, sockfd);
 
-  rec->sockfd = -1;
-  rec->userdata = NULL;
-  rec->callback = NULL;
-
-  free(rec);
+  receiver_free(rec);
   rec = NULL;
 }
 
 
-/* just dummy, since we don't maintain a queue any more */
 int iemnet__receiver_getsize(t_iemnet_receiver*x)
 {
+  unsigned long pending = 0, buffered = 0;
+  if(!x) {
+    return -1;
+  }
+  iemnet__receiver_getstats(x, &pending, &buffered, NULL);
+  pending += buffered;
+  return (pending > INT_MAX)?INT_MAX:(int)pending;
+}
+
+void iemnet__receiver_getstats(t_iemnet_receiver*x,
+                               unsigned long*pending, unsigned long*buffered,
+                               unsigned long*highwater)
+{
+  unsigned long inkernel = 0, queued = 0;
   if(x) {
-    return 0;
+    inkernel = receiver_pending(x->sockfd);
+    queued = receiver_buffered(x);
+    receiver_sethighwater(x, inkernel + queued);
+  }
+  if(pending) {
+    *pending = inkernel;
   }
-  return -1;
+  if(buffered) {
+    *buffered = queued;
+  }
+  if(highwater) {
+    *highwater = x?(unsigned long)iemnet_atomic_get(&x->highwater):0;
+  }
+}
+
+void iemnet__receiver_setbudget(t_iemnet_receiver*x,
+                                unsigned int maxpackets, size_t maxbytes)
+{
+  if(!x) {
+    return;
+  }
+  if(!maxpackets) {
+    maxpackets = IEMNET_RECEIVE_BUDGET_PACKETS;
+  }
+  iemnet_atomic_set(&x->budgetpackets, maxpackets);
+  iemnet_atomic_set(&x->budgetbytes, (long)maxbytes);
+}
+
+unsigned long iemnet__receiver_getexhausted(t_iemnet_receiver*x)
+{
+  if(x) {
+    return (unsigned long)iemnet_atomic_get(&x->exhausted);
+  }
+  return 0;
+}
+
+void iemnet__receiver_setbufsize(t_iemnet_receiver*x, size_t size)
+{
+  if(!x) {
+    return;
+  }
+  if(!size) {
+    size = INBUFSIZE;
+  }
+  /* the buffer is re-allocated by the reader, before its next read */
+  iemnet_atomic_set(&x->bufsize, (long)size);
+}
+
+size_t iemnet__receiver_getbufsize(t_iemnet_receiver*x)
+{
+  if(x) {
+    return (size_t)iemnet_atomic_get(&x->bufsize);
+  }
+  return 0;
+}
+
+void iemnet__receiver_pause(t_iemnet_receiver*x, int pause)
+{
+  pause = (pause != 0);
+  if(!x || x->paused == pause) {
+    return;
+  }
+  x->paused = pause;
+#ifdef IEMNET_HAVE_EPOLL
+  if(x->worker) {
+    if(pause) {
+      epoll_ctl(x->worker->epollfd, EPOLL_CTL_DEL, x->sockfd, NULL);
+    } else {
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN | EPOLLRDHUP;
+      ev.data.ptr = x;
+      epoll_ctl(x->worker->epollfd, EPOLL_CTL_ADD, x->sockfd, &ev);
+      /* deliver whatever has been read before we paused */
+      recvthread_schedule(x);
+    }
+    return;
+  }
+#endif
+  if(pause) {
+    sys_rmpollfn(x->sockfd);
+  } else {
+    sys_addpollfn(x->sockfd, pollfun, x);
+  }
+}
+
+int iemnet__receiver_ispaused(t_iemnet_receiver*x)
+{
+  return x?x->paused:0;
 }
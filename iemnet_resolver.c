@@ -0,0 +1,399 @@
+/* iemnet
+ *
+ * resolver
+ *   resolves hostnames to IPv4 addresses (in the background)
+ *   and caches the results for a while
+ *
+ *  copyright © 2010-2015 IOhannes m zmölnig, IEM
+ */
+
+/* This program is free software; you can redistribute it and/or                */
+/* modify it under the terms of the GNU General Public License                  */
+/* as published by the Free Software Foundation; either version 2               */
+/* of the License, or (at your option) any later version.                       */
+/*                                                                              */
+/* This program is distributed in the hope that it will be useful,              */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of               */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                */
+/* GNU General Public License for more details.                                 */
+/*                                                                              */
+/* You should have received a copy of the GNU General Public License            */
+/* along with this program; if not, see                                         */
+/*     http://www.gnu.org/licenses/                                             */
+/*                                                                              */
+
+#define DEBUGLEVEL 4
+
+#include "iemnet.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <time.h>
+# include <sys/time.h>
+#endif
+
+/* number of hostnames we remember */
+#define IEMNET_RESOLVER_CACHESIZE 64
+/* how long (in seconds) we remember a resolved hostname;
+ * getaddrinfo() doesn't tell us the real TTL of the DNS record */
+#define IEMNET_RESOLVER_TTL 60.
+/* how long (in seconds) we remember that a hostname could not be resolved */
+#define IEMNET_RESOLVER_NEGATIVE_TTL 5.
+
+/* ---------------------------- cache ------------------------------------- */
+
+typedef struct _resolver_entry {
+  char*host; /* NULL if the entry is unused */
+  uint32_t addr; /* host byte order */
+  int success; /* 0 if the hostname could not be resolved */
+  double expires; /* <0: never */
+} t_resolver_entry;
+
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+  t_resolver_entry entries[IEMNET_RESOLVER_CACHESIZE];
+  double ttl;
+  unsigned long hits, misses;
+} cache = {
+  {{0}}, IEMNET_RESOLVER_TTL, 0, 0
+};
+
+/* a monotonic time (in seconds) that is safe to read from any thread */
+static double resolver_now(void)
+{
+#ifdef _WIN32
+  return GetTickCount() * 0.001;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+static void cache_clear(t_resolver_entry*e)
+{
+  free(e->host);
+  memset(e, 0, sizeof(*e));
+}
+
+/* (must be called with the cache_mtx held) */
+static t_resolver_entry*cache_find(const char*host, double now)
+{
+  unsigned int i;
+  for(i = 0; i < IEMNET_RESOLVER_CACHESIZE; i++) {
+    t_resolver_entry*e = cache.entries + i;
+    if(!e->host) {
+      continue;
+    }
+    if(e->expires >= 0 && e->expires <= now) {
+      cache_clear(e);
+      continue;
+    }
+    if(!strcmp(e->host, host)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* returns 1 if the hostname was found in the cache
+ * if 'count' is 0, the lookup does not show up in the statistics */
+static int cache_lookup(const char*host, uint32_t*addr, int*success,
+                        int count)
+{
+  t_resolver_entry*e;
+  pthread_mutex_lock(&cache_mtx);
+  e = cache_find(host, resolver_now());
+  if(e) {
+    *addr = e->addr;
+    *success = e->success;
+  }
+  if(count) {
+    if(e) {
+      cache.hits++;
+    } else {
+      cache.misses++;
+    }
+  }
+  pthread_mutex_unlock(&cache_mtx);
+  return (NULL != e);
+}
+
+/* ttl<0 means 'forever'; ttl==0 doesn't store anything */
+static void cache_store(const char*host, uint32_t addr, int success,
+                        double ttl)
+{
+  double now = resolver_now();
+  t_resolver_entry*e = NULL;
+  char*name = NULL;
+  unsigned int i;
+  if(!ttl) {
+    return;
+  }
+  name = strdup(host);
+  if(!name) {
+    return;
+  }
+  pthread_mutex_lock(&cache_mtx);
+  e = cache_find(host, now);
+  /* find a free slot, or replace the entry that expires first */
+  for(i = 0; !e && i < IEMNET_RESOLVER_CACHESIZE; i++) {
+    if(!cache.entries[i].host) {
+      e = cache.entries + i;
+    }
+  }
+  for(i = 0; !e && i < IEMNET_RESOLVER_CACHESIZE; i++) {
+    t_resolver_entry*c = cache.entries + i;
+    if(c->expires >= 0 && (!e || c->expires < e->expires)) {
+      e = c;
+    }
+  }
+  if(e) {
+    cache_clear(e);
+    e->host = name;
+    e->addr = addr;
+    e->success = success;
+    e->expires = (ttl < 0) ? -1 : (now + ttl);
+    name = NULL;
+  }
+  pthread_mutex_unlock(&cache_mtx);
+  free(name);
+}
+
+/* --------------------------- resolving ---------------------------------- */
+
+/* returns 1 if the hostname could be resolved */
+static int resolver_getaddrinfo(const char*host, uint32_t*addr, int numeric)
+{
+  struct addrinfo hints, *ai = NULL;
+  int success = 0;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if(numeric) {
+    hints.ai_flags = AI_NUMERICHOST;
+  }
+  if(!getaddrinfo(host, NULL, &hints, &ai) && ai) {
+    *addr = ntohl(((struct sockaddr_in*)ai->ai_addr)->sin_addr.s_addr);
+    success = 1;
+  }
+  if(ai) {
+    freeaddrinfo(ai);
+  }
+  return success;
+}
+
+static int resolver_dns(const char*host, uint32_t*addr)
+{
+  return resolver_getaddrinfo(host, addr, 0);
+}
+/* asks the DNS (protected by cache_mtx) */
+static t_iemnet_lookupfunction resolver_lookupfun = resolver_dns;
+
+/* resolve without blocking; returns 1 if we know the answer */
+static int resolver_immediate(const char*host, uint32_t*addr, int*success)
+{
+  /* numeric addresses never need to ask the DNS */
+  if(resolver_getaddrinfo(host, addr, 1)) {
+    *success = 1;
+    return 1;
+  }
+  return cache_lookup(host, addr, success, 1);
+}
+
+/* ask the DNS (blocking), and remember the answer */
+static int resolver_ask(const char*host, uint32_t*addr)
+{
+  t_iemnet_lookupfunction lookup;
+  int success;
+  double ttl;
+  pthread_mutex_lock(&cache_mtx);
+  lookup = resolver_lookupfun;
+  pthread_mutex_unlock(&cache_mtx);
+  success = (lookup)(host, addr);
+  pthread_mutex_lock(&cache_mtx);
+  ttl = cache.ttl;
+  pthread_mutex_unlock(&cache_mtx);
+  if(!success && ttl > IEMNET_RESOLVER_NEGATIVE_TTL) {
+    ttl = IEMNET_RESOLVER_NEGATIVE_TTL;
+  }
+  cache_store(host, *addr, success, ttl);
+  return success;
+}
+
+int iemnet__resolve(const char*host, uint32_t*addr)
+{
+  int success = 0;
+  if(resolver_immediate(host, addr, &success)) {
+    return success;
+  }
+  return resolver_ask(host, addr);
+}
+
+/* ----------------------- asynchronous lookups --------------------------- */
+
+/* each lookup runs in its own (detached) thread,
+ * so a hostname that takes long to resolve does not hold up the others
+ */
+
+struct _iemnet_resolver {
+  char*host;
+  void*userdata;
+  t_iemnet_resolvecallback callback;
+
+  int cancelled; /* only touched by the main thread */
+  /* the result (only touched by the resolver thread, until it is reported) */
+  int success;
+  uint32_t addr;
+
+  t_iemnet_mainjob job; /* reports the result */
+};
+
+static void resolver_free(t_iemnet_resolver*r)
+{
+  free(r->host);
+  free(r);
+}
+
+/* report a finished lookup (in the main thread) */
+static void resolver_report(void*z)
+{
+  t_iemnet_resolver*r = (t_iemnet_resolver*)z;
+  if(!r->cancelled) {
+    (r->callback)(r->userdata, r->success, r->addr);
+  }
+  resolver_free(r);
+}
+
+static void*resolver_thread(void*arg)
+{
+  t_iemnet_resolver*r = (t_iemnet_resolver*)arg;
+  /* the cache miss has already been counted by iemnet__resolver_lookup();
+   * but another lookup of the same host might have finished meanwhile */
+  if(!cache_lookup(r->host, &r->addr, &r->success, 0)) {
+    r->success = resolver_ask(r->host, &r->addr);
+  }
+  iemnet__mainjob_post(&r->job, resolver_report, r);
+  return 0;
+}
+
+/* (must be called from the main thread, or with the Pd-lock held) */
+static int resolver_start(t_iemnet_resolver*r)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int res;
+  if(!iemnet__mainjob_start()) {
+    return 0;
+  }
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  res = pthread_create(&thread, &attr, resolver_thread, r);
+  pthread_attr_destroy(&attr);
+  return !res;
+}
+
+t_iemnet_resolver*iemnet__resolver_lookup(const char*host, void*userdata,
+    t_iemnet_resolvecallback callback)
+{
+  t_iemnet_resolver*r;
+  uint32_t addr = 0;
+  int success = 0;
+
+  if(resolver_immediate(host, &addr, &success)) {
+    (callback)(userdata, success, addr);
+    return NULL;
+  }
+
+  r = (t_iemnet_resolver*)calloc(1, sizeof(*r));
+  if(r) {
+    r->host = strdup(host);
+    r->userdata = userdata;
+    r->callback = callback;
+  }
+  if(!r || !r->host || !resolver_start(r)) {
+    if(r) {
+      resolver_free(r);
+    }
+    /* resolving synchronously would block Pd */
+    (callback)(userdata, 0, 0);
+    return NULL;
+  }
+  return r;
+}
+
+void iemnet__resolver_cancel(t_iemnet_resolver*r)
+{
+  /* the lookup is freed once its result has been handed back */
+  if(r) {
+    r->cancelled = 1;
+  }
+}
+
+/* ---------------------------- settings ---------------------------------- */
+
+void iemnet__resolver_addhost(const char*host, uint32_t addr)
+{
+  cache_store(host, addr, 1, -1);
+}
+
+void iemnet__resolver_setlookup(t_iemnet_lookupfunction lookup)
+{
+  pthread_mutex_lock(&cache_mtx);
+  resolver_lookupfun = lookup ? lookup : resolver_dns;
+  pthread_mutex_unlock(&cache_mtx);
+}
+
+void iemnet__resolver_setttl(float ttl)
+{
+  unsigned int i;
+  if(ttl < 0) {
+    ttl = 0;
+  }
+  pthread_mutex_lock(&cache_mtx);
+  cache.ttl = ttl;
+  if(!ttl) {
+    /* forget everything (but the static hosts) */
+    for(i = 0; i < IEMNET_RESOLVER_CACHESIZE; i++) {
+      if(cache.entries[i].expires >= 0) {
+        cache_clear(cache.entries + i);
+      }
+    }
+  }
+  pthread_mutex_unlock(&cache_mtx);
+}
+
+float iemnet__resolver_getstats(unsigned int*entries,
+                                unsigned long*hits, unsigned long*misses)
+{
+  double now = resolver_now();
+  float ttl;
+  unsigned int i, count = 0;
+  pthread_mutex_lock(&cache_mtx);
+  for(i = 0; i < IEMNET_RESOLVER_CACHESIZE; i++) {
+    t_resolver_entry*e = cache.entries + i;
+    if(e->host && (e->expires < 0 || e->expires > now)) {
+      count++;
+    }
+  }
+  if(entries) {
+    *entries = count;
+  }
+  if(hits) {
+    *hits = cache.hits;
+  }
+  if(misses) {
+    *misses = cache.misses;
+  }
+  ttl = cache.ttl;
+  pthread_mutex_unlock(&cache_mtx);
+  return ttl;
+}
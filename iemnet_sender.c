@@ -24,6 +24,11 @@
 
 #define DEBUGLEVEL 2
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* for sendmmsg() */
+# define _GNU_SOURCE
+#endif
+
 #include "iemnet.h"
 #include "iemnet_data.h"
 
@@ -40,8 +45,25 @@
 # include <ws2tcpip.h> /* for socklen_t */
 #else
 # include <sys/socket.h>
+# include <sys/uio.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <poll.h>
 # include <unistd.h>
 # include <fcntl.h>
+# include <limits.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) \
+  && ((__GLIBC__ > 2) || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+# define IEMNET_HAVE_SENDMMSG 1
+#endif
+
+#ifdef __linux__
+# define IEMNET_HAVE_EPOLL 1
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <stdint.h>
 #endif
 
 #include <pthread.h>
@@ -59,7 +81,40 @@ static int debug_lockcount = 0;
  *   - there is a sender thread for each open connection
  *   - the main thread just adds chunks to each sender threads processing queue
  *   - the sender thread tries to send the queue as fast as possible
+ *
+ *   - alternatively (see iemnet__sender_setthreads()), a fixed number of
+ *     shared worker threads multiplex all senders with epoll;
+ *     pushing a chunk schedules the sender on its worker, and a sender whose
+ *     socket is full waits for EPOLLOUT (without blocking the worker)
+ */
+
+/* maximum number of chunks the send thread handles per wakeup */
+#if defined(IOV_MAX) && IOV_MAX < 1024
+# define IEMNET_SENDBATCH IOV_MAX
+#else
+# define IEMNET_SENDBATCH 1024
+#endif
+/* defaults */
+#define IEMNET_SENDBATCH_CHUNKS 256
+#define IEMNET_SENDBATCH_BYTES 65536
+
+/* a batch of chunks that is currently being sent */
+typedef struct _iemnet_sendstate {
+  t_iemnet_chunk*chunks[IEMNET_SENDBATCH];
+  unsigned int count;
+  unsigned int first; /* the first chunk that has not been sent (completely) */
+  size_t offset; /* how much of the first chunk has already been sent */
+} t_iemnet_sendstate;
+
+typedef struct _iemnet_sendworker t_iemnet_sendworker;
+
+/* the batched send functions take the remaining chunks from the sendstate
+ * and return 1 if all of them have been sent, 0 if the connection broke
+ * and -1 if a sender on a shared worker has to wait for the socket
+ * (the progress is kept in the sendstate)
  */
+typedef int (*t_iemnet_sendbatchfunction)(t_iemnet_sender*s, int sockfd,
+    t_iemnet_sendstate*state);
 
 struct _iemnet_sender {
   pthread_t thread;
@@ -72,17 +127,120 @@ struct _iemnet_sender {
   const void*userdata; /* user provided data */
   t_iemnet_sendfunction sendfun; /* user provided send function */
 
+  /* how many chunks (and bytes) to handle with a single wakeup (and syscall) */
+  unsigned int batchchunks;
+  size_t batchbytes;
+
+  t_iemnet_sendstate state;
+  t_iemnet_sendbatchfunction sendbatch; /* batched send function (if any) */
+
+  /* shared worker (or NULL if the sender has a thread of its own) */
+  t_iemnet_sendworker*worker;
+  pthread_cond_t cond; /* signals that the worker has let go of the sender */
+  int detached;
+  /* owned by the worker (protected by the worker's mutex) */
+  int scheduled;
+  struct _iemnet_sender*next;
+  /* owned by the worker thread */
+  int pollfd; /* fd registered with epoll (-1 if none) */
+  int blocked; /* waiting for the socket to become writable */
+  int broken;
+
   pthread_mutex_t mtx; /* mutex to protect isrunning,.. */
 };
 
 /* the workhorse of the family */
 
+/* how long to wait for a blocked socket before re-checking whether we
+ * should still be sending */
+#define IEMNET_SENDWAIT_MS 100
 
+static int iemnet__sender_keepsending(t_iemnet_sender*s)
+{
+  int result;
+  LOCK(&s->mtx);
+  result = s->keepsending;
+  UNLOCK(&s->mtx);
+  return result;
+}
+
+/* wait until a (non-blocking) socket can take more data
+ * returns 0 if the socket broke or the sender is shutting down
+ */
+static int iemnet__sender_waitwritable(t_iemnet_sender*s, int sockfd)
+{
+  while(iemnet__sender_keepsending(s)) {
+    int result;
+#ifdef _WIN32
+    fd_set writefds;
+    struct timeval timeout;
+    FD_ZERO(&writefds);
+    FD_SET(sockfd, &writefds);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = IEMNET_SENDWAIT_MS * 1000;
+    result = select(sockfd + 1, NULL, &writefds, NULL, &timeout);
+    if(result < 0 && WSAEINTR == WSAGetLastError()) {
+      continue;
+    }
+#else
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    result = poll(&pfd, 1, IEMNET_SENDWAIT_MS);
+    if(result < 0 && EINTR == errno) {
+      continue;
+    }
+    if(result > 0 && (pfd.revents & POLLNVAL)) {
+      return 0;
+    }
+#endif
+    if(result < 0) {
+      return 0;
+    }
+    if(result > 0) {
+      /* writable (or errored, which the next send will tell us) */
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* decide what to do after a failed send
+ * returns 1 if the send should be retried, 0 if the connection broke
+ * and -1 if a sender on a shared worker would have to wait
+ */
+static int iemnet__sender_recover(t_iemnet_sender*s, int sockfd)
+{
+#ifdef _WIN32
+  int err = WSAGetLastError();
+  if(WSAEINTR == err) {
+    return 1;
+  }
+  if(WSAEWOULDBLOCK == err) {
+    return iemnet__sender_waitwritable(s, sockfd);
+  }
+#else
+  int err = errno;
+  if(EINTR == err) {
+    return 1;
+  }
+  if(EAGAIN == err || EWOULDBLOCK == err) {
+    if(s->worker) {
+      return -1;
+    }
+    return iemnet__sender_waitwritable(s, sockfd);
+  }
+#endif
+  DEBUG("send failed with %d", err);
+  return 0;
+}
+
+/* x is the sender itself */
 static int iemnet__sender_defaultsend(const void*x, int sockfd,
                                       t_iemnet_chunk*c)
 {
-  int result = -1;
-
+  t_iemnet_sender*sender = (t_iemnet_sender*)x;
   struct sockaddr_in to;
   socklen_t tolen = sizeof(to);
 
@@ -94,33 +252,204 @@ static int iemnet__sender_defaultsend(const void*x, int sockfd,
   flags |= MSG_NOSIGNAL;
 #endif
 
-
-  //fprintf(stderr, "sending %d bytes at %x to %d\n", size, data, sockfd);
   if(c->port) {
-    DEBUG("%p sending %d bytes to %x:%d @%d", x, size, c->addr, c->port, c->family);
-
+    memset(&to, 0, sizeof(to));
     to.sin_addr.s_addr = htonl(c->addr);
     to.sin_port = htons(c->port);
     to.sin_family = c->family;
-    result = sendto(sockfd,
+  }
+
+  /* datagrams are sent in one go;
+   * on stream sockets we might have to send the remainder of a chunk */
+  do {
+    int result;
+    if(c->port) {
+      DEBUG("%p sending %d bytes to %x:%d @%d", x, size, c->addr, c->port, c->family);
+      result = sendto(sockfd,
+                      (void *)data, size, /* DATA */
+                      flags, /* FLAGS */
+                      (struct sockaddr *)&to, tolen); /* DESTADDR */
+    } else {
+      DEBUG("sending %d bytes", size);
+      result = send(sockfd,
                     (void *)data, size, /* DATA */
-                    flags, /* FLAGS */
-                    (struct sockaddr *)&to, tolen); /* DESTADDR */
-  } else {
-    DEBUG("sending %d bytes", size);
-    result = send(sockfd,
-                  (void *)data, size, /* DATA */
-                  flags); /* FLAGS */
+                    flags); /* FLAGS */
+    }
+    if(result < 0) {
+      if(iemnet__sender_recover(sender, sockfd)) {
+        continue;
+      }
+      /* broken pipe */
+      return 0;
+    }
+    DEBUG("sent %d bytes", result);
+    if(c->port) {
+      break;
+    }
+    data += result;
+    size -= result;
+  } while(size);
+
+  return 1;
+}
+
+static int iemnet__sender_sendflags(t_iemnet_sender*s)
+{
+  int flags = 0;
+#ifdef __linux__
+  flags |= MSG_NOSIGNAL;
+#endif
+#ifdef MSG_DONTWAIT
+  /* the shared workers must never block on a socket */
+  if(s->worker) {
+    flags |= MSG_DONTWAIT;
   }
-  if(result<0) {
-    /* broken pipe */
-    return 0;
+#else
+  (void)s; /* ignore unused variable */
+#endif
+  return flags;
+}
+
+#ifndef _WIN32
+/* send a number of chunks to a stream socket with a single syscall
+ * (resuming after partial writes)
+ */
+static int iemnet__sender_sendv(t_iemnet_sender*s, int sockfd,
+                                t_iemnet_sendstate*state)
+{
+  struct iovec iov[IEMNET_SENDBATCH];
+  struct msghdr msg;
+  unsigned int base = state->first, i;
+  int flags = iemnet__sender_sendflags(s);
+
+  for(i = base; i < state->count; i++) {
+    iov[i - base].iov_base = state->chunks[i]->data;
+    iov[i - base].iov_len = state->chunks[i]->size;
+  }
+  if(state->first < state->count) {
+    iov[0].iov_base = (char*)iov[0].iov_base + state->offset;
+    iov[0].iov_len -= state->offset;
+  }
+
+  while(state->first < state->count) {
+    struct iovec*cur = iov + (state->first - base);
+    ssize_t result;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = cur;
+    msg.msg_iovlen = state->count - state->first;
+    result = sendmsg(sockfd, &msg, flags);
+    if(result < 0) {
+      int ret = iemnet__sender_recover(s, sockfd);
+      if(ret > 0) {
+        continue;
+      }
+      /* broken pipe (or we have to wait) */
+      return ret;
+    }
+    DEBUG("sent %d bytes in %d chunks", (int)result,
+          state->count - state->first);
+
+    /* skip everything that has been written,
+     * and continue in the middle of a chunk if needed */
+    while(state->first < state->count && (size_t)result >= cur->iov_len) {
+      result -= cur->iov_len;
+      state->first++;
+      state->offset = 0;
+      cur++;
+    }
+    if(state->first < state->count) {
+      cur->iov_base = (char*)cur->iov_base + result;
+      cur->iov_len -= result;
+      state->offset += result;
+    }
+  }
+  return 1;
+}
+#endif /* !_WIN32 */
+
+#ifdef IEMNET_HAVE_SENDMMSG
+/* send a number of datagrams with a single syscall
+ * each chunk is sent as a separate datagram (to its own destination)
+ */
+static int iemnet__sender_sendmm(t_iemnet_sender*s, int sockfd,
+                                 t_iemnet_sendstate*state)
+{
+  struct mmsghdr msgs[IEMNET_SENDBATCH];
+  struct iovec iov[IEMNET_SENDBATCH];
+  struct sockaddr_in to[IEMNET_SENDBATCH];
+  unsigned int base = state->first, count = state->count - base, i;
+  int flags = iemnet__sender_sendflags(s);
+
+  memset(msgs, 0, count * sizeof(*msgs));
+  for(i = 0; i < count; i++) {
+    t_iemnet_chunk*c = state->chunks[base + i];
+    iov[i].iov_base = c->data;
+    iov[i].iov_len = c->size;
+    msgs[i].msg_hdr.msg_iov = iov + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    if(c->port) {
+      memset(to + i, 0, sizeof(*to));
+      to[i].sin_addr.s_addr = htonl(c->addr);
+      to[i].sin_port = htons(c->port);
+      to[i].sin_family = c->family;
+      msgs[i].msg_hdr.msg_name = to + i;
+      msgs[i].msg_hdr.msg_namelen = sizeof(*to);
+    }
   }
 
-  /* shouldn't we do something with the result here? */
-  DEBUG("sent %d bytes", result);
+  /* sendmmsg() might not send all datagrams at once */
+  while(state->first < state->count) {
+    int result = sendmmsg(sockfd, msgs + (state->first - base),
+                          state->count - state->first, flags);
+    if(result < 0) {
+      int ret = iemnet__sender_recover(s, sockfd);
+      if(ret > 0) {
+        continue;
+      }
+      /* broken pipe (or we have to wait) */
+      return ret;
+    }
+    DEBUG("sent %d of %d datagrams", result, state->count - state->first);
+    state->first += result;
+  }
   return 1;
 }
+#endif /* IEMNET_HAVE_SENDMMSG */
+
+/* the batched send implementation for the given socket (if any) */
+static t_iemnet_sendbatchfunction iemnet__sender_getbatchfunction(
+  int sockfd)
+{
+  int socktype = 0;
+  socklen_t socktypelen = sizeof(socktype);
+  if(getsockopt(sockfd, SOL_SOCKET, SO_TYPE, (void*)&socktype, &socktypelen)) {
+    return NULL;
+  }
+  switch(socktype) {
+#ifndef _WIN32
+  case SOCK_STREAM:
+    return iemnet__sender_sendv;
+#endif
+#ifdef IEMNET_HAVE_SENDMMSG
+  case SOCK_DGRAM:
+    return iemnet__sender_sendmm;
+#endif
+  default:
+    break;
+  }
+  return NULL;
+}
+
+/* destroy all chunks of the current batch */
+static void iemnet__sender_clearstate(t_iemnet_sendstate*state)
+{
+  unsigned int i;
+  for(i = 0; i < state->count; i++) {
+    iemnet__chunk_destroy(state->chunks[i]);
+  }
+  state->count = state->first = 0;
+  state->offset = 0;
+}
 
 static void*iemnet__sender_sendthread(void*arg)
 {
@@ -128,34 +457,47 @@ static void*iemnet__sender_sendthread(void*arg)
 
   int sockfd = -1;
   t_iemnet_queue*q = NULL;
-  t_iemnet_chunk*c = NULL;
+  t_iemnet_sendstate*state = &sender->state;
   t_iemnet_sendfunction dosend = iemnet__sender_defaultsend;
   const void*userdata = NULL;
+  t_iemnet_sendbatchfunction sendbatch = NULL;
 
   LOCK(&sender->mtx);
   q = sender->queue;
   userdata = sender->userdata;
   if(NULL != sender->sendfun) {
     dosend = sender->sendfun;
+  } else {
+    userdata = sender;
   }
 
   sockfd = sender->sockfd;
+  /* with the default implementation, all pending chunks
+   * are sent with a single syscall (if the system supports it) */
+  sendbatch = sender->sendbatch;
 
   while(sender->keepsending) {
+    unsigned int batchchunks = sender->batchchunks;
+    size_t batchbytes = sender->batchbytes;
+    int ok = 1;
     UNLOCK(&sender->mtx);
 
-    c = queue_pop_block(q);
-    if(c) {
-      if(!dosend(userdata, sockfd, c)) {
-        iemnet__chunk_destroy(c);
-
-        LOCK(&sender->mtx);
-        break;
+    /* drain everything that is pending in a single go */
+    state->count = queue_pop_batch(q, state->chunks, batchchunks, batchbytes);
+    if(sendbatch) {
+      ok = (!state->count) || (sendbatch(sender, sockfd, state) > 0);
+    } else {
+      for(; ok && state->first < state->count; state->first++) {
+        ok = dosend(userdata, sockfd, state->chunks[state->first]);
       }
-      iemnet__chunk_destroy(c);
-      c = NULL;
     }
+    iemnet__sender_clearstate(state);
+
     LOCK(&sender->mtx);
+    if(!ok) {
+      /* broken pipe */
+      break;
+    }
   }
   sender->isrunning = 0;
   UNLOCK(&sender->mtx);
@@ -163,7 +505,291 @@ static void*iemnet__sender_sendthread(void*arg)
   return NULL;
 }
 
-int iemnet__sender_send(t_iemnet_sender*s, t_iemnet_chunk*c)
+
+#ifdef IEMNET_HAVE_EPOLL
+/* ----------------------------- shared send workers ------------------------- */
+
+struct _iemnet_sendworker {
+  pthread_t thread;
+  int epollfd;
+  int wakefd; /* eventfd to wake up the worker */
+  pthread_mutex_t mtx; /* protects the 'ready' list */
+  t_iemnet_sender*ready; /* senders that have something to do */
+};
+
+static pthread_mutex_t sendworkers_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int sendworkers_wanted = -1; /* -1: disabled; 0: one per core */
+static t_iemnet_sendworker*sendworkers = NULL;
+static unsigned int sendworkers_count = 0;
+static unsigned int sendworkers_next = 0;
+
+static unsigned int iemnet__sendworker_numcores(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (unsigned int)n : 1;
+}
+
+/* tell the worker that the sender has something to do
+ * (new data, or it is being destroyed) */
+static void iemnet__sendworker_schedule(t_iemnet_sender*s)
+{
+  t_iemnet_sendworker*w = s->worker;
+  int wakeup = 0;
+  pthread_mutex_lock(&w->mtx);
+  if(!s->scheduled) {
+    s->scheduled = 1;
+    wakeup = (NULL == w->ready);
+    s->next = w->ready;
+    w->ready = s;
+  }
+  pthread_mutex_unlock(&w->mtx);
+  if(wakeup) {
+    uint64_t one = 1;
+    while(write(w->wakefd, &one, sizeof(one)) < 0 && EINTR == errno);
+  }
+}
+
+/* wait for the socket to become writable again */
+static int iemnet__sendworker_block(t_iemnet_sendworker*w, t_iemnet_sender*s)
+{
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLOUT | EPOLLONESHOT;
+  ev.data.ptr = s;
+  if(s->pollfd >= 0) {
+    if(!epoll_ctl(w->epollfd, EPOLL_CTL_MOD, s->pollfd, &ev)) {
+      s->blocked = 1;
+      return 1;
+    }
+    return 0;
+  }
+  s->pollfd = s->sockfd;
+  if(epoll_ctl(w->epollfd, EPOLL_CTL_ADD, s->pollfd, &ev)) {
+    if(EEXIST != errno) {
+      /* nobody would ever wake us up */
+      s->pollfd = -1;
+      return 0;
+    }
+    /* another sender is already watching this socket (e.g. udpserver),
+     * so watch a duplicate of it */
+    s->pollfd = dup(s->sockfd);
+    if(s->pollfd < 0 || epoll_ctl(w->epollfd, EPOLL_CTL_ADD, s->pollfd, &ev)) {
+      if(s->pollfd >= 0) {
+        close(s->pollfd);
+      }
+      s->pollfd = -1;
+      return 0;
+    }
+  }
+  s->blocked = 1;
+  return 1;
+}
+
+/* send as much as possible without blocking */
+static void iemnet__sendworker_flush(t_iemnet_sendworker*w,
+                                     t_iemnet_sender*s)
+{
+  t_iemnet_sendbatchfunction sendbatch = s->sendbatch;
+  t_iemnet_sendstate*state = &s->state;
+  unsigned int batchchunks;
+  size_t batchbytes;
+  int result = 1;
+
+  LOCK(&s->mtx);
+  batchchunks = s->batchchunks;
+  batchbytes = s->batchbytes;
+  UNLOCK(&s->mtx);
+
+  while(!s->broken) {
+    if(state->first >= state->count) {
+      iemnet__sender_clearstate(state);
+      state->count = queue_pop_batch_noblock(s->queue, state->chunks,
+                                             batchchunks, batchbytes);
+      if(!state->count) {
+        return;
+      }
+    }
+    result = sendbatch(s, s->sockfd, state);
+    if(result < 0 && iemnet__sendworker_block(w, s)) {
+      return;
+    }
+    if(result <= 0) {
+      /* broken pipe */
+      s->broken = 1;
+      iemnet__sender_clearstate(state);
+      LOCK(&s->mtx);
+      s->isrunning = 0;
+      UNLOCK(&s->mtx);
+    }
+  }
+}
+
+/* the sender is being destroyed: forget about it */
+static void iemnet__sendworker_detach(t_iemnet_sendworker*w,
+                                      t_iemnet_sender*s)
+{
+  if(s->pollfd >= 0) {
+    epoll_ctl(w->epollfd, EPOLL_CTL_DEL, s->pollfd, NULL);
+    if(s->pollfd != s->sockfd) {
+      close(s->pollfd);
+    }
+    s->pollfd = -1;
+  }
+  iemnet__sender_clearstate(&s->state);
+  LOCK(&s->mtx);
+  s->isrunning = 0;
+  s->detached = 1;
+  pthread_cond_signal(&s->cond);
+  UNLOCK(&s->mtx);
+  /* 's' might be gone now */
+}
+
+#define IEMNET_SENDWORKER_EVENTS 64
+static void*iemnet__sendworker_thread(void*arg)
+{
+  t_iemnet_sendworker*w = (t_iemnet_sendworker*)arg;
+  struct epoll_event events[IEMNET_SENDWORKER_EVENTS];
+  while(1) {
+    t_iemnet_sender*s;
+    int i, n = epoll_wait(w->epollfd, events, IEMNET_SENDWORKER_EVENTS, -1);
+    if(n < 0) {
+      if(EINTR == errno) {
+        continue;
+      }
+      break;
+    }
+    for(i = 0; i < n; i++) {
+      s = (t_iemnet_sender*)events[i].data.ptr;
+      if(!s) {
+        uint64_t count;
+        while(read(w->wakefd, &count, sizeof(count)) < 0 && EINTR == errno);
+        continue;
+      }
+      /* the socket is writable again */
+      s->blocked = 0;
+      iemnet__sendworker_flush(w, s);
+    }
+
+    /* senders are only ever detached here (after all events are handled),
+     * so no event refers to a detached sender */
+    pthread_mutex_lock(&w->mtx);
+    s = w->ready;
+    w->ready = NULL;
+    pthread_mutex_unlock(&w->mtx);
+    while(s) {
+      t_iemnet_sender*next;
+      pthread_mutex_lock(&w->mtx);
+      next = s->next;
+      s->scheduled = 0;
+      pthread_mutex_unlock(&w->mtx);
+      if(!iemnet__sender_keepsending(s)) {
+        iemnet__sendworker_detach(w, s);
+      } else if(!s->blocked) {
+        iemnet__sendworker_flush(w, s);
+      }
+      s = next;
+    }
+  }
+  return NULL;
+}
+
+static int iemnet__sendworker_init(t_iemnet_sendworker*w)
+{
+  struct epoll_event ev;
+  w->ready = NULL;
+  w->epollfd = epoll_create1(EPOLL_CLOEXEC);
+  w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(w->epollfd < 0 || w->wakefd < 0) {
+    goto fail;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if(epoll_ctl(w->epollfd, EPOLL_CTL_ADD, w->wakefd, &ev)) {
+    goto fail;
+  }
+  pthread_mutex_init(&w->mtx, NULL);
+  if(pthread_create(&w->thread, 0, iemnet__sendworker_thread, w)) {
+    pthread_mutex_destroy(&w->mtx);
+    goto fail;
+  }
+  return 1;
+fail:
+  if(w->epollfd >= 0) {
+    close(w->epollfd);
+  }
+  if(w->wakefd >= 0) {
+    close(w->wakefd);
+  }
+  return 0;
+}
+
+/* get a shared worker for a new sender
+ * (or NULL if the sender should run a thread of its own) */
+static t_iemnet_sendworker*iemnet__sendworker_get(void)
+{
+  t_iemnet_sendworker*w = NULL;
+  pthread_mutex_lock(&sendworkers_mtx);
+  if(sendworkers_wanted >= 0 && !sendworkers) {
+    /* the workers are started on demand, and live as long as the library */
+    unsigned int count = sendworkers_wanted ? (unsigned int)sendworkers_wanted
+                         : iemnet__sendworker_numcores();
+    t_iemnet_sendworker*workers = (t_iemnet_sendworker*)calloc(count,
+                                  sizeof(*workers));
+    unsigned int i;
+    for(i = 0; workers && i < count; i++) {
+      if(!iemnet__sendworker_init(workers + i)) {
+        break;
+      }
+    }
+    if(i) {
+      sendworkers = workers;
+      sendworkers_count = i;
+    } else {
+      free(workers);
+    }
+  }
+  if(sendworkers_wanted >= 0 && sendworkers_count) {
+    w = sendworkers + (sendworkers_next++ % sendworkers_count);
+  }
+  pthread_mutex_unlock(&sendworkers_mtx);
+  return w;
+}
+#endif /* IEMNET_HAVE_EPOLL */
+
+int iemnet__sender_setthreads(int numthreads)
+{
+  int result = -1;
+#ifdef IEMNET_HAVE_EPOLL
+  pthread_mutex_lock(&sendworkers_mtx);
+  sendworkers_wanted = (numthreads < 0) ? -1 : numthreads;
+  pthread_mutex_unlock(&sendworkers_mtx);
+  result = iemnet__sender_getthreads();
+#else
+  (void)numthreads; /* ignore unused variable */
+#endif
+  return result;
+}
+
+int iemnet__sender_getthreads(void)
+{
+  int result = -1;
+#ifdef IEMNET_HAVE_EPOLL
+  pthread_mutex_lock(&sendworkers_mtx);
+  if(sendworkers_wanted >= 0) {
+    if(sendworkers_count) {
+      result = (int)sendworkers_count;
+    } else {
+      result = sendworkers_wanted ? sendworkers_wanted
+               : (int)iemnet__sendworker_numcores();
+    }
+  }
+  pthread_mutex_unlock(&sendworkers_mtx);
+#endif
+  return result;
+}
+
+int iemnet__sender_send_owned(t_iemnet_sender*s, t_iemnet_chunk*c)
 {
   t_iemnet_queue*q = 0;
   int size = -1;
@@ -171,16 +797,30 @@ int iemnet__sender_send(t_iemnet_sender*s, t_iemnet_chunk*c)
   q = s->queue;
   if(!s->isrunning) {
     UNLOCK(&s->mtx);
+    iemnet__chunk_destroy(c);
     return -1;
   }
   UNLOCK(&s->mtx);
   if(q) {
-    t_iemnet_chunk*chunk = iemnet__chunk_create_chunk(c);
-    size = queue_push(q, chunk);
+    size = queue_push(q, c);
+#ifdef IEMNET_HAVE_EPOLL
+    if(s->worker) {
+      iemnet__sendworker_schedule(s);
+    }
+#endif
+  } else {
+    iemnet__chunk_destroy(c);
   }
   return size;
 }
 
+int iemnet__sender_send(t_iemnet_sender*s, t_iemnet_chunk*c)
+{
+  /* the payload is shared, so broadcasting the same chunk to
+   * many senders does not copy the data */
+  return iemnet__sender_send_owned(s, iemnet__chunk_share(c));
+}
+
 void iemnet__sender_destroy(t_iemnet_sender*s, int subthread)
 {
   /* simple protection against recursive calls:
@@ -197,22 +837,40 @@ void iemnet__sender_destroy(t_iemnet_sender*s, int subthread)
   }
   s->keepsending = 0;
 
-  while(s->isrunning) {
-    s->keepsending = 0;
-    queue_finish(s->queue);
+#ifdef IEMNET_HAVE_EPOLL
+  if(s->worker) {
     UNLOCK(&s->mtx);
+    queue_finish(s->queue);
+    /* the worker drops the sender as soon as it sees that it is not
+     * supposed to keep sending */
+    iemnet__sendworker_schedule(s);
     LOCK(&s->mtx);
-  }
+    while(!s->detached) {
+      pthread_cond_wait(&s->cond, &s->mtx);
+    }
+    UNLOCK(&s->mtx);
+    DEBUG("sender detached");
+  } else
+#endif
+  {
+    while(s->isrunning) {
+      s->keepsending = 0;
+      queue_finish(s->queue);
+      UNLOCK(&s->mtx);
+      LOCK(&s->mtx);
+    }
 
-  UNLOCK(&s->mtx);
+    UNLOCK(&s->mtx);
 
-  queue_finish(s->queue);
-  DEBUG("queue finished");
+    queue_finish(s->queue);
+    DEBUG("queue finished");
 
-  pthread_join(s->thread, NULL);
-  DEBUG("thread joined");
+    pthread_join(s->thread, NULL);
+    DEBUG("thread joined");
+  }
   queue_destroy(s->queue);
 
+  pthread_cond_destroy(&s->cond);
   pthread_mutex_destroy (&s->mtx);
 
   memset(s, 0, sizeof(t_iemnet_sender));
@@ -228,6 +886,7 @@ t_iemnet_sender*iemnet__sender_create(int sock,
                                       int subthread)
 {
   static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+  static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
   t_iemnet_sender*result = (t_iemnet_sender*)calloc(1,
                            sizeof(t_iemnet_sender));
   int res = 0;
@@ -243,9 +902,29 @@ t_iemnet_sender*iemnet__sender_create(int sock,
   result->isrunning = 1;
   result->sendfun = sendfun;
   result->userdata = userdata;
+  result->batchchunks = IEMNET_SENDBATCH_CHUNKS;
+  result->batchbytes = IEMNET_SENDBATCH_BYTES;
+  result->pollfd = -1;
+  if(NULL == sendfun) {
+    result->sendbatch = iemnet__sender_getbatchfunction(sock);
+  }
   DEBUG("create_sender queue = %x", result->queue);
 
   memcpy(&result->mtx, &mtx, sizeof(pthread_mutex_t));
+  memcpy(&result->cond, &cond, sizeof(pthread_cond_t));
+
+#ifdef IEMNET_HAVE_EPOLL
+  /* senders with a custom send function (or on sockets that don't support
+   * batched sending) keep their own thread */
+  if(result->sendbatch) {
+    result->worker = iemnet__sendworker_get();
+  }
+  if(result->worker) {
+    DEBUG("created sender on shared worker %p", result->worker);
+    return result;
+  }
+#endif
+
   res = pthread_create(&result->thread, 0, iemnet__sender_sendthread,
                        result);
 
@@ -305,6 +984,38 @@ int iemnet__sender_getsize(t_iemnet_sender*x)
   return size;
 }
 
+void iemnet__sender_setlimit(t_iemnet_sender*x, unsigned long maxbytes,
+                             t_iemnet_overflow policy)
+{
+  if(x && x->queue) {
+    queue_setlimit(x->queue, maxbytes, policy);
+  }
+}
+
+void iemnet__sender_setbatch(t_iemnet_sender*x,
+                             size_t maxbytes, unsigned int maxchunks)
+{
+  if(!x) {
+    return;
+  }
+  if(!maxchunks) {
+    maxchunks = IEMNET_SENDBATCH_CHUNKS;
+  }
+  if(maxchunks > IEMNET_SENDBATCH) {
+    maxchunks = IEMNET_SENDBATCH;
+  }
+  LOCK(&x->mtx);
+  x->batchchunks = maxchunks;
+  x->batchbytes = maxbytes;
+  UNLOCK(&x->mtx);
+}
+
+void iemnet__sender_getdropped(t_iemnet_sender*x,
+                               unsigned long*chunks, unsigned long*bytes)
+{
+  queue_getdropped(x?x->queue:NULL, chunks, bytes);
+}
+
 
 
 static int sock_set_nonblocking(int socket, int nonblocking)
@@ -378,10 +1089,23 @@ int iemnet__connect(int sockfd, const struct sockaddr *addr,
       return -1;
     }
 
-    if (FD_ISSET(sockfd, &errfds)) { // connection failed
-      int err;
+    /* a failed connection might also just report the socket as writable */
+    {
+      int err = 0;
       socklen_t len = sizeof(err);
-      getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (void *)&err, &len);
+      if(getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (void *)&err, &len) < 0) {
+        return -1;
+      }
+      if(!err && !FD_ISSET(sockfd, &errfds)) {
+        goto connected;
+      }
+      if(!err) {
+#ifdef _WIN32
+        err = WSAECONNREFUSED;
+#else
+        err = ECONNREFUSED;
+#endif
+      }
 #ifdef _WIN32
       WSASetLastError(err);
 #else
@@ -390,7 +1114,226 @@ int iemnet__connect(int sockfd, const struct sockaddr *addr,
       return -1;
     }
   }
+connected:
   // done, set blocking again
   sock_set_nonblocking(sockfd, 0);
   return 0;
 }
+
+
+/* listening sockets */
+int iemnet__listen(int sockfd, int backlog, int deferaccept)
+{
+  if(backlog <= 0) {
+    backlog = IEMNET_LISTEN_BACKLOG;
+  }
+#ifdef TCP_DEFER_ACCEPT
+  /* don't report connections until the first data has arrived */
+  if (setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                 (char *)&deferaccept, sizeof(deferaccept)) < 0) {
+    if(deferaccept > 0) {
+      sys_sockerror("setsockopt:TCP_DEFER_ACCEPT");
+    }
+  }
+#else
+  (void)deferaccept; /* ignore unused variable */
+#endif
+  /* so we can drain the accept queue without blocking */
+  if(sock_set_nonblocking(sockfd, 1) < 0) {
+    return -1;
+  }
+  return listen(sockfd, backlog);
+}
+
+static int accept_again(void)
+{
+#ifdef _WIN32
+  return (WSAGetLastError() == WSAECONNRESET);
+#else
+  return (EINTR == errno || ECONNABORTED == errno);
+#endif
+}
+static int accept_empty(void)
+{
+#ifdef _WIN32
+  return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+  return (EAGAIN == errno || EWOULDBLOCK == errno);
+#endif
+}
+
+int iemnet__accept(int sockfd, struct sockaddr_in*addr)
+{
+  int fd = -1;
+  do {
+    socklen_t addrlen = sizeof(*addr);
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+    /* (on Linux, accepted sockets never inherit O_NONBLOCK) */
+    fd = accept4(sockfd, (struct sockaddr*)addr, &addrlen, SOCK_CLOEXEC);
+#else
+    fd = accept(sockfd, (struct sockaddr*)addr, &addrlen);
+    if(fd >= 0) {
+      /* some systems inherit O_NONBLOCK from the listening socket */
+      sock_set_nonblocking(fd, 0);
+    }
+#endif
+  } while(fd < 0 && accept_again());
+
+  if(fd < 0) {
+    return accept_empty() ? -1 : -2;
+  }
+  return fd;
+}
+
+
+/* asynchronous connect */
+struct _iemnet_connector {
+  char*host;
+  unsigned short port;
+  float timeout;
+
+  void*userdata;
+  t_iemnet_connectcallback callback;
+
+  /* the result (only touched by the connect thread, until it is reported) */
+  int sockfd; /* the connected socket (not yet handed to the owner) */
+  long addr; /* the resolved address (host byte order) */
+  int error; /* errno of a failed connect(), or -1 if resolving failed */
+
+  /* only touched by the main thread */
+  int done; /* the result has been reported */
+  int cancelled; /* the owner is no longer interested in the result */
+
+  t_iemnet_mainjob job; /* reports the result */
+};
+
+static void connector_free(t_iemnet_connector*c)
+{
+  free(c->host);
+  free(c);
+}
+
+static void connector_report(void*z);
+
+static void*connector_thread(void*arg)
+{
+  t_iemnet_connector*c = (t_iemnet_connector*)arg;
+  int sockfd = -1;
+  int error = 0;
+  uint32_t addr = 0;
+
+  /* (uses the shared hostname cache) */
+  if(!iemnet__resolve(c->host, &addr)) {
+    error = -1;
+  } else {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = htonl(addr);
+    server.sin_port = htons(c->port);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(sockfd < 0
+        || iemnet__connect(sockfd, (struct sockaddr *)&server, sizeof(server),
+                           c->timeout) < 0) {
+#ifdef _WIN32
+      error = WSAGetLastError();
+#else
+      error = errno;
+#endif
+      if(!error) {
+        error = EINVAL;
+      }
+      iemnet__closesocket(sockfd, 0);
+      sockfd = -1;
+    }
+  }
+  c->sockfd = sockfd;
+  c->addr = addr;
+  c->error = error;
+  /* from now on, the connector belongs to the main thread again */
+  iemnet__mainjob_post(&c->job, connector_report, c);
+  return 0;
+}
+
+/* the connect thread has finished: report back (in the main thread) */
+static void connector_report(void*z)
+{
+  t_iemnet_connector*c = (t_iemnet_connector*)z;
+  int sockfd = c->sockfd;
+  c->sockfd = -1;
+  c->done = 1;
+  if(c->cancelled) {
+    iemnet__closesocket(sockfd, 0);
+    connector_free(c);
+    return;
+  }
+  if(sockfd < 0) {
+    if(c->error < 0) {
+      iemnet_log(c->userdata, IEMNET_ERROR, "bad host '%s'?", c->host);
+    } else {
+      iemnet_log(c->userdata, IEMNET_ERROR,
+                 "unable to connect to %s:%d", c->host, c->port);
+#ifdef _WIN32
+      WSASetLastError(c->error);
+#else
+      errno = c->error;
+#endif
+      sys_sockerror("connect");
+    }
+  }
+  /* (the callback might destroy the connector) */
+  (c->callback)(c->userdata, sockfd, c->addr);
+}
+
+t_iemnet_connector*iemnet__connector_create(const char*host,
+    unsigned short port, float timeout,
+    void*userdata, t_iemnet_connectcallback callback)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int res;
+  t_iemnet_connector*c = (t_iemnet_connector*)calloc(1, sizeof(*c));
+  if(!c) {
+    return NULL;
+  }
+  c->host = strdup(host);
+  if(!c->host) {
+    free(c);
+    return NULL;
+  }
+  c->port = port;
+  c->timeout = timeout;
+  c->userdata = userdata;
+  c->callback = callback;
+  c->sockfd = -1;
+  if(!iemnet__mainjob_start()) {
+    connector_free(c);
+    return NULL;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  res = pthread_create(&thread, &attr, connector_thread, c);
+  pthread_attr_destroy(&attr);
+  if(res) {
+    connector_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+void iemnet__connector_destroy(t_iemnet_connector*c)
+{
+  if(!c) {
+    return;
+  }
+  /* (the result is reported in the main thread, so this cannot race) */
+  if(c->done) {
+    iemnet__closesocket(c->sockfd, 1);
+    connector_free(c);
+  } else {
+    /* clean up once the result comes in */
+    c->cancelled = 1;
+  }
+}
@@ -42,6 +42,8 @@ typedef struct _tcpclient {
 
   t_iemnet_sender*x_sender;
   t_iemnet_receiver*x_receiver;
+  t_iemnet_connector*x_connector; /* pending connection attempt */
+  t_iemnet_queue*x_pending; /* data sent while connecting */
 
   int x_serialize;
 
@@ -53,6 +55,14 @@ typedef struct _tcpclient {
 
   t_float x_timeout;
 
+  unsigned long x_sendlimit; /* max. bytes in the send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
+  int x_paused; /* don't read from the socket */
+
   t_iemnet_floatlist*x_floatlist;
 } t_tcpclient;
 
@@ -64,6 +74,8 @@ static void tcpclient_info(t_tcpclient *x)
   /*
   "server <socket> <IP> <port>"
   "bufsize <insize> <outsize>"
+  "dropped <chunks> <bytes>"
+  "recvbuf <pending> <buffered> <highwater>"
   */
   static t_atom output_atom[3];
   int connected = x->x_connectstate;
@@ -79,6 +91,8 @@ static void tcpclient_info(t_tcpclient *x)
 
     int insize = iemnet__receiver_getsize(x->x_receiver);
     int outsize = iemnet__sender_getsize(x->x_sender);
+    unsigned long dropchunks = 0, dropbytes = 0;
+    unsigned long pending = 0, buffered = 0, highwater = 0;
 
     SETFLOAT(output_atom+0, sockfd);
     SETSYMBOL(output_atom+1, gensym(hostname));
@@ -89,6 +103,17 @@ static void tcpclient_info(t_tcpclient *x)
     SETFLOAT(output_atom+0, insize);
     SETFLOAT(output_atom+1, outsize);
     outlet_anything(x->x_statusout, gensym("bufsize"), 2, output_atom);
+
+    iemnet__sender_getdropped(x->x_sender, &dropchunks, &dropbytes);
+    SETFLOAT(output_atom+0, dropchunks);
+    SETFLOAT(output_atom+1, dropbytes);
+    outlet_anything(x->x_statusout, gensym("dropped"), 2, output_atom);
+
+    iemnet__receiver_getstats(x->x_receiver, &pending, &buffered, &highwater);
+    SETFLOAT(output_atom+0, pending);
+    SETFLOAT(output_atom+1, buffered);
+    SETFLOAT(output_atom+2, highwater);
+    outlet_anything(x->x_statusout, gensym("recvbuf"), 3, output_atom);
   }
 }
 
@@ -110,57 +135,47 @@ static int tcpclient_do_disconnect(int fd, t_iemnet_sender*sender,
   }
   return 0;
 }
-static int tcpclient_do_connect(const char*host, unsigned short port,
-                                t_tcpclient*x,
-                                t_iemnet_sender**senderOUT, t_iemnet_receiver**receiverOUT, long*addrOUT)
+/* the connection attempt has finished */
+static void tcpclient_connected(void*y, int sockfd, long addr)
 {
-  struct sockaddr_in server;
-  struct hostent*hp;
-  int sockfd = -1;
-  t_iemnet_sender*sender;
-  t_iemnet_receiver*receiver;
-
-  /* connect socket using hostname provided in command line */
-  memset(&server, 0, sizeof(server));
-  server.sin_family = AF_INET;
-  hp = gethostbyname(host);
-  if (hp == 0) {
-    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", host);
-    return (-1);
-  }
-  memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
+  t_tcpclient*x = (t_tcpclient*)y;
+  t_iemnet_chunk*chunk;
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd < 0) {
-    iemnet_log(x, IEMNET_ERROR, "unable to open socket");
-    sys_sockerror("socket");
-    return (sockfd);
-  }
-
-  /* assign client port number */
-  server.sin_port = htons((u_short)port);
+  iemnet__connector_destroy(x->x_connector);
+  x->x_connector = NULL;
 
-  /* try to connect */
-  if (iemnet__connect(sockfd, (struct sockaddr *) &server, sizeof (server), x->x_timeout) < 0) {
-    iemnet_log(x, IEMNET_ERROR, "unable to connect to stream socket");
-    sys_sockerror("connect");
-    iemnet__closesocket(sockfd, 1);
-    return (-1);
+  if(sockfd < 0) {
+    if(x->x_pending) {
+      queue_destroy(x->x_pending);
+    }
+    x->x_pending = NULL;
+    x->x_hostname = NULL;
+    x->x_port = 0;
+    tcpclient_info(x);
+    return;
   }
 
-  sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
-  receiver = iemnet__receiver_create(sockfd, x, tcpclient_receive_callback,
-                                     0);
-  if(addrOUT) {
-    *addrOUT = ntohl(*(long *)hp->h_addr);
-  }
-  if(senderOUT) {
-    *senderOUT = sender;
-  }
-  if(receiverOUT) {
-    *receiverOUT = receiver;
+  x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
+  iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+  x->x_receiver = iemnet__receiver_create(sockfd, x,
+                                          tcpclient_receive_callback, 0);
+  iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+  iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
+  iemnet__receiver_pause(x->x_receiver, x->x_paused);
+  x->x_addr = addr;
+  x->x_fd = sockfd;
+  x->x_connectstate = 1;
+
+  /* flush whatever has been sent while we were connecting */
+  if(x->x_pending) {
+    while((chunk = queue_pop_noblock(x->x_pending))) {
+      iemnet__sender_send_owned(x->x_sender, chunk);
+    }
+    queue_destroy(x->x_pending);
   }
-  return sockfd;
+  x->x_pending = NULL;
+
+  tcpclient_info(x);
 }
 
 static void tcpclient_tick(t_tcpclient *x)
@@ -176,28 +191,41 @@ static void tcpclient_connect(t_tcpclient *x, t_symbol *hostname,
 {
   int state;
 
-  /* first disconnect any active connection */
+  /* first disconnect any active connection (or abandon a pending one) */
   if(x->x_hostname || x->x_port) {
     state = tcpclient_do_disconnect(x->x_fd, x->x_sender, x->x_receiver);
     x->x_connectstate = 0;
+    x->x_fd = -1;
     x->x_sender = NULL;
     x->x_receiver = NULL;
     if(state) {
       iemnet__numconnout(x->x_statusout, x->x_connectout, 0);
     }
   }
+  iemnet__connector_destroy(x->x_connector);
+  x->x_connector = NULL;
+  if(x->x_pending) {
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
 
   /* we get hostname and port and pass them on
-     to the child thread that establishes the connection */
+     to the child thread that establishes the connection;
+     the result is reported via tcpclient_connected() */
   x->x_hostname = hostname->s_name;
   x->x_port = fportno;
 
-  state = tcpclient_do_connect(x->x_hostname, x->x_port, x,
-                               &x->x_sender, &x->x_receiver,
-                               &x->x_addr);
-  x->x_connectstate = (state>0);
-  x->x_fd = state;
-  tcpclient_info(x);
+  x->x_pending = queue_create();
+  if(x->x_pending) {
+    queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+  }
+  x->x_connector = iemnet__connector_create(x->x_hostname, x->x_port,
+                   x->x_timeout, x, tcpclient_connected);
+  if(!x->x_connector) {
+    iemnet_log(x, IEMNET_ERROR, "unable to start connecting to '%s'",
+               x->x_hostname);
+    tcpclient_connected(x, -1, 0);
+  }
 }
 
 static void tcpclient_disconnect(t_tcpclient *x)
@@ -209,8 +237,16 @@ static void tcpclient_disconnect(t_tcpclient *x)
       iemnet_log(x, IEMNET_ERROR, "not connected");
     }
   }
+  iemnet__connector_destroy(x->x_connector);
+  x->x_connector = NULL;
+  if(x->x_pending) {
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
   x->x_port = 0;
   x->x_hostname = NULL;
+  x->x_fd = -1;
+  x->x_connectstate = 0;
   x->x_sender = NULL;
   x->x_receiver = NULL;
 
@@ -229,9 +265,13 @@ static void tcpclient_send(t_tcpclient *x, t_symbol *s, int argc,
   (void)s; /* ignore unused variable */
 
   if(sender && chunk) {
-    size = iemnet__sender_send(sender, chunk);
+    size = iemnet__sender_send_owned(sender, chunk);
+  } else if(x->x_pending && chunk) {
+    /* still connecting: keep the data until we are connected */
+    size = queue_push(x->x_pending, chunk);
+  } else {
+    iemnet__chunk_destroy(chunk);
   }
-  iemnet__chunk_destroy(chunk);
 
   SETFLOAT(&output_atom, size);
   outlet_anything( x->x_statusout, gensym("sendbuffersize"), 1,
@@ -241,16 +281,87 @@ static void tcpclient_send(t_tcpclient *x, t_symbol *s, int argc,
   }
 }
 
+static void tcpclient_sendlimit(t_tcpclient *x, t_symbol *s, int argc,
+                                t_atom *argv)
+{
+  t_atom ap[2];
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_sendlimit);
+    SETSYMBOL(ap+1, iemnet__overflow2symbol(x->x_overflow));
+    outlet_anything(x->x_statusout, s, 2, ap);
+    break;
+  case 1:
+    iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+    if(x->x_pending) {
+      queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void tcpclient_receivebudget(t_tcpclient *x, t_symbol *s, int argc,
+                                    t_atom *argv)
+{
+  t_atom ap[3];
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, iemnet__receiver_getexhausted(x->x_receiver));
+    outlet_anything(x->x_statusout, s, 3, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+    break;
+  default:
+    break;
+  }
+}
+
+static void tcpclient_recvbufsize(t_tcpclient *x, t_symbol *s, int argc,
+                                  t_atom *argv)
+{
+  t_atom ap[1];
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statusout, s, 1, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
+    break;
+  default:
+    break;
+  }
+}
+
+/* stop (resp. resume) reading from the server */
+static void tcpclient_pause(t_tcpclient *x, t_symbol *s, int argc,
+                            t_atom *argv)
+{
+  (void)argc; /* ignore unused variable */
+  (void)argv; /* ignore unused variable */
+  x->x_paused = (gensym("pause") == s);
+  iemnet__receiver_pause(x->x_receiver, x->x_paused);
+}
+
 static void tcpclient_receive_callback(void*y, t_iemnet_chunk*c)
 {
   t_tcpclient *x = (t_tcpclient*)y;
 
   if(c) {
+    t_atom*argv = NULL;
     iemnet__addrout(x->x_statusout, x->x_addrout, x->x_addr, x->x_port);
     /* get's destroyed in the dtor */
-    x->x_floatlist = iemnet__chunk2list(c, x->x_floatlist);
-    iemnet__streamout(x->x_msgout, x->x_floatlist->argc, x->x_floatlist->argv,
-                      x->x_serialize);
+    argv = iemnet__chunk2atoms(c, &x->x_floatlist);
+    if(argv) {
+      iemnet__streamout(x->x_msgout, c->size, argv, x->x_serialize);
+    }
   } else {
     /* disconnected */
     tcpclient_disconnect(x);
@@ -306,6 +417,13 @@ static void *tcpclient_new(void)
   x->x_serialize = 1;
   x->x_timeout = -1;
 
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
+  x->x_paused = 0;
+
   x->x_fd = -1;
 
   x->x_addr = 0L;
@@ -313,6 +431,8 @@ static void *tcpclient_new(void)
 
   x->x_sender = NULL;
   x->x_receiver = NULL;
+  x->x_connector = NULL;
+  x->x_pending = NULL;
 
   x->x_clock = clock_new(x, (t_method)tcpclient_tick);
   x->x_floatlist = iemnet__floatlist_create(1024);
@@ -345,6 +465,16 @@ IEMNET_EXTERN void tcpclient_setup(void)
 
   class_addmethod(tcpclient_class, (t_method)tcpclient_timeout,
                   gensym("timeout"), A_FLOAT, 0);
+  class_addmethod(tcpclient_class, (t_method)tcpclient_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
+  class_addmethod(tcpclient_class, (t_method)tcpclient_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(tcpclient_class, (t_method)tcpclient_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
+  class_addmethod(tcpclient_class, (t_method)tcpclient_pause,
+                  gensym("pause"), A_GIMME, 0);
+  class_addmethod(tcpclient_class, (t_method)tcpclient_pause,
+                  gensym("resume"), A_GIMME, 0);
 
   class_addmethod(tcpclient_class, (t_method)tcpclient_send, gensym("send"),
                   A_GIMME, 0);
@@ -352,6 +482,10 @@ IEMNET_EXTERN void tcpclient_setup(void)
 
   class_addbang(tcpclient_class, (t_method)tcpclient_info);
   DEBUGMETHOD(tcpclient_class);
+  POOLSTATSMETHOD(tcpclient_class);
+  SENDTHREADSMETHOD(tcpclient_class);
+  RECEIVETHREADMETHOD(tcpclient_class);
+  RESOLVERCACHEMETHOD(tcpclient_class);
 }
 
 
@@ -27,6 +27,7 @@
 static const char*objName = "tcpreceive";
 
 #include "iemnet.h"
+#include "iemnet_data.h"
 #ifndef _WIN32
 /* needed for TCP_NODELAY */
 # include <netinet/tcp.h>
@@ -38,12 +39,11 @@ static const char*objName = "tcpreceive";
 
 static t_class *tcpreceive_class;
 
-#define MAX_CONNECTIONS 128 /* this is going to cause trouble down the line...:( */
-
 typedef struct _tcpconnection {
   long addr;
   unsigned short port;
   int socket;
+  unsigned int handle; /* our entry in the owner's x_connections */
   struct _tcpreceive*owner;
   t_iemnet_receiver*receiver;
 } t_tcpconnection;
@@ -56,50 +56,51 @@ typedef struct _tcpreceive {
   t_outlet*x_statusout;
   int x_connectsocket;
   int x_port;
+  int x_backlog; /* max. pending connections (0: default) */
+  int x_deferaccept; /* seconds to wait for data before accepting (0: off) */
 
   int x_serialize;
 
-  int x_nconnections;
-  t_tcpconnection x_connection[MAX_CONNECTIONS];
+  /* the open connections (t_tcpconnection), keyed by socket */
+  t_iemnet_slotmap*x_connections;
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
+  int x_paused; /* don't read from the sockets */
 
   t_iemnet_floatlist*x_floatlist;
 } t_tcpreceive;
 
 /* forward declarations */
-static int tcpreceive_disconnect(t_tcpreceive *x, int id);
+static int tcpreceive_disconnect(t_tcpreceive *x, t_tcpconnection*y);
 
-static int tcpreceive_find_socket(t_tcpreceive *x, int fd)
+static t_tcpconnection*tcpreceive_find_socket(t_tcpreceive *x, int fd)
 {
-  int i;
-  for (i = 0; i < MAX_CONNECTIONS; ++i)
-    if (x->x_connection[i].socket == fd) {
-      return i;
-    }
-
-  return -1;
+  return (t_tcpconnection*)iemnet__slotmap_get(x->x_connections,
+         iemnet__slotmap_find(x->x_connections, fd));
 }
 
 static void tcpreceive_read_callback(void *w, t_iemnet_chunk*c)
 {
   t_tcpconnection*y = (t_tcpconnection*)w;
   t_tcpreceive*x = NULL;
-  int index = -1;
   if(NULL == y || NULL == (x = y->owner)) {
     return;
   }
 
-  index = tcpreceive_find_socket(x, y->socket);
-  if(index >= 0) {
+  if(y == iemnet__slotmap_get(x->x_connections, y->handle)) {
     if(c) {
       /* TODO?: outlet info about connection */
 
       /* gets destroyed in the dtor */
-      x->x_floatlist = iemnet__chunk2list(c, x->x_floatlist);
-      iemnet__streamout(x->x_msgout, x->x_floatlist->argc, x->x_floatlist->argv,
-                        x->x_serialize);
+      t_atom*argv = iemnet__chunk2atoms(c, &x->x_floatlist);
+      if(argv) {
+        iemnet__streamout(x->x_msgout, c->size, argv, x->x_serialize);
+      }
     } else {
       /* disconnected */
-      tcpreceive_disconnect(x, index);
+      tcpreceive_disconnect(x, y);
     }
   }
 }
@@ -109,22 +110,24 @@ static void tcpreceive_read_callback(void *w, t_iemnet_chunk*c)
 static int tcpreceive_addconnection(t_tcpreceive *x, int fd, long addr,
                                     unsigned short port)
 {
-  int i;
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (x->x_connection[i].socket == -1) {
-      x->x_connection[i].socket = fd;
-      x->x_connection[i].addr = addr;
-      x->x_connection[i].port = port;
-      x->x_connection[i].owner = x;
-      x->x_connection[i].receiver =
-        iemnet__receiver_create(fd,
-                                x->x_connection+i,
-                                tcpreceive_read_callback,
-                                0);
-      return 1;
-    }
+  t_tcpconnection*y = (t_tcpconnection*)getbytes(sizeof(*y));
+  if(!y) {
+    return 0;
   }
-  return 0;
+  y->handle = iemnet__slotmap_add(x->x_connections, fd, y);
+  if(!y->handle) {
+    freebytes(y, sizeof(*y));
+    return 0;
+  }
+  y->socket = fd;
+  y->addr = addr;
+  y->port = port;
+  y->owner = x;
+  y->receiver = iemnet__receiver_create(fd, y, tcpreceive_read_callback, 0);
+  iemnet__receiver_setbudget(y->receiver, x->x_recvpackets, x->x_recvbytes);
+  iemnet__receiver_setbufsize(y->receiver, x->x_recvbufsize);
+  iemnet__receiver_pause(y->receiver, x->x_paused);
+  return 1;
 }
 
 
@@ -132,47 +135,50 @@ static int tcpreceive_addconnection(t_tcpreceive *x, int fd, long addr,
 /* a new socket is assigned  */
 static void tcpreceive_connectpoll(t_tcpreceive *x, int fd)
 {
-  struct sockaddr_in from;
-  socklen_t fromlen = sizeof(from);
-  long addr;
-  unsigned short port;
+  unsigned int count;
   if(fd != x->x_connectsocket) {
     iemnet_log(x, IEMNET_FATAL, "callback received for socket:%d on listener for socket:%d", fd, x->x_connectsocket);
     return;
   }
 
-  fd = accept(fd, (struct sockaddr *)&from, &fromlen);
-  if (fd < 0) {
-    iemnet_log(x, IEMNET_ERROR, "could not accept new connection");
-    sys_sockerror("accept");
-  } else {
+  /* accept all pending connections (but not too many at once) */
+  for(count = 0; count < IEMNET_ACCEPT_BUDGET; count++) {
+    struct sockaddr_in from;
+    long addr;
+    unsigned short port;
+    int sockfd = iemnet__accept(fd, &from);
+    if (sockfd < 0) {
+      if(sockfd < -1) {
+        iemnet_log(x, IEMNET_ERROR, "could not accept new connection");
+        sys_sockerror("accept");
+      }
+      break;
+    }
     /* get the sender's ip */
     addr = ntohl(from.sin_addr.s_addr);
     port = ntohs(from.sin_port);
-    if (tcpreceive_addconnection(x, fd, addr, port)) {
-      x->x_nconnections++;
-      iemnet__numconnout(x->x_statusout, x->x_connectout, x->x_nconnections);
+    if (tcpreceive_addconnection(x, sockfd, addr, port)) {
+      iemnet__numconnout(x->x_statusout, x->x_connectout,
+                         iemnet__slotmap_size(x->x_connections));
       iemnet__addrout(x->x_statusout, x->x_addrout, addr, port);
     } else {
       iemnet_log(x, IEMNET_ERROR, "too many connections");
-      iemnet__closesocket(fd, 1);
+      iemnet__closesocket(sockfd, 1);
     }
   }
 }
 
-static int tcpreceive_disconnect(t_tcpreceive *x, int id)
+static int tcpreceive_disconnect(t_tcpreceive *x, t_tcpconnection*y)
 {
-  if(id >= 0 && id < MAX_CONNECTIONS && x->x_connection[id].port>0) {
-    iemnet__receiver_destroy(x->x_connection[id].receiver, 0);
-    x->x_connection[id].receiver = NULL;
+  if(y && y == iemnet__slotmap_remove(x->x_connections, y->handle)) {
+    iemnet__receiver_destroy(y->receiver, 0);
+    y->receiver = NULL;
 
-    iemnet__closesocket(x->x_connection[id].socket, 1);
-    x->x_connection[id].socket = -1;
+    iemnet__closesocket(y->socket, 1);
+    freebytes(y, sizeof(*y));
 
-    x->x_connection[id].addr = 0L;
-    x->x_connection[id].port = 0;
-    x->x_nconnections--;
-    iemnet__numconnout(x->x_statusout, x->x_connectout, x->x_nconnections);
+    iemnet__numconnout(x->x_statusout, x->x_connectout,
+                       iemnet__slotmap_size(x->x_connections));
     return 1;
   }
 
@@ -183,10 +189,11 @@ static int tcpreceive_disconnect(t_tcpreceive *x, int id)
 /* tcpreceive_closeall closes all open sockets and deletes them from the list */
 static void tcpreceive_disconnect_all(t_tcpreceive *x)
 {
-  int i;
+  unsigned int i;
 
-  for (i = 0; i < MAX_CONNECTIONS; i++) {
-    tcpreceive_disconnect(x, i);
+  for (i = 0; i < iemnet__slotmap_capacity(x->x_connections); i++) {
+    tcpreceive_disconnect(x,
+                          (t_tcpconnection*)iemnet__slotmap_at(x->x_connections, i));
   }
 }
 
@@ -194,13 +201,7 @@ static void tcpreceive_disconnect_all(t_tcpreceive *x)
 /* returns 1 on success, else 0 */
 static int tcpreceive_disconnect_socket(t_tcpreceive *x, int fd)
 {
-  int i;
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (x->x_connection[i].socket == fd) {
-      return tcpreceive_disconnect(x, i);
-    }
-  }
-  return 0;
+  return tcpreceive_disconnect(x, tcpreceive_find_socket(x, fd));
 }
 
 static void tcpreceive_port(t_tcpreceive*x, t_floatarg fportno)
@@ -276,7 +277,7 @@ static void tcpreceive_port(t_tcpreceive*x, t_floatarg fportno)
   }
 
   /* streaming protocol */
-  if (listen(sockfd, 5) < 0) {
+  if (iemnet__listen(sockfd, x->x_backlog, x->x_deferaccept) < 0) {
     iemnet_log(x, IEMNET_ERROR, "unable to listen on socket");
     sys_sockerror("listen");
     iemnet__closesocket(sockfd, 1);
@@ -307,6 +308,33 @@ static void tcpreceive_serialize(t_tcpreceive *x, t_floatarg doit)
   x->x_serialize = doit;
 }
 
+static void tcpreceive_backlog(t_tcpreceive *x, t_floatarg f)
+{
+  if(f < 0) {
+    pd_error(x, "backlog must be >= 0");
+    return;
+  }
+  x->x_backlog = f;
+  if(x->x_connectsocket >= 0
+      && iemnet__listen(x->x_connectsocket, x->x_backlog, x->x_deferaccept) < 0) {
+    iemnet_log(x, IEMNET_ERROR, "unable to change backlog");
+    sys_sockerror("listen");
+  }
+}
+static void tcpreceive_deferaccept(t_tcpreceive *x, t_floatarg f)
+{
+  if(f < 0) {
+    pd_error(x, "deferaccept timeout must be >= 0");
+    return;
+  }
+  x->x_deferaccept = f;
+  if(x->x_connectsocket >= 0
+      && iemnet__listen(x->x_connectsocket, x->x_backlog, x->x_deferaccept) < 0) {
+    iemnet_log(x, IEMNET_ERROR, "unable to change deferaccept");
+    sys_sockerror("listen");
+  }
+}
+
 static void tcpreceive_free(t_tcpreceive *x)
 {
   /* is this ever called? */
@@ -315,17 +343,97 @@ static void tcpreceive_free(t_tcpreceive *x)
     iemnet__closesocket(x->x_connectsocket, 1);
   }
   tcpreceive_disconnect_all(x);
+  iemnet__slotmap_destroy(x->x_connections);
+  x->x_connections = NULL;
   if(x->x_floatlist) {
     iemnet__floatlist_destroy(x->x_floatlist);
   }
   x->x_floatlist = NULL;
 }
 
+static void tcpreceive_receivebudget(t_tcpreceive *x, t_symbol *s, int argc,
+                                     t_atom *argv)
+{
+  t_atom ap[3];
+  unsigned long exhausted = 0;
+  unsigned int i;
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_connections); i++) {
+      t_tcpconnection*y =
+        (t_tcpconnection*)iemnet__slotmap_at(x->x_connections, i);
+      if(y) {
+        exhausted +=
+          iemnet__receiver_getexhausted(y->receiver);
+      }
+    }
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, exhausted);
+    outlet_anything(x->x_statusout, s, 3, ap);
+    break;
+  case 1:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_connections); i++) {
+      t_tcpconnection*y =
+        (t_tcpconnection*)iemnet__slotmap_at(x->x_connections, i);
+      if(y) {
+        iemnet__receiver_setbudget(y->receiver,
+                                   x->x_recvpackets, x->x_recvbytes);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void tcpreceive_recvbufsize(t_tcpreceive *x, t_symbol *s, int argc,
+                                   t_atom *argv)
+{
+  t_atom ap[1];
+  unsigned int i;
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statusout, s, 1, ap);
+    break;
+  case 1:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_connections); i++) {
+      t_tcpconnection*y =
+        (t_tcpconnection*)iemnet__slotmap_at(x->x_connections, i);
+      if(y) {
+        iemnet__receiver_setbufsize(y->receiver,
+                                    x->x_recvbufsize);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* stop (resp. resume) reading from all connections (including new ones) */
+static void tcpreceive_pause(t_tcpreceive *x, t_symbol *s, int argc,
+                             t_atom *argv)
+{
+  unsigned int i;
+  (void)argc; /* ignore unused variable */
+  (void)argv; /* ignore unused variable */
+  x->x_paused = (gensym("pause") == s);
+  for(i = 0; i < iemnet__slotmap_capacity(x->x_connections); i++) {
+    t_tcpconnection*y =
+      (t_tcpconnection*)iemnet__slotmap_at(x->x_connections, i);
+    if(y) {
+      iemnet__receiver_pause(y->receiver, x->x_paused);
+    }
+  }
+}
+
 static void *tcpreceive_new(t_floatarg fportno)
 {
   t_tcpreceive*x;
   int portno = fportno;
-  int i;
 
   x = (t_tcpreceive *)pd_new(tcpreceive_class);
   x->x_msgout = outlet_new(&x->x_obj, 0);
@@ -337,13 +445,16 @@ static void *tcpreceive_new(t_floatarg fportno)
 
   x->x_connectsocket = -1;
   x->x_port = -1;
-  x->x_nconnections = 0;
-
-  /* clear the connection list */
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    x->x_connection[i].socket = -1;
-    x->x_connection[i].addr = 0L;
-    x->x_connection[i].port = 0;
+  x->x_backlog = 0;
+  x->x_deferaccept = 0;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
+  x->x_paused = 0;
+
+  x->x_connections = iemnet__slotmap_create();
+  if(!x->x_connections) {
+    iemnet_log(x, IEMNET_FATAL, "unable to allocate connection table");
   }
 
   x->x_floatlist = iemnet__floatlist_create(1024);
@@ -370,7 +481,22 @@ IEMNET_EXTERN void tcpreceive_setup(void)
 
   class_addmethod(tcpreceive_class, (t_method)tcpreceive_serialize,
                   gensym("serialize"), A_FLOAT, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_backlog,
+                  gensym("backlog"), A_FLOAT, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_deferaccept,
+                  gensym("deferaccept"), A_FLOAT, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_pause,
+                  gensym("pause"), A_GIMME, 0);
+  class_addmethod(tcpreceive_class, (t_method)tcpreceive_pause,
+                  gensym("resume"), A_GIMME, 0);
   DEBUGMETHOD(tcpreceive_class);
+  POOLSTATSMETHOD(tcpreceive_class);
+  SENDTHREADSMETHOD(tcpreceive_class);
+  RECEIVETHREADMETHOD(tcpreceive_class);
 }
 
 IEMNET_INITIALIZER(tcpreceive_setup);
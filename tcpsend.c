@@ -40,10 +40,21 @@ typedef struct _tcpsend {
   int x_fd;
   t_float x_timeout;
   t_iemnet_sender*x_sender;
+  t_iemnet_connector*x_connector; /* pending connection attempt */
+  t_iemnet_queue*x_pending; /* data sent while connecting */
+
+  unsigned long x_sendlimit; /* max. bytes in the send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
 } t_tcpsend;
 
 static void tcpsend_disconnect(t_tcpsend *x)
 {
+  iemnet__connector_destroy(x->x_connector);
+  x->x_connector = NULL;
+  if(x->x_pending) {
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
   if(x->x_sender) {
     iemnet__sender_destroy(x->x_sender, 0);
   }
@@ -55,35 +66,23 @@ static void tcpsend_disconnect(t_tcpsend *x)
   }
 }
 
-static void tcpsend_connect(t_tcpsend *x, t_symbol *hostname,
-                            t_floatarg fportno)
+/* the connection attempt has finished */
+static void tcpsend_connected(void*y, int sockfd, long addr)
 {
-  struct sockaddr_in server;
-  struct hostent*hp;
-  int sockfd;
-  int portno = fportno;
+  t_tcpsend*x = (t_tcpsend*)y;
+  t_iemnet_chunk*chunk;
   int intarg;
-  memset(&server, 0, sizeof(server));
+  (void)addr; /* ignore unused variable */
 
-  if (x->x_fd >= 0) {
-    iemnet_log(x, IEMNET_ERROR, "already connected");
-    return;
-  }
+  iemnet__connector_destroy(x->x_connector);
+  x->x_connector = NULL;
 
-  /* resolve hostname provided as argument */
-  server.sin_family = AF_INET;
-  hp = gethostbyname(hostname->s_name);
-  if (hp == 0) {
-    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", hostname->s_name);
-    return;
-  }
-
-  /* create a socket */
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  DEBUG("send socket %d\n", sockfd);
-  if (sockfd < 0) {
-    iemnet_log(x, IEMNET_ERROR, "unable to open socket");
-    sys_sockerror("socket");
+  if(sockfd < 0) {
+    if(x->x_pending) {
+      queue_destroy(x->x_pending);
+    }
+    x->x_pending = NULL;
+    outlet_float(x->x_obj.ob_outlet, 0);
     return;
   }
 
@@ -95,25 +94,50 @@ static void tcpsend_connect(t_tcpsend *x, t_symbol *hostname,
     sys_sockerror("setsockopt");
   }
 
-  /* connect socket using hostname provided as argument */
-  memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
+  x->x_fd = sockfd;
+  x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
+  iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+
+  /* flush whatever has been sent while we were connecting */
+  if(x->x_pending) {
+    while((chunk = queue_pop_noblock(x->x_pending))) {
+      iemnet__sender_send_owned(x->x_sender, chunk);
+    }
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
 
-  /* assign client port number */
-  server.sin_port = htons((u_short)portno);
+  outlet_float(x->x_obj.ob_outlet, 1);
+}
 
-  iemnet_log(x, IEMNET_VERBOSE, "connecting to port %d", portno);
-  /* try to connect. */
-  if (iemnet__connect(sockfd, (struct sockaddr *) &server, sizeof (server), x->x_timeout) < 0) {
-    iemnet_log(x, IEMNET_ERROR, "unable to initiate connection on socket %d", sockfd);
-    sys_sockerror("connect");
-    iemnet__closesocket(sockfd, 1);
+static void tcpsend_connect(t_tcpsend *x, t_symbol *hostname,
+                            t_floatarg fportno)
+{
+  int portno = fportno;
+
+  if (x->x_fd >= 0) {
+    iemnet_log(x, IEMNET_ERROR, "already connected");
+    return;
+  }
+  if (x->x_connector) {
+    iemnet_log(x, IEMNET_ERROR, "already connecting");
     return;
   }
-  x->x_fd = sockfd;
-
-  x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
 
-  outlet_float(x->x_obj.ob_outlet, 1);
+  /* resolving and connecting is done in a helper thread,
+   * the result is reported via tcpsend_connected() */
+  iemnet_log(x, IEMNET_VERBOSE, "connecting to port %d", portno);
+  x->x_pending = queue_create();
+  if(x->x_pending) {
+    queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+  }
+  x->x_connector = iemnet__connector_create(hostname->s_name, portno,
+                   x->x_timeout, x, tcpsend_connected);
+  if(!x->x_connector) {
+    iemnet_log(x, IEMNET_ERROR, "unable to start connecting to '%s'",
+               hostname->s_name);
+    tcpsend_connected(x, -1, 0);
+  }
 }
 
 static void tcpsend_timeout(t_tcpsend *x, t_float timeout)
@@ -126,9 +150,41 @@ static void tcpsend_send(t_tcpsend *x, t_symbol *s, int argc, t_atom *argv)
   t_iemnet_chunk*chunk = iemnet__chunk_create_list(argc, argv);
   (void)s; /* ignore unused variable */
   if(sender && chunk) {
-    iemnet__sender_send(sender, chunk);
+    if(iemnet__sender_send_owned(sender, chunk) < 0) {
+      tcpsend_disconnect(x);
+    }
+  } else if(x->x_pending && chunk) {
+    /* still connecting: keep the data until we are connected */
+    if(queue_push(x->x_pending, chunk) < 0) {
+      tcpsend_disconnect(x);
+    }
+  } else {
+    iemnet__chunk_destroy(chunk);
+  }
+}
+
+static void tcpsend_sendlimit(t_tcpsend *x, t_symbol *s, int argc,
+                              t_atom *argv)
+{
+  unsigned long dropchunks = 0, dropbytes = 0;
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    iemnet__sender_getdropped(x->x_sender, &dropchunks, &dropbytes);
+    iemnet_log(x, IEMNET_NORMAL,
+               "sendlimit: %lu bytes (%s); dropped %lu chunks (%lu bytes)",
+               x->x_sendlimit, iemnet__overflow2symbol(x->x_overflow)->s_name,
+               dropchunks, dropbytes);
+    break;
+  case 1:
+    iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+    if(x->x_pending) {
+      queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+    }
+    break;
+  default:
+    break;
   }
-  iemnet__chunk_destroy(chunk);
 }
 
 static void tcpsend_free(t_tcpsend *x)
@@ -141,7 +197,12 @@ static void *tcpsend_new(void)
   t_tcpsend *x = (t_tcpsend *)pd_new(tcpsend_class);
   outlet_new(&x->x_obj, gensym("float"));
   x->x_fd = -1;
+  x->x_sender = NULL;
+  x->x_connector = NULL;
+  x->x_pending = NULL;
   x->x_timeout = -1;
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
   return (x);
 }
 
@@ -164,8 +225,16 @@ IEMNET_EXTERN void tcpsend_setup(void)
   class_addlist(tcpsend_class, (t_method)tcpsend_send);
   class_addmethod(tcpsend_class, (t_method)tcpsend_timeout, gensym("timeout"),
                   A_FLOAT, 0);
+  class_addmethod(tcpsend_class, (t_method)tcpsend_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
 
   DEBUGMETHOD(tcpsend_class);
+
+  POOLSTATSMETHOD(tcpsend_class);
+
+  SENDTHREADSMETHOD(tcpsend_class);
+  RECEIVETHREADMETHOD(tcpsend_class);
+  RESOLVERCACHEMETHOD(tcpsend_class);
 }
 
 IEMNET_INITIALIZER(tcpsend_setup);
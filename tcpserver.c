@@ -36,7 +36,7 @@
 # include <netinet/tcp.h>
 #endif
 
-#define MAX_CONNECT 32 /* maximum number of connections */
+#define MAX_CONNECT 32 /* default maximum number of connections */
 
 typedef enum {
   ILLEGAL=-1,
@@ -59,7 +59,7 @@ typedef struct _tcpserver_socketreceiver {
   long sr_host;
   unsigned short sr_port;
   int sr_fd;
-  unsigned int sr_client;
+  unsigned int sr_handle; /* our entry in the owner's x_clients */
   t_iemnet_sender*sr_sender;
   t_iemnet_receiver*sr_receiver;
   t_symbol*sr_hostname;
@@ -76,16 +76,38 @@ typedef struct _tcpserver {
   int x_serialize; /* whether we want to serialize the data or not (TRUE) */
   int x_accepting; /* whether we are accepting new connections (TRUE) */
 
-  t_tcpserver_socketreceiver**x_sr; /* socket per connection */
-  unsigned int x_nconnections;
+  /* the connected clients (t_tcpserver_socketreceiver), keyed by socket;
+   * the client id is the slot+1 */
+  t_iemnet_slotmap*x_clients;
   unsigned int x_maxconnections;
 
-  int x_connectsocket; /* socket waiting for new connections */
+  /* sockets waiting for new connections;
+   * with sharding, there are several sockets listening on the same port,
+   * and the connections of each are read by its own receive thread */
+  int x_connectsocket[IEMNET_RECEIVER_MAXSHARDS];
+  unsigned int x_nconnectsockets;
+  unsigned int x_shards; /* number of sockets to listen on (1: no sharding) */
   int x_port;
+  int x_backlog; /* max. pending connections (0: default) */
+  int x_deferaccept; /* seconds to wait for data before accepting (0: off) */
 
   /* the default connection to send to; 0 = broadcast; >0 use this client; <0 exclude this client */
   int x_defaulttarget;
+
+  unsigned long x_sendlimit; /* max. bytes in each send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
+
   t_iemnet_floatlist*x_floatlist;
+
+  /* snapshot of the clients' handles while broadcasting
+   * (grown along with the client table) */
+  unsigned int*x_snapshot;
+  unsigned int x_snapshotsize;
+  int x_snapshotbusy; /* a broadcast is in progress (e.g. re-entered from the outlet) */
 } t_tcpserver;
 
 /* forward declarations */
@@ -123,7 +145,7 @@ static t_tcpserver_event tcpserver_info_event(t_tcpserver *x, t_tcpserver_event
 
 
 static t_tcpserver_socketreceiver *tcpserver_socketreceiver_new(
-  t_tcpserver *owner, int sockfd, struct sockaddr_in*addr, unsigned int client)
+  t_tcpserver *owner, int sockfd, struct sockaddr_in*addr, int shard)
 {
   t_tcpserver_socketreceiver *x = (t_tcpserver_socketreceiver *)getbytes(sizeof(*x));
   long address;
@@ -135,7 +157,7 @@ static t_tcpserver_socketreceiver *tcpserver_socketreceiver_new(
   x->sr_owner = owner;
 
   x->sr_fd = sockfd;
-  x->sr_client = client;
+  x->sr_handle = 0;
 
   x->sr_host = ntohl(addr->sin_addr.s_addr);
   x->sr_port = ntohs(addr->sin_port);
@@ -151,8 +173,18 @@ static t_tcpserver_socketreceiver *tcpserver_socketreceiver_new(
   x->sr_hostname = gensym(hostname);
 
   x->sr_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
-  x->sr_receiver = iemnet__receiver_create(sockfd, x,
-                                         tcpserver_receive_callback, 0);
+  iemnet__sender_setlimit(x->sr_sender,
+                            owner->x_sendlimit, owner->x_overflow);
+  if(shard < 0) {
+    x->sr_receiver = iemnet__receiver_create(sockfd, x,
+                     tcpserver_receive_callback, 0);
+  } else {
+    x->sr_receiver = iemnet__receiver_create_shard(sockfd, x,
+                     tcpserver_receive_callback, 0, shard);
+  }
+  iemnet__receiver_setbudget(x->sr_receiver,
+                             owner->x_recvpackets, owner->x_recvbytes);
+  iemnet__receiver_setbufsize(x->sr_receiver, owner->x_recvbufsize);
   return (x);
 }
 
@@ -184,73 +216,95 @@ static void tcpserver_socketreceiver_free(t_tcpserver_socketreceiver *x)
   DEBUG("freed %x", x);
 }
 
-static int tcpserver_socket2index(t_tcpserver*x, int sockfd)
+static unsigned int tcpserver_clientid(t_tcpserver_socketreceiver*sr)
 {
-  unsigned int i = 0;
-  for(i = 0; i < x->x_nconnections; i++) { /* check if connection exists */
-    if(x->x_sr[i]->sr_fd == sockfd) {
-      return i;
-    }
-  }
-  return -1;
+  return iemnet__slotmap_index(sr->sr_handle) + 1;
 }
 
-/* checks whether client is a valid (1-based) index
- *  if the id is invalid, returns -1
- *  if the id is valid, return the 0-based index (client-1)
+static t_tcpserver_socketreceiver*tcpserver_socket2client(t_tcpserver*x,
+    int sockfd)
+{
+  return (t_tcpserver_socketreceiver*)iemnet__slotmap_get(x->x_clients,
+         iemnet__slotmap_find(x->x_clients, sockfd));
+}
+
+/* gets the client with the given (1-based) id
+ *  if the id is invalid, returns NULL
  */
-static int tcpserver_fixindex(t_tcpserver*x, int client)
+static t_tcpserver_socketreceiver*tcpserver_getclient(t_tcpserver*x,
+    int client)
 {
-  if(x->x_nconnections <= 0) {
+  t_tcpserver_socketreceiver*sr = NULL;
+  if(!iemnet__slotmap_size(x->x_clients)) {
     iemnet_log(x, IEMNET_ERROR, "no clients connected");
-    return -1;
+    return NULL;
   }
-
-  if (!((client > 0) && ((unsigned int)client <= x->x_nconnections))) {
-    iemnet_log(x, IEMNET_ERROR,
-               "client:%d out of range [1..%d]",
-               client, (int)(x->x_nconnections));
-    return -1;
+  if(client > 0) {
+    sr = (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients,
+         client - 1);
   }
-  return (client-1);
+  if(!sr) {
+    iemnet_log(x, IEMNET_ERROR, "client:%d is not connected", client);
+  }
+  return sr;
 }
 
 /* ---------------- tcpserver info ---------------------------- */
-static void tcpserver_info_client(t_tcpserver *x, unsigned int client)
+static void tcpserver_info_client(t_tcpserver *x,
+                                  t_tcpserver_socketreceiver*sr)
 {
   /*
     "client <id> <socket> <IP> <port>"
     "bufsize <id> <insize> <outsize>"
+    "dropped <id> <chunks> <bytes>"
+    "recvbuf <id> <pending> <buffered> <highwater>"
   */
   static t_atom output_atom[4];
-  if(x && client<x->x_maxconnections && x->x_sr[client]) {
-    int sockfd = x->x_sr[client]->sr_fd;
-    unsigned short port = x->x_sr[client]->sr_port;
+  if(x && sr) {
+    unsigned int client = tcpserver_clientid(sr);
+    int sockfd = sr->sr_fd;
+    unsigned short port = sr->sr_port;
 
-    int insize = iemnet__receiver_getsize(x->x_sr[client]->sr_receiver);
-    int outsize = iemnet__sender_getsize(x->x_sr[client]->sr_sender);
+    int insize = iemnet__receiver_getsize(sr->sr_receiver);
+    int outsize = iemnet__sender_getsize(sr->sr_sender);
+    unsigned long dropchunks = 0, dropbytes = 0;
+    unsigned long pending = 0, buffered = 0, highwater = 0;
 
     tcpserver_info_event(x, CLIENT_INFO);
 
 
-    SETFLOAT(output_atom+0, client+1);
+    SETFLOAT(output_atom+0, client);
     SETFLOAT(output_atom+1, sockfd);
-    SETSYMBOL(output_atom+2, x->x_sr[client]->sr_hostname);
+    SETSYMBOL(output_atom+2, sr->sr_hostname);
     SETFLOAT(output_atom+3, port);
 
     outlet_anything( x->x_statusout, gensym("client"), 4, output_atom);
 
-    SETFLOAT(output_atom+0, client+1);
+    SETFLOAT(output_atom+0, client);
     SETFLOAT(output_atom+1, insize);
     SETFLOAT(output_atom+2, outsize);
     outlet_anything( x->x_statusout, gensym("bufsize"), 3, output_atom);
+
+    iemnet__sender_getdropped(sr->sr_sender, &dropchunks, &dropbytes);
+    SETFLOAT(output_atom+0, client);
+    SETFLOAT(output_atom+1, dropchunks);
+    SETFLOAT(output_atom+2, dropbytes);
+    outlet_anything( x->x_statusout, gensym("dropped"), 3, output_atom);
+
+    iemnet__receiver_getstats(sr->sr_receiver, &pending, &buffered,
+                              &highwater);
+    SETFLOAT(output_atom+0, client);
+    SETFLOAT(output_atom+1, pending);
+    SETFLOAT(output_atom+2, buffered);
+    SETFLOAT(output_atom+3, highwater);
+    outlet_anything( x->x_statusout, gensym("recvbuf"), 4, output_atom);
   }
 }
 
 static void tcpserver_info(t_tcpserver *x)
 {
   static t_atom output_atom[4];
-  int sockfd = x->x_connectsocket;
+  int sockfd = x->x_nconnectsockets?x->x_connectsocket[0]:-1;
 
   int port = x->x_port;
 
@@ -278,6 +332,12 @@ static void tcpserver_info(t_tcpserver *x)
   outlet_anything( x->x_statusout, gensym("port"), 1, output_atom);
   SETFLOAT(output_atom+0, x->x_maxconnections);
   outlet_anything( x->x_statusout, gensym("maxconnections"), 1, output_atom);
+  SETFLOAT(output_atom+0, x->x_backlog?x->x_backlog:IEMNET_LISTEN_BACKLOG);
+  outlet_anything( x->x_statusout, gensym("backlog"), 1, output_atom);
+  SETFLOAT(output_atom+0, x->x_deferaccept);
+  outlet_anything( x->x_statusout, gensym("deferaccept"), 1, output_atom);
+  SETFLOAT(output_atom+0, x->x_nconnectsockets);
+  outlet_anything( x->x_statusout, gensym("shards"), 1, output_atom);
 }
 
 static void tcpserver_info_connection(t_tcpserver *x
@@ -287,7 +347,7 @@ static void tcpserver_info_connection(t_tcpserver *x
 {
   t_atom a[4];
   tcpserver_info_event(x, event);
-  SETFLOAT(a+0, y->sr_client + 1);
+  SETFLOAT(a+0, tcpserver_clientid(y));
   SETFLOAT(a+1, y->sr_fd);
   SETSYMBOL(a+2, y->sr_hostname);
   SETFLOAT(a+3, y->sr_port);
@@ -300,12 +360,14 @@ static void tcpserver_info_connection(t_tcpserver *x
 }
 
 /* ---------------- main tcpserver (send) stuff --------------------- */
-static void tcpserver_disconnect_socket(t_tcpserver *x,
-                                        t_floatarg fsocket);
+static void tcpserver_disconnect(t_tcpserver *x,
+                                 t_tcpserver_socketreceiver*sr);
 
+/* sends the chunk to a single client, taking ownership of the chunk */
 static void tcpserver_send_bytes_client(t_tcpserver*x,
-                                        t_tcpserver_socketreceiver*sr, int client, t_iemnet_chunk*chunk)
+                                        t_tcpserver_socketreceiver*sr, t_iemnet_chunk*chunk)
 {
+  DEBUG("send_bytes to %p -> %p", x, sr);
   if(sr) {
     t_atom output_atom[3];
     int size = -1;
@@ -313,101 +375,124 @@ static void tcpserver_send_bytes_client(t_tcpserver*x,
     t_iemnet_sender*sender = sr->sr_sender;
     int sockfd = sr->sr_fd;
     if(sender) {
-      size = iemnet__sender_send(sender, chunk);
+      size = iemnet__sender_send_owned(sender, chunk);
+    } else {
+      iemnet__chunk_destroy(chunk);
     }
 
     tcpserver_info_event(x, SEND);
-    SETFLOAT(&output_atom[0], client+1);
+    SETFLOAT(&output_atom[0], tcpserver_clientid(sr));
     SETFLOAT(&output_atom[1], size);
     SETFLOAT(&output_atom[2], sockfd);
     outlet_anything( x->x_statusout, gensym("sendbuffersize"), 3, output_atom);
 
     if(size<0) {
       /* disconnected! */
-      tcpserver_disconnect_socket(x, sockfd);
+      tcpserver_disconnect(x, sr);
     }
+  } else {
+    iemnet__chunk_destroy(chunk);
   }
 }
 
-static void tcpserver_send_bytes(t_tcpserver*x, unsigned int client,
-                                 t_iemnet_chunk*chunk)
+/* send the chunk to all clients but the given one (which might be NULL)
+ * (the clients share the payload; the caller keeps its reference) */
+static void tcpserver_send_bytes_clients(t_tcpserver*x,
+    t_tcpserver_socketreceiver*but, t_iemnet_chunk*chunk)
 {
-  t_tcpserver_socketreceiver*sr = NULL;
-  if(x && client<x->x_maxconnections) {
-    sr = x->x_sr[client];
+  unsigned int capacity = iemnet__slotmap_capacity(x->x_clients);
+  unsigned int i, count = 0;
+  unsigned int*handles = x->x_snapshot;
+  if(!capacity) {
+    return;
   }
-  DEBUG("send_bytes to %p[%d] -> %p", x, client, sr);
-  tcpserver_send_bytes_client(x, sr, client, chunk);
-}
 
-/* send the chunk to all non-null clients */
-static void tcpserver_send_bytes_clients(t_tcpserver*x,
-    t_tcpserver_socketreceiver**sr, unsigned int nsr, t_iemnet_chunk*chunk)
-{
-  unsigned int i = 0;
-  for(i = 0; i<nsr; i++) {
-    tcpserver_send_bytes_client(x, sr[i], i, chunk);
+  /* sending might disconnect clients, so we first take a snapshot
+   * of all the receivers, and then check whether they are still valid */
+  if(x->x_snapshotbusy) {
+    /* re-entered (from the status outlet): don't touch the outer snapshot */
+    handles = (unsigned int*)malloc(capacity * sizeof(*handles));
+  } else if(x->x_snapshotsize < capacity) {
+    handles = (unsigned int*)realloc(x->x_snapshot, capacity * sizeof(*handles));
+    if(handles) {
+      x->x_snapshot = handles;
+      x->x_snapshotsize = capacity;
+    }
+  }
+  if(!handles) {
+    return;
+  }
+  if(handles == x->x_snapshot) {
+    x->x_snapshotbusy = 1;
+  }
+  for(i = 0; i<capacity; i++) {
+    t_tcpserver_socketreceiver*sr =
+      (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+    if(sr && sr != but) {
+      handles[count++] = sr->sr_handle;
+    }
+  }
+  for(i = 0; i<count; i++) {
+    t_tcpserver_socketreceiver*sr =
+      (t_tcpserver_socketreceiver*)iemnet__slotmap_get(x->x_clients,
+          handles[i]);
+    if(sr) {
+      tcpserver_send_bytes_client(x, sr, iemnet__chunk_share(chunk));
+    }
+  }
+  if(handles == x->x_snapshot) {
+    x->x_snapshotbusy = 0;
+  } else {
+    free(handles);
   }
 }
 
 /* broadcasts a message to all connected clients but the given one */
-static void tcpserver_send_butclient(t_tcpserver *x, unsigned int but,
+static void tcpserver_send_butclient(t_tcpserver *x,
+                                     t_tcpserver_socketreceiver*but,
                                      int argc, t_atom *argv)
 {
-  unsigned int client = 0;
   t_iemnet_chunk*chunk = NULL;
-  t_tcpserver_socketreceiver**sr = NULL;
-  if(!x || !x->x_nconnections) {
+  if(!x || !iemnet__slotmap_size(x->x_clients)) {
     return;
   }
 
   chunk = iemnet__chunk_create_list(argc, argv);
-  sr = (t_tcpserver_socketreceiver**)calloc(x->x_nconnections, sizeof(*sr));
-
-  for(client = 0; client<x->x_nconnections; client++) {
-    sr[client] = x->x_sr[client];
-  }
-
-  if(but<x->x_nconnections) {
-    sr[but] = NULL;
-  }
-
-  tcpserver_send_bytes_clients(x, sr, x->x_nconnections, chunk);
-
-  free(sr);
+  tcpserver_send_bytes_clients(x, but, chunk);
   iemnet__chunk_destroy(chunk);
 }
 /* sends a message to a given client */
-static void tcpserver_send_toclient(t_tcpserver *x, unsigned int client,
+static void tcpserver_send_toclient(t_tcpserver *x,
+                                    t_tcpserver_socketreceiver*sr,
                                     int argc, t_atom *argv)
 {
   t_iemnet_chunk*chunk = iemnet__chunk_create_list(argc, argv);
-  tcpserver_send_bytes(x, client, chunk);
-  iemnet__chunk_destroy(chunk);
+  tcpserver_send_bytes_client(x, sr, chunk);
 }
 
 /* send message to client using client number
-   note that the client numbers might change in case a client disconnects! */
-/* clients start at 1 but our index starts at 0 */
+   the client numbers stay the same as long as the client is connected;
+   the number of a disconnected client is re-used for a new connection! */
 static void tcpserver_send_client(t_tcpserver *x, t_symbol *s, int argc,
                                   t_atom *argv)
 {
   (void)s; /* ignore unused variable */
   if (argc > 0) {
-    int client = tcpserver_fixindex(x, atom_getint(argv));
-    if(client<0) {
+    t_tcpserver_socketreceiver*sr = tcpserver_getclient(x, atom_getint(argv));
+    if(!sr) {
       return;
     }
     if(argc == 1) {
-      tcpserver_info_client(x, client);
+      tcpserver_info_client(x, sr);
     } else {
-      tcpserver_send_toclient(x, client, argc-1, argv+1);
+      tcpserver_send_toclient(x, sr, argc-1, argv+1);
     }
     return;
   } else {
-    unsigned int client = 0;
-    for(client = 0; client<x->x_nconnections; client++) {
-      tcpserver_info_client(x, client);
+    unsigned int i = 0;
+    for(i = 0; i<iemnet__slotmap_capacity(x->x_clients); i++) {
+      tcpserver_info_client(x,
+                            (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i));
     }
   }
 }
@@ -416,44 +501,27 @@ static void tcpserver_send_client(t_tcpserver *x, t_symbol *s, int argc,
 static void tcpserver_broadcast(t_tcpserver *x, t_symbol *s, int argc,
                                 t_atom *argv)
 {
-  unsigned int client = 0;
-  t_iemnet_chunk*chunk = NULL;
-  t_tcpserver_socketreceiver**sr = NULL;
   (void)s; /* ignore unused variable */
-  if(!x || !x->x_nconnections) {
-    return;
-  }
-
-  chunk = iemnet__chunk_create_list(argc, argv);
-  sr = (t_tcpserver_socketreceiver**)calloc(x->x_nconnections, sizeof(*sr));
-
-  for(client = 0; client<x->x_nconnections; client++) {
-    sr[client] = x->x_sr[client];
-  }
-
-  tcpserver_send_bytes_clients(x, sr, x->x_nconnections, chunk);
-
-  free(sr);
-  iemnet__chunk_destroy(chunk);
+  tcpserver_send_butclient(x, NULL, argc, argv);
 }
 
 static void tcpserver_defaultsend(t_tcpserver *x, t_symbol *s, int argc,
                                   t_atom *argv)
 {
-  int client = -1;
+  t_tcpserver_socketreceiver*sr = NULL;
   int sockfd = x->x_defaulttarget;
   if(sockfd>0) {
-    client = tcpserver_socket2index(x, sockfd);
-    if(client >= 0) {
-      tcpserver_send_toclient(x, client, argc, argv);
+    sr = tcpserver_socket2client(x, sockfd);
+    if(sr) {
+      tcpserver_send_toclient(x, sr, argc, argv);
       return;
     }
     iemnet_log(x, IEMNET_ERROR, "illegal socket:%d, switching to broadcast mode", sockfd);
     x->x_defaulttarget = 0;
   } else if(sockfd<0) {
-    client = tcpserver_socket2index(x, -sockfd);
-    if(client >= 0) {
-      tcpserver_send_butclient(x, client, argc, argv);
+    sr = tcpserver_socket2client(x, -sockfd);
+    if(sr) {
+      tcpserver_send_butclient(x, sr, argc, argv);
       return;
     }
     iemnet_log(x, IEMNET_ERROR, "illegal socket:%d excluded, switching to broadcast mode", sockfd);
@@ -466,18 +534,15 @@ static void tcpserver_defaulttarget(t_tcpserver *x, t_floatarg f)
 {
   int sockfd = 0;
   int rawclient = f;
-  unsigned int client = (rawclient<0)?(-rawclient):rawclient;
-
-  if(client > x->x_nconnections) {
-    iemnet_log(x, IEMNET_ERROR,
-               "target %d out of range [0..%d]",
-               client, (int)(x->x_nconnections));
-    return;
-  }
+  int client = (rawclient<0)?(-rawclient):rawclient;
 
   /* map the client to a persistant socket */
   if(client>0) {
-    sockfd = x->x_sr[client-1]->sr_fd;
+    t_tcpserver_socketreceiver*sr = tcpserver_getclient(x, client);
+    if(!sr) {
+      return;
+    }
+    sockfd = sr->sr_fd;
   }
 
   if(rawclient<0) {
@@ -496,24 +561,19 @@ static void tcpserver_targetsocket(t_tcpserver *x, t_floatarg f)
 static void tcpserver_send_socket(t_tcpserver *x, t_symbol *s, int argc,
                                   t_atom *argv)
 {
-  int client = -1;
+  t_tcpserver_socketreceiver*sr = NULL;
   t_iemnet_chunk*chunk = NULL;
   (void)s; /* ignore unused variable */
-  if(argc) {
-    client = tcpserver_socket2index(x, atom_getint(argv));
-    if(client<0) {
-      return;
-    }
-  } else {
+  if(!argc) {
     iemnet_log(x, IEMNET_ERROR, "no socket specified");
     return;
   }
 
   /* get socket number of connection (first element in list) */
-  if(argc && argv->a_type == A_FLOAT) {
+  if(argv->a_type == A_FLOAT) {
     int sockfd = atom_getint(argv);
-    client = tcpserver_socket2index(x, sockfd);
-    if(client < 0) {
+    sr = tcpserver_socket2client(x, sockfd);
+    if(!sr) {
       iemnet_log(x, IEMNET_ERROR, "no connection on socket %d", sockfd);
       return;
     }
@@ -523,55 +583,50 @@ static void tcpserver_send_socket(t_tcpserver *x, t_symbol *s, int argc,
   }
 
   chunk = iemnet__chunk_create_list(argc-1, argv+1);
-  tcpserver_send_bytes(x, client, chunk);
-  iemnet__chunk_destroy(chunk);
+  tcpserver_send_bytes_client(x, sr, chunk);
 }
 
-static void tcpserver_disconnect(t_tcpserver *x, unsigned int client)
+static void tcpserver_disconnect(t_tcpserver *x,
+                                 t_tcpserver_socketreceiver*sr)
 {
-  unsigned int k;
-  DEBUG("disconnect %x %d", x, client);
-  tcpserver_info_connection(x, x->x_sr[client], DISCONNECT);
-
-  tcpserver_socketreceiver_free(x->x_sr[client]);
-  x->x_sr[client] = NULL;
+  DEBUG("disconnect %x %x", x, sr);
+  tcpserver_info_connection(x, sr, DISCONNECT);
 
-  /* rearrange list now: move entries to close the gap */
-  for(k = client; k < x->x_nconnections; k++) {
-    x->x_sr[k] = x->x_sr[k + 1];
-  }
-  x->x_sr[k + 1] = NULL;
-  x->x_nconnections--;
+  iemnet__slotmap_remove(x->x_clients, sr->sr_handle);
+  tcpserver_socketreceiver_free(sr);
 
-  iemnet__numconnout(x->x_statusout, x->x_connectout, x->x_nconnections);
+  iemnet__numconnout(x->x_statusout, x->x_connectout,
+                     iemnet__slotmap_size(x->x_clients));
 }
 
 /* disconnect a client by number */
 static void tcpserver_disconnect_client(t_tcpserver *x, t_floatarg fclient)
 {
-  int client = tcpserver_fixindex(x, fclient);
-
-  if(client<0) {
-    return;
+  t_tcpserver_socketreceiver*sr = tcpserver_getclient(x, fclient);
+  if(sr) {
+    tcpserver_disconnect(x, sr);
   }
-  tcpserver_disconnect(x, client);
 }
 
 /* disconnect a client by socket */
 static void tcpserver_disconnect_socket(t_tcpserver *x, t_floatarg fsocket)
 {
-  int id = tcpserver_socket2index(x, (int)fsocket);
-  if(id >= 0) {
-    tcpserver_disconnect_client(x, id+1);
+  t_tcpserver_socketreceiver*sr = tcpserver_socket2client(x, (int)fsocket);
+  if(sr) {
+    tcpserver_disconnect(x, sr);
   }
 }
 
-/* disconnect a client by socket */
+/* disconnect all clients */
 static void tcpserver_disconnect_all(t_tcpserver *x)
 {
-  unsigned int id;
-  for(id = 0; id<x->x_nconnections; id++) {
-    tcpserver_disconnect(x, id);
+  unsigned int i;
+  for(i = 0; i<iemnet__slotmap_capacity(x->x_clients); i++) {
+    t_tcpserver_socketreceiver*sr =
+      (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+    if(sr) {
+      tcpserver_disconnect(x, sr);
+    }
   }
 }
 
@@ -586,11 +641,13 @@ static void tcpserver_receive_callback(void *y0,
   }
 
   if(c) {
+    t_atom*argv = NULL;
     tcpserver_info_connection(x, y, RECEIVE);
     /* get's destroyed in the dtor */
-    x->x_floatlist = iemnet__chunk2list(c, x->x_floatlist);
-    iemnet__streamout(x->x_msgout, x->x_floatlist->argc, x->x_floatlist->argv,
-                      x->x_serialize);
+    argv = iemnet__chunk2atoms(c, &x->x_floatlist);
+    if(argv) {
+      iemnet__streamout(x->x_msgout, c->size, argv, x->x_serialize);
+    }
   } else {
     /* disconnected */
     int sockfd = y->sr_fd;
@@ -599,78 +656,100 @@ static void tcpserver_receive_callback(void *y0,
   }
 }
 
-static void tcpserver_connectpoll(t_tcpserver *x, int fd)
+/* takes over the accepted socket */
+static void tcpserver_addclient(t_tcpserver *x, int fd,
+                                struct sockaddr_in*address, int shard)
 {
-  struct sockaddr_in incomer_address;
-  socklen_t sockaddrl = sizeof( struct sockaddr );
-  if(fd != x->x_connectsocket) {
-    iemnet_log(x, IEMNET_FATAL, "callback received for socket:%d on listener for socket:%d", fd, x->x_connectsocket);
+  t_tcpserver_socketreceiver *y = NULL;
+  tcpserver_info_event(x, CONNECT);
+  if(!x->x_accepting) {
+    iemnet__closesocket(fd, 1);
+    return;
+  }
+  if(iemnet__slotmap_size(x->x_clients) >= x->x_maxconnections) {
+    iemnet_log(x, IEMNET_ERROR,
+               "cannot handle more than %d connections, dropping!",
+               x->x_maxconnections);
+    iemnet__closesocket(fd, 1);
     return;
   }
 
-  fd = accept(fd, (struct sockaddr*)&incomer_address, &sockaddrl);
-
-  tcpserver_info_event(x, CONNECT);
-  if (fd < 0) {
-    post("%s: accept failed", objName);
-  } else if(!x->x_accepting) {
+  y = tcpserver_socketreceiver_new((void *)x, fd, address, shard);
+  if (!y) {
     iemnet__closesocket(fd, 1);
-  } else {
-    t_tcpserver_socketreceiver *y = NULL;
-    if(x->x_nconnections >= x->x_maxconnections) {
-      iemnet_log(x, IEMNET_ERROR,
-                 "cannot handle more than %d connections, dropping!",
-                 x->x_nconnections);
-      iemnet__closesocket(fd, 1);
-      return;
-    }
+    return;
+  }
 
-    y = tcpserver_socketreceiver_new((void *)x, fd, &incomer_address, x->x_nconnections);
-    if (!y) {
-      iemnet__closesocket(fd, 1);
-      return;
+  y->sr_handle = iemnet__slotmap_add(x->x_clients, fd, y);
+  if(!y->sr_handle) {
+    iemnet_log(x, IEMNET_ERROR, "unable to add connection, dropping!");
+    tcpserver_socketreceiver_free(y);
+    return;
+  }
+
+  tcpserver_info_connection(x, y, ILLEGAL);
+}
+
+static void tcpserver_connectpoll(t_tcpserver *x, int fd)
+{
+  unsigned int count, shard;
+  for(shard = 0; shard < x->x_nconnectsockets; shard++) {
+    if(fd == x->x_connectsocket[shard]) {
+      break;
     }
+  }
+  if(shard >= x->x_nconnectsockets) {
+    iemnet_log(x, IEMNET_FATAL, "callback received for socket:%d on listener for port:%d", fd, x->x_port);
+    return;
+  }
 
-    x->x_sr[x->x_nconnections] = y;
-    x->x_nconnections++;
+  /* accept all pending connections (but not too many at once) */
+  for(count = 0; count < IEMNET_ACCEPT_BUDGET; count++) {
+    struct sockaddr_in incomer_address;
+    int sockfd = iemnet__accept(fd, &incomer_address);
+    if(sockfd < 0) {
+      if(sockfd < -1) {
+        iemnet_log(x, IEMNET_ERROR, "accept failed");
+        sys_sockerror("accept");
+      }
+      break;
+    }
+    tcpserver_addclient(x, sockfd, &incomer_address,
+                        (x->x_nconnectsockets > 1)?(int)shard:-1);
+  }
+  if(count) {
+    iemnet__numconnout(x->x_statusout, x->x_connectout,
+                       iemnet__slotmap_size(x->x_clients));
+  }
+}
 
-    tcpserver_info_connection(x, y, ILLEGAL);
+static void tcpserver_closeports(t_tcpserver*x)
+{
+  unsigned int i;
+  for(i = 0; i < x->x_nconnectsockets; i++) {
+    sys_rmpollfn(x->x_connectsocket[i]);
+    iemnet__closesocket(x->x_connectsocket[i], 1);
+    x->x_connectsocket[i] = -1;
   }
-  iemnet__numconnout(x->x_statusout, x->x_connectout, x->x_nconnections);
+  x->x_nconnectsockets = 0;
+  x->x_port = -1;
 }
 
-static void tcpserver_port(t_tcpserver*x, t_floatarg fportno)
+/* returns the listening socket (or -1) */
+static int tcpserver_listensocket(t_tcpserver*x, int portno)
 {
-  static t_atom ap[1];
-  int portno = fportno;
   struct sockaddr_in server;
   socklen_t serversize = sizeof(server);
-  int sockfd = x->x_connectsocket;
+  int sockfd;
   int intarg;
   memset(&server, 0, sizeof(server));
 
-  tcpserver_info_event(x, SERVER_INFO);
-
-  SETFLOAT(ap, -1);
-  if(x->x_port == portno) {
-    return;
-  }
-
-  /* cleanup any open ports */
-  if(sockfd >= 0) {
-    sys_rmpollfn(sockfd);
-    iemnet__closesocket(sockfd, 1);
-    x->x_connectsocket = -1;
-    x->x_port = -1;
-  }
-
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if(sockfd<0) {
     iemnet_log(x, IEMNET_ERROR, "unable to create TCP/IP socket");
     sys_sockerror("socket");
-    return;
+    return -1;
   }
-
   /* ask OS to allow another Pd to reopen this port after we close it. */
 #ifdef SO_REUSEADDR
   intarg = 1;
@@ -711,24 +790,51 @@ static void tcpserver_port(t_tcpserver*x, t_floatarg fportno)
     iemnet_log(x, IEMNET_ERROR, "unable to bind to TCP/IP socket");
     sys_sockerror("bind");
     iemnet__closesocket(sockfd, 1);
-    outlet_anything(x->x_statusout, gensym("port"), 1, ap);
-    return;
+    return -1;
   }
 
   /* streaming protocol */
-  if (listen(sockfd, 5) < 0) {
+  if (iemnet__listen(sockfd, x->x_backlog, x->x_deferaccept) < 0) {
     iemnet_log(x, IEMNET_ERROR, "unable to listen on TCP/IP socket");
     sys_sockerror("listen");
     iemnet__closesocket(sockfd, 1);
-    sockfd = -1;
-    outlet_anything(x->x_statusout, gensym("port"), 1, ap);
-    return;
+    return -1;
   } else {
     /* wait for new connections */
     sys_addpollfn(sockfd, (t_fdpollfn)tcpserver_connectpoll, x);
   }
 
-  x->x_connectsocket = sockfd;
+  return sockfd;
+}
+
+static void tcpserver_port(t_tcpserver*x, t_floatarg fportno)
+{
+  static t_atom ap[1];
+  int portno = fportno;
+  struct sockaddr_in server;
+  socklen_t serversize = sizeof(server);
+  int sockfd;
+  unsigned int i;
+  memset(&server, 0, sizeof(server));
+
+  tcpserver_info_event(x, SERVER_INFO);
+
+  SETFLOAT(ap, -1);
+  if(x->x_port == portno) {
+    return;
+  }
+
+  /* cleanup any open ports */
+  tcpserver_closeports(x);
+
+  sockfd = tcpserver_listensocket(x, portno);
+  if(sockfd < 0) {
+    outlet_anything(x->x_statusout, gensym("port"), 1, ap);
+    return;
+  }
+
+  x->x_connectsocket[0] = sockfd;
+  x->x_nconnectsockets = 1;
   x->x_port = portno;
 
   /* find out which port is actually used (useful when assigning "0") */
@@ -736,6 +842,17 @@ static void tcpserver_port(t_tcpserver*x, t_floatarg fportno)
     x->x_port = ntohs(server.sin_port);
   }
 
+  /* the kernel distributes the new connections across all sockets */
+  for(i = 1; i < x->x_shards; i++) {
+    int fd = tcpserver_listensocket(x, x->x_port);
+    if(fd < 0) {
+      iemnet_log(x, IEMNET_ERROR, "only using %d shards", i);
+      break;
+    }
+    x->x_connectsocket[i] = fd;
+    x->x_nconnectsockets++;
+  }
+
   iemnet__socket2addressout(sockfd, x->x_statusout, gensym("local_address"));
 
   SETFLOAT(ap, x->x_port);
@@ -753,35 +870,194 @@ static void tcpserver_accept(t_tcpserver *x, t_floatarg doit)
 static void tcpserver_maxconnections(t_tcpserver *x, t_floatarg maxconnf)
 {
   unsigned int maxconn = (unsigned int)maxconnf;
-  t_tcpserver_socketreceiver**sr;
+  unsigned int nconnections = iemnet__slotmap_size(x->x_clients);
   if(maxconnf<1) {
     pd_error(x, "maximum number of connections must be > 0");
     return;
   }
-  if(maxconn < x->x_nconnections) {
-    pd_error(x, "maximum number of connections < number of currently connected clients [%d]", x->x_nconnections);
+  if(maxconn < nconnections) {
+    pd_error(x, "maximum number of connections < number of currently connected clients [%d]", nconnections);
     return;
   }
-  if(maxconn == x->x_maxconnections) {
+  /* the client table grows as needed */
+  x->x_maxconnections = maxconn;
+}
+
+/* apply the backlog & deferaccept settings to the listening sockets */
+static void tcpserver_relisten(t_tcpserver *x, const char*what)
+{
+  unsigned int i;
+  for(i = 0; i < x->x_nconnectsockets; i++) {
+    if(iemnet__listen(x->x_connectsocket[i],
+                      x->x_backlog, x->x_deferaccept) < 0) {
+      iemnet_log(x, IEMNET_ERROR, "unable to change %s", what);
+      sys_sockerror("listen");
+      return;
+    }
+  }
+}
+static void tcpserver_backlog(t_tcpserver *x, t_floatarg f)
+{
+  if(f < 0) {
+    pd_error(x, "backlog must be >= 0");
     return;
   }
+  x->x_backlog = f;
+  tcpserver_relisten(x, "backlog");
+}
+static void tcpserver_deferaccept(t_tcpserver *x, t_floatarg f)
+{
+  if(f < 0) {
+    pd_error(x, "deferaccept timeout must be >= 0");
+    return;
+  }
+  x->x_deferaccept = f;
+  tcpserver_relisten(x, "deferaccept");
+}
+static void tcpserver_shards(t_tcpserver *x, t_floatarg f)
+{
+  int shards = f;
+  if(shards < 1 || shards > IEMNET_RECEIVER_MAXSHARDS) {
+    pd_error(x, "number of shards must be in [1..%d]",
+             IEMNET_RECEIVER_MAXSHARDS);
+    return;
+  }
+#ifndef SO_REUSEPORT
+  if(shards > 1) {
+    pd_error(x, "sharding needs SO_REUSEPORT, which is not supported");
+    return;
+  }
+#endif
+  if((unsigned int)shards == x->x_shards) {
+    return;
+  }
+  x->x_shards = shards;
+  /* re-open the port with the new number of sockets
+   * (the connected clients stay where they are) */
+  if(x->x_nconnectsockets) {
+    int port = x->x_port;
+    tcpserver_closeports(x);
+    tcpserver_port(x, port);
+  }
+}
 
-  sr = resizebytes(x->x_sr
-      , sizeof(*sr) * x->x_maxconnections
-      , sizeof(*sr) * maxconn
-      );
-  if(sr) {
-    x->x_sr = sr;
-    x->x_maxconnections = maxconn;
-  } else {
-    pd_error(x, "failed to set maximum number of connections");
+static void tcpserver_sendlimit(t_tcpserver *x, t_symbol *s, int argc,
+                                t_atom *argv)
+{
+  t_atom ap[2];
+  unsigned int i;
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_sendlimit);
+    SETSYMBOL(ap+1, iemnet__overflow2symbol(x->x_overflow));
+    outlet_anything(x->x_statusout, s, 2, ap);
+    break;
+  case 1:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+      t_tcpserver_socketreceiver*sr =
+        (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+      if(sr) {
+        iemnet__sender_setlimit(sr->sr_sender,
+                                x->x_sendlimit, x->x_overflow);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void tcpserver_receivebudget(t_tcpserver *x, t_symbol *s, int argc,
+                                    t_atom *argv)
+{
+  t_atom ap[3];
+  unsigned long exhausted = 0;
+  unsigned int i;
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+      t_tcpserver_socketreceiver*sr =
+        (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+      if(sr) {
+        exhausted += iemnet__receiver_getexhausted(sr->sr_receiver);
+      }
+    }
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, exhausted);
+    outlet_anything(x->x_statusout, s, 3, ap);
+    break;
+  case 1:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+      t_tcpserver_socketreceiver*sr =
+        (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+      if(sr) {
+        iemnet__receiver_setbudget(sr->sr_receiver,
+                                   x->x_recvpackets, x->x_recvbytes);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void tcpserver_recvbufsize(t_tcpserver *x, t_symbol *s, int argc,
+                                  t_atom *argv)
+{
+  t_atom ap[1];
+  unsigned int i;
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statusout, s, 1, ap);
+    break;
+  case 1:
+    for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+      t_tcpserver_socketreceiver*sr =
+        (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+      if(sr) {
+        iemnet__receiver_setbufsize(sr->sr_receiver, x->x_recvbufsize);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* stop (resp. resume) reading from a client (or from all clients) */
+static void tcpserver_pause(t_tcpserver *x, t_symbol *s, int argc,
+                            t_atom *argv)
+{
+  int pause = (gensym("pause") == s);
+  unsigned int i;
+  if(argc) {
+    t_tcpserver_socketreceiver*sr;
+    if(argc > 1 || A_FLOAT != argv->a_type) {
+      iemnet_log(x, IEMNET_ERROR, "usage: %s [<client>]", s->s_name);
+      return;
+    }
+    sr = tcpserver_getclient(x, atom_getint(argv));
+    if(sr) {
+      iemnet__receiver_pause(sr->sr_receiver, pause);
+    }
+    return;
+  }
+  for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+    t_tcpserver_socketreceiver*sr =
+      (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+    if(sr) {
+      iemnet__receiver_pause(sr->sr_receiver, pause);
+    }
   }
 }
 
 static void *tcpserver_new(t_floatarg fportno)
 {
   t_tcpserver*x;
-  unsigned int i;
   x = (t_tcpserver *)pd_new(tcpserver_class);
 
   x->x_msgout = outlet_new(&x->x_obj, 0); /* 1st outlet for received data */
@@ -795,19 +1071,27 @@ static void *tcpserver_new(t_floatarg fportno)
   x->x_serialize = 1;
   x->x_accepting = 1;
 
-  x->x_connectsocket = -1;
+  x->x_nconnectsockets = 0;
+  x->x_shards = 1;
   x->x_port = -1;
-  x->x_nconnections = 0;
+  x->x_backlog = 0;
+  x->x_deferaccept = 0;
   x->x_maxconnections = MAX_CONNECT;
-
-  x->x_sr = (t_tcpserver_socketreceiver**)getbytes(sizeof(*x->x_sr) * x->x_maxconnections);
-
-  for(i = 0; i < x->x_maxconnections; i++) {
-    x->x_sr[i] = NULL;
+  x->x_clients = iemnet__slotmap_create();
+  if(!x->x_clients) {
+    iemnet_log(x, IEMNET_FATAL, "unable to allocate client table");
   }
 
   x->x_defaulttarget = 0;
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
   x->x_floatlist = iemnet__floatlist_create(1024);
+  x->x_snapshot = NULL;
+  x->x_snapshotsize = 0;
+  x->x_snapshotbusy = 0;
 
   tcpserver_port(x, fportno);
 
@@ -818,23 +1102,25 @@ static void tcpserver_free(t_tcpserver *x)
 {
   unsigned int i;
 
-  for(i = 0; i < x->x_maxconnections; i++) {
-    if (NULL != x->x_sr[i]) {
+  for(i = 0; i < iemnet__slotmap_capacity(x->x_clients); i++) {
+    t_tcpserver_socketreceiver*sr =
+      (t_tcpserver_socketreceiver*)iemnet__slotmap_at(x->x_clients, i);
+    if (NULL != sr) {
       DEBUG("[%s] free %x", objName, x);
-      tcpserver_socketreceiver_free(x->x_sr[i]);
-      x->x_sr[i] = NULL;
+      tcpserver_socketreceiver_free(sr);
     }
   }
-  freebytes(x->x_sr, sizeof(*x->x_sr) * x->x_maxconnections);
+  iemnet__slotmap_destroy(x->x_clients);
+  x->x_clients = NULL;
 
-  if (x->x_connectsocket >= 0) {
-    sys_rmpollfn(x->x_connectsocket);
-    iemnet__closesocket(x->x_connectsocket, 1);
-  }
+  tcpserver_closeports(x);
   if(x->x_floatlist) {
     iemnet__floatlist_destroy(x->x_floatlist);
   }
   x->x_floatlist = NULL;
+  free(x->x_snapshot);
+  x->x_snapshot = NULL;
+  x->x_snapshotsize = 0;
 }
 
 IEMNET_EXTERN void tcpserver_setup(void)
@@ -871,8 +1157,24 @@ IEMNET_EXTERN void tcpserver_setup(void)
                   gensym("serialize"), A_FLOAT, 0);
   class_addmethod(tcpserver_class, (t_method)tcpserver_accept,
                   gensym("accept"), A_FLOAT, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_pause,
+                  gensym("pause"), A_GIMME, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_pause,
+                  gensym("resume"), A_GIMME, 0);
   class_addmethod(tcpserver_class, (t_method)tcpserver_maxconnections,
                   gensym("maxconnections"), A_FLOAT, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_backlog,
+                  gensym("backlog"), A_FLOAT, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_deferaccept,
+                  gensym("deferaccept"), A_FLOAT, 0);
+  class_addmethod(tcpserver_class, (t_method)tcpserver_shards,
+                  gensym("shards"), A_FLOAT, 0);
 
 
   class_addmethod(tcpserver_class, (t_method)tcpserver_port, gensym("port"),
@@ -880,6 +1182,11 @@ IEMNET_EXTERN void tcpserver_setup(void)
   class_addbang(tcpserver_class, (t_method)tcpserver_info);
 
   DEBUGMETHOD(tcpserver_class);
+
+  POOLSTATSMETHOD(tcpserver_class);
+
+  SENDTHREADSMETHOD(tcpserver_class);
+  RECEIVETHREADMETHOD(tcpserver_class);
 }
 
 IEMNET_INITIALIZER(tcpserver_setup);
@@ -41,6 +41,8 @@ typedef struct _udpclient {
 
   t_iemnet_sender*x_sender;
   t_iemnet_receiver*x_receiver;
+  t_iemnet_resolver*x_resolver; /* pending hostname lookup */
+  t_iemnet_queue*x_pending; /* data sent while resolving */
 
   int x_fd; /* the socket */
   const char*x_hostname; /* address we want to connect to as text */
@@ -50,6 +52,13 @@ typedef struct _udpclient {
 
   long x_addr; /* address we're connected to as 32bit int */
 
+  unsigned long x_sendlimit; /* max. bytes in the send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
+
   t_iemnet_floatlist*x_floatlist;
 } t_udpclient;
 
@@ -64,6 +73,8 @@ static void udpclient_info(t_udpclient *x)
   /*
     "server <socket> <IP> <port>"
     "bufsize <insize> <outsize>"
+    "dropped <chunks> <bytes>"
+    "recvbuf <pending> <buffered> <highwater>"
   */
   static t_atom output_atom[3];
   int connected = x->x_connectstate;
@@ -78,6 +89,8 @@ static void udpclient_info(t_udpclient *x)
 
     int insize = iemnet__receiver_getsize(x->x_receiver);
     int outsize = iemnet__sender_getsize(x->x_sender);
+    unsigned long dropchunks = 0, dropbytes = 0;
+    unsigned long pending = 0, buffered = 0, highwater = 0;
 
     SETFLOAT(output_atom+0, sockfd);
     SETSYMBOL(output_atom+1, gensym(hostname));
@@ -87,28 +100,44 @@ static void udpclient_info(t_udpclient *x)
     SETFLOAT(output_atom+0, insize);
     SETFLOAT(output_atom+1, outsize);
     outlet_anything(x->x_statusout, gensym("bufsize"), 2, output_atom);
+
+    iemnet__sender_getdropped(x->x_sender, &dropchunks, &dropbytes);
+    SETFLOAT(output_atom+0, dropchunks);
+    SETFLOAT(output_atom+1, dropbytes);
+    outlet_anything(x->x_statusout, gensym("dropped"), 2, output_atom);
+
+    iemnet__receiver_getstats(x->x_receiver, &pending, &buffered, &highwater);
+    SETFLOAT(output_atom+0, pending);
+    SETFLOAT(output_atom+1, buffered);
+    SETFLOAT(output_atom+2, highwater);
+    outlet_anything(x->x_statusout, gensym("recvbuf"), 3, output_atom);
   }
 }
 
 /* connection handling */
-static void *udpclient_doconnect(t_udpclient*x, int subthread)
+static void udpclient_pending_free(t_udpclient*x)
+{
+  if(x->x_pending) {
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
+}
+
+/* the hostname has been resolved */
+static void udpclient_resolved(void*y, int success, uint32_t addr)
 {
+  t_udpclient*x = (t_udpclient*)y;
   struct sockaddr_in server;
-  struct hostent*hp;
+  t_iemnet_chunk*chunk;
   int sockfd;
   int broadcast = 1;/* nonzero is true */
   memset(&server, 0, sizeof(server));
 
-  if (x->x_sender) {
-    iemnet_log(x, IEMNET_ERROR, "already connected");
-    return (x);
-  }
-
-  /* connect socket using hostname provided in command line */
-  hp = gethostbyname(x->x_hostname);
-  if (hp == 0) {
+  x->x_resolver = NULL;
+  if (!success) {
     iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", x->x_hostname);
-    return (x);
+    udpclient_pending_free(x);
+    return;
   }
   server.sin_family = AF_INET;
 
@@ -118,7 +147,8 @@ static void *udpclient_doconnect(t_udpclient*x, int subthread)
   if (sockfd < 0) {
     iemnet_log(x, IEMNET_ERROR, "unable to create socket");
     sys_sockerror("socket");
-    return (x);
+    udpclient_pending_free(x);
+    return;
   }
 
   /* Enable sending of broadcast messages (if hostname is a broadcast address) */
@@ -142,7 +172,7 @@ static void *udpclient_doconnect(t_udpclient*x, int subthread)
 
   /* try to connect. */
   /* assign client port number */
-  memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
+  server.sin_addr.s_addr = htonl(addr);
   server.sin_port = htons(x->x_port);
   DEBUG("connecting to %s:%d", x->x_hostname, x->x_port);
 
@@ -150,24 +180,39 @@ static void *udpclient_doconnect(t_udpclient*x, int subthread)
     iemnet_log(x, IEMNET_ERROR, "unable to connect to stream socket");
     sys_sockerror("connect");
     iemnet__closesocket(sockfd, 1);
-    return (x);
+    udpclient_pending_free(x);
+    return;
   }
 
   x->x_fd = sockfd;
-  x->x_addr = ntohl(*(long *)hp->h_addr);
+  x->x_addr = addr;
 
-  x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, subthread);
+  x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
+  iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
   x->x_receiver = iemnet__receiver_create(sockfd, x,
-                                          udpclient_receive_callback, subthread);
+                                          udpclient_receive_callback, 0);
+  iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+  iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
+
+  /* flush whatever has been sent while we were resolving */
+  if(x->x_pending) {
+    while((chunk = queue_pop_noblock(x->x_pending))) {
+      iemnet__sender_send_owned(x->x_sender, chunk);
+    }
+  }
+  udpclient_pending_free(x);
 
   x->x_connectstate = 1;
   udpclient_info(x);
-  return (x);
 }
 
 static int udpclient_do_disconnect(t_udpclient *x)
 {
+  int resolving = (NULL != x->x_resolver);
   DEBUG("disconnect %x %x", x->x_sender, x->x_receiver);
+  iemnet__resolver_cancel(x->x_resolver);
+  x->x_resolver = NULL;
+  udpclient_pending_free(x);
   if(x->x_receiver) {
     iemnet__receiver_destroy(x->x_receiver, 0);
   }
@@ -179,7 +224,7 @@ static int udpclient_do_disconnect(t_udpclient *x)
 
   x->x_connectstate = 0;
   if (x->x_fd < 0) {
-    return 0;
+    return resolving;
   }
   iemnet__closesocket(x->x_fd, 1);
   x->x_fd = -1;
@@ -198,16 +243,22 @@ static void udpclient_connect(t_udpclient *x, t_symbol *hostname,
                               t_floatarg fportno,
                               t_floatarg fsndportno)
 {
-  if(x->x_fd >= 0) {
+  if(x->x_fd >= 0 || x->x_resolver) {
     udpclient_disconnect(x);
   }
   /* we get hostname and port and pass them on
-     to the child thread that establishes the connection */
+     to the resolver thread; the connection is established
+     in udpclient_resolved() */
   x->x_hostname = hostname->s_name;
   x->x_port = fportno;
   x->x_sendport = (fsndportno>0)?fsndportno:0;
   x->x_connectstate = 0;
-  udpclient_doconnect(x, 0);
+  x->x_pending = queue_create();
+  if(x->x_pending) {
+    queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+  }
+  x->x_resolver = iemnet__resolver_lookup(x->x_hostname, x,
+                                          udpclient_resolved);
 }
 
 /* sending/receiving */
@@ -221,13 +272,79 @@ static void udpclient_send(t_udpclient *x, t_symbol *s, int argc,
   (void)s; /* ignore unused variable */
 
   if(sender && chunk) {
-    size = iemnet__sender_send(sender, chunk);
+    size = iemnet__sender_send_owned(sender, chunk);
+  } else if(x->x_pending && chunk) {
+    /* still resolving: keep the data until we are connected */
+    size = queue_push(x->x_pending, chunk);
+  } else {
+    iemnet__chunk_destroy(chunk);
   }
-  iemnet__chunk_destroy(chunk);
 
   SETFLOAT(&output_atom, size);
   outlet_anything( x->x_statusout, gensym("sendbuffersize"), 1,
                    &output_atom);
+  if(size<0) {
+    udpclient_disconnect(x);
+  }
+}
+
+static void udpclient_sendlimit(t_udpclient *x, t_symbol *s, int argc,
+                                t_atom *argv)
+{
+  t_atom ap[2];
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_sendlimit);
+    SETSYMBOL(ap+1, iemnet__overflow2symbol(x->x_overflow));
+    outlet_anything(x->x_statusout, s, 2, ap);
+    break;
+  case 1:
+    iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+    if(x->x_pending) {
+      queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void udpclient_receivebudget(t_udpclient *x, t_symbol *s, int argc,
+                                    t_atom *argv)
+{
+  t_atom ap[3];
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, iemnet__receiver_getexhausted(x->x_receiver));
+    outlet_anything(x->x_statusout, s, 3, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+    break;
+  default:
+    break;
+  }
+}
+
+static void udpclient_recvbufsize(t_udpclient *x, t_symbol *s, int argc,
+                                  t_atom *argv)
+{
+  t_atom ap[1];
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statusout, s, 1, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
+    break;
+  default:
+    break;
+  }
 }
 
 static void udpclient_receive_callback(void*y, t_iemnet_chunk*c)
@@ -235,11 +352,13 @@ static void udpclient_receive_callback(void*y, t_iemnet_chunk*c)
   t_udpclient *x = (t_udpclient*)y;
 
   if(c) {
+    t_atom*argv = NULL;
     iemnet__addrout(x->x_statusout, x->x_addrout, x->x_addr, x->x_port);
-    x->x_floatlist = iemnet__chunk2list(c,
-                                        x->x_floatlist); /* gets destroyed in the dtor */
-    outlet_list(x->x_msgout, gensym("list"),x->x_floatlist->argc,
-                x->x_floatlist->argv);
+    argv = iemnet__chunk2atoms(c,
+                               &x->x_floatlist); /* gets destroyed in the dtor */
+    if(argv) {
+      outlet_list(x->x_msgout, gensym("list"), c->size, argv);
+    }
   } else {
     /* disconnected */
     DEBUG("disconnected");
@@ -265,8 +384,16 @@ static void *udpclient_new(void)
   x->x_addr = 0L;
   x->x_port = 0;
 
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
+
   x->x_sender = NULL;
   x->x_receiver = NULL;
+  x->x_resolver = NULL;
+  x->x_pending = NULL;
 
   x->x_floatlist = iemnet__floatlist_create(1024);
 
@@ -297,9 +424,21 @@ IEMNET_EXTERN void udpclient_setup(void)
   class_addmethod(udpclient_class, (t_method)udpclient_send, gensym("send"),
                   A_GIMME, 0);
   class_addlist(udpclient_class, (t_method)udpclient_send);
+  class_addmethod(udpclient_class, (t_method)udpclient_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
+  class_addmethod(udpclient_class, (t_method)udpclient_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(udpclient_class, (t_method)udpclient_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
   class_addbang(udpclient_class, (t_method)udpclient_info);
 
   DEBUGMETHOD(udpclient_class);
+
+  POOLSTATSMETHOD(udpclient_class);
+
+  SENDTHREADSMETHOD(udpclient_class);
+  RECEIVETHREADMETHOD(udpclient_class);
+  RESOLVERCACHEMETHOD(udpclient_class);
 }
 
 
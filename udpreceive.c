@@ -38,12 +38,20 @@ typedef struct _udpreceive {
   t_outlet*x_addrout;
   t_outlet*x_statout;
 
-  int x_fd;
+  /* with sharding, there are several sockets bound to the same port,
+   * each read by its own receive thread */
+  int x_fd[IEMNET_RECEIVER_MAXSHARDS];
+  t_iemnet_receiver*x_receiver[IEMNET_RECEIVER_MAXSHARDS];
+  unsigned int x_nsockets; /* number of open sockets */
   int x_port;
-  t_iemnet_receiver*x_receiver;
   t_iemnet_floatlist*x_floatlist;
 
   int x_reuseport, x_reuseaddr;
+  unsigned int x_shards; /* number of sockets to open (1: no sharding) */
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
 } t_udpreceive;
 
 
@@ -51,45 +59,50 @@ static void udpreceive_read_callback(void*y, t_iemnet_chunk*c)
 {
   t_udpreceive*x = (t_udpreceive*)y;
   if(c) {
+    t_atom*argv = NULL;
     iemnet__addrout(x->x_statout, x->x_addrout, c->addr, c->port);
     /* gets destroyed in the dtor */
-    x->x_floatlist = iemnet__chunk2list(c, x->x_floatlist);
-    outlet_list(x->x_msgout, gensym("list"), x->x_floatlist->argc,
-                x->x_floatlist->argv);
+    argv = iemnet__chunk2atoms(c, &x->x_floatlist);
+    if(argv) {
+      outlet_list(x->x_msgout, gensym("list"), c->size, argv);
+    }
   } else {
     iemnet_log(x, IEMNET_VERBOSE, "nothing received");
   }
 }
 
-static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
+static void udpreceive_close(t_udpreceive*x, int verbose)
+{
+  unsigned int i;
+  for(i = 0; i < x->x_nsockets; i++) {
+    if(x->x_receiver[i]) {
+      iemnet__receiver_destroy(x->x_receiver[i], 0);
+    }
+    x->x_receiver[i] = NULL;
+    if(x->x_fd[i] >= 0) {
+      iemnet__closesocket(x->x_fd[i], verbose);
+    }
+    x->x_fd[i] = -1;
+  }
+  x->x_nsockets = 0;
+  x->x_port = -1;
+}
+
+/* returns the bound socket (or -1) */
+static int udpreceive_opensocket(t_udpreceive*x, unsigned short portno,
+                                 int reuseport)
 {
   struct sockaddr_in server;
   socklen_t serversize = sizeof(server);
-  int sockfd = x->x_fd;
+  int sockfd;
   int intarg;
   memset(&server, 0, sizeof(server));
 
-  if(x->x_port == portno) {
-    iemnet_log(x, IEMNET_VERBOSE, "skipping re-binding to port:%d", portno);
-    return 1;
-  }
-
-  /* cleanup any open ports */
-  if(x->x_receiver) {
-    iemnet__receiver_destroy(x->x_receiver, 0);
-    x->x_receiver = NULL;
-  }
-  if(sockfd >= 0) {
-    iemnet__closesocket(sockfd, 1);
-    x->x_fd = -1;
-    x->x_port = -1;
-  }
-
   sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   if(sockfd<0) {
     iemnet_log(x, IEMNET_ERROR, "unable to create socket");
     sys_sockerror("socket");
-    return 0;
+    return -1;
   }
 
   /* ask OS to allow another Pd to reopen this port after we close it. */
@@ -105,7 +118,7 @@ static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
   }
 #endif /* SO_REUSEADDR */
 #ifdef SO_REUSEPORT
-  if(x->x_reuseport) {
+  if(reuseport) {
     intarg = 1;
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT,
                    (void *)&intarg, sizeof(intarg))
@@ -114,6 +127,8 @@ static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
       sys_sockerror("setsockopt:SO_REUSEPORT");
     }
   }
+#else
+  (void)reuseport; /* ignore unused variable */
 #endif /* SO_REUSEPORT */
 
   server.sin_family = AF_INET;
@@ -125,11 +140,36 @@ static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
     iemnet_log(x, IEMNET_ERROR, "unable to bind to socket");
     sys_sockerror("bind");
     iemnet__closesocket(sockfd, 1);
-    sockfd = -1;
+    return -1;
+  }
+  return sockfd;
+}
+
+static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
+{
+  struct sockaddr_in server;
+  socklen_t serversize = sizeof(server);
+  unsigned int shards = x->x_shards;
+  unsigned int i;
+  int sockfd;
+
+  if(x->x_port == portno) {
+    iemnet_log(x, IEMNET_VERBOSE, "skipping re-binding to port:%d", portno);
+    return 1;
+  }
+
+  /* cleanup any open ports */
+  udpreceive_close(x, 1);
+
+  /* the kernel distributes the datagrams across all sockets
+   * (all the datagrams from a given sender end up in the same socket) */
+  sockfd = udpreceive_opensocket(x, portno, x->x_reuseport || shards > 1);
+  if(sockfd < 0) {
     return 0;
   }
 
-  x->x_fd = sockfd;
+  x->x_fd[0] = sockfd;
+  x->x_nsockets = 1;
   x->x_port = portno;
 
   /* find out which port is actually used (useful when assigning "0") */
@@ -137,10 +177,32 @@ static int udpreceive_setport(t_udpreceive*x, unsigned short portno)
     x->x_port = ntohs(server.sin_port);
   }
 
-  x->x_receiver = iemnet__receiver_create(sockfd,
-                                          x,
-                                          udpreceive_read_callback,
-                                          0);
+  for(i = 1; i < shards; i++) {
+    sockfd = udpreceive_opensocket(x, x->x_port, 1);
+    if(sockfd < 0) {
+      iemnet_log(x, IEMNET_ERROR, "only using %d shards", i);
+      break;
+    }
+    x->x_fd[i] = sockfd;
+    x->x_nsockets++;
+  }
+
+  for(i = 0; i < x->x_nsockets; i++) {
+    if(x->x_nsockets > 1) {
+      x->x_receiver[i] = iemnet__receiver_create_shard(x->x_fd[i],
+                         x,
+                         udpreceive_read_callback,
+                         0, i);
+    } else {
+      x->x_receiver[i] = iemnet__receiver_create(x->x_fd[i],
+                         x,
+                         udpreceive_read_callback,
+                         0);
+    }
+    iemnet__receiver_setbudget(x->x_receiver[i],
+                               x->x_recvpackets, x->x_recvbytes);
+    iemnet__receiver_setbufsize(x->x_receiver[i], x->x_recvbufsize);
+  }
   return 1;
 }
 
@@ -193,22 +255,116 @@ static void udpreceive_optionI(t_udpreceive*x, t_symbol*s, int argc,
   }
 }
 
+static void udpreceive_shards(t_udpreceive*x, t_symbol*s, int argc,
+                              t_atom*argv)
+{
+  t_atom ap[1];
+  int shards;
+  if(!argc) {
+    SETFLOAT(ap, x->x_shards);
+    outlet_anything(x->x_statout, s, 1, ap);
+    return;
+  }
+  shards = atom_getint(argv);
+  if(argc > 1 || A_FLOAT != argv->a_type
+      || shards < 1 || shards > IEMNET_RECEIVER_MAXSHARDS) {
+    iemnet_log(x, IEMNET_ERROR, "usage: %s [<1..%d>]", s->s_name,
+               IEMNET_RECEIVER_MAXSHARDS);
+    return;
+  }
+#ifndef SO_REUSEPORT
+  if(shards > 1) {
+    iemnet_log(x, IEMNET_ERROR, "sharding needs SO_REUSEPORT, which is not supported");
+    return;
+  }
+#endif
+  if((unsigned int)shards == x->x_shards) {
+    return;
+  }
+  x->x_shards = shards;
+  /* re-open the port with the new number of sockets */
+  if(x->x_nsockets) {
+    int port = x->x_port;
+    udpreceive_close(x, 0);
+    if(!udpreceive_setport(x, port)) {
+      SETFLOAT(ap, -1);
+      outlet_anything(x->x_statout, gensym("port"), 1, ap);
+    }
+  }
+}
+
+static void udpreceive_receivebudget(t_udpreceive *x, t_symbol *s, int argc,
+                                     t_atom *argv)
+{
+  t_atom ap[3];
+  unsigned long exhausted = 0;
+  unsigned int i;
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    for(i = 0; i < x->x_nsockets; i++) {
+      exhausted += iemnet__receiver_getexhausted(x->x_receiver[i]);
+    }
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, exhausted);
+    outlet_anything(x->x_statout, s, 3, ap);
+    break;
+  case 1:
+    for(i = 0; i < x->x_nsockets; i++) {
+      iemnet__receiver_setbudget(x->x_receiver[i],
+                                 x->x_recvpackets, x->x_recvbytes);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void udpreceive_recvbufsize(t_udpreceive *x, t_symbol *s, int argc,
+                                   t_atom *argv)
+{
+  t_atom ap[1];
+  unsigned int i;
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statout, s, 1, ap);
+    break;
+  case 1:
+    for(i = 0; i < x->x_nsockets; i++) {
+      iemnet__receiver_setbufsize(x->x_receiver[i], x->x_recvbufsize);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
 static void *udpreceive_new(t_floatarg fportno)
 {
   t_udpreceive*x = (t_udpreceive *)pd_new(udpreceive_class);
+  unsigned int i;
 
   x->x_msgout = outlet_new(&x->x_obj, 0);
   x->x_addrout = outlet_new(&x->x_obj, gensym("list"));
   x->x_statout = outlet_new(&x->x_obj, 0);
 
-  x->x_fd = -1;
+  for(i = 0; i < IEMNET_RECEIVER_MAXSHARDS; i++) {
+    x->x_fd[i] = -1;
+    x->x_receiver[i] = NULL;
+  }
+  x->x_nsockets = 0;
   x->x_port = -1;
-  x->x_receiver = NULL;
 
   x->x_floatlist = iemnet__floatlist_create(1024);
 
   x->x_reuseaddr = 1;
   x->x_reuseport = 0;
+  x->x_shards = 1;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
 
   udpreceive_setport(x, fportno);
 
@@ -217,14 +373,7 @@ static void *udpreceive_new(t_floatarg fportno)
 
 static void udpreceive_free(t_udpreceive *x)
 {
-  if(x->x_receiver) {
-    iemnet__receiver_destroy(x->x_receiver, 0);
-  }
-  x->x_receiver = NULL;
-  if(x->x_fd >= 0) {
-    iemnet__closesocket(x->x_fd, 0);
-  }
-  x->x_fd = -1;
+  udpreceive_close(x, 0);
 
   outlet_free(x->x_msgout);
   outlet_free(x->x_addrout);
@@ -253,8 +402,20 @@ IEMNET_EXTERN void udpreceive_setup(void)
                   gensym("reuseaddr"), A_GIMME, 0);
   class_addmethod(udpreceive_class, (t_method)udpreceive_optionI,
                   gensym("reuseport"), A_GIMME, 0);
+  class_addmethod(udpreceive_class, (t_method)udpreceive_shards,
+                  gensym("shards"), A_GIMME, 0);
+
+  class_addmethod(udpreceive_class, (t_method)udpreceive_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(udpreceive_class, (t_method)udpreceive_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
 
   DEBUGMETHOD(udpreceive_class);
+
+  POOLSTATSMETHOD(udpreceive_class);
+
+  SENDTHREADSMETHOD(udpreceive_class);
+  RECEIVETHREADMETHOD(udpreceive_class);
 }
 
 IEMNET_INITIALIZER(udpreceive_setup);
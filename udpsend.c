@@ -35,32 +35,45 @@ typedef struct _udpsend {
   t_object x_obj;
   t_iemnet_sender*x_sender;
   int x_fd;
+
+  t_iemnet_resolver*x_resolver; /* pending hostname lookup */
+  t_symbol*x_hostname; /* the host we are connecting to */
+  int x_port; /* the port we are connecting to */
+  t_iemnet_queue*x_pending; /* data sent while resolving */
+
+  unsigned long x_sendlimit; /* max. bytes in the send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
 } t_udpsend;
 
-static void udpsend_connect(t_udpsend *x, t_symbol *hostname,
-                            t_floatarg fportno)
+static void udpsend_pending_free(t_udpsend *x)
+{
+  if(x->x_pending) {
+    queue_destroy(x->x_pending);
+  }
+  x->x_pending = NULL;
+}
+
+/* the hostname has been resolved */
+static void udpsend_resolved(void*y, int success, uint32_t addr)
 {
+  t_udpsend*x = (t_udpsend*)y;
   struct sockaddr_in server;
-  struct hostent*hp = NULL;
+  t_iemnet_chunk*chunk;
   int sockfd;
-  int portno = fportno;
+  int portno = x->x_port;
   int broadcast = 1;/* nonzero is true */
   memset(&server, 0, sizeof(server));
 
-  if (x->x_sender) {
-    iemnet_log(x, IEMNET_ERROR, "already connected");
+  x->x_resolver = NULL;
+  if (!success) {
+    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", x->x_hostname->s_name);
+    udpsend_pending_free(x);
     return;
   }
 
   /* connect socket using hostname provided in command line */
   server.sin_family = AF_INET;
-
-  hp = gethostbyname(hostname->s_name);
-  if (hp == 0) {
-    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", hostname->s_name);
-    return;
-  }
-  memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
+  server.sin_addr.s_addr = htonl(addr);
 
   /* assign client port number */
   server.sin_port = htons((u_short)portno);
@@ -74,6 +87,7 @@ static void udpsend_connect(t_udpsend *x, t_symbol *hostname,
   if (sockfd < 0) {
     iemnet_log(x, IEMNET_ERROR, "unable to create datagram socket");
     sys_sockerror("socket");
+    udpsend_pending_free(x);
     return;
   }
 
@@ -91,15 +105,54 @@ static void udpsend_connect(t_udpsend *x, t_symbol *hostname,
     iemnet_log(x, IEMNET_ERROR, "unable to connect to socket:%d", sockfd);
     sys_sockerror("connect");
     iemnet__closesocket(sockfd, 1);
+    udpsend_pending_free(x);
     return;
   }
   x->x_sender = iemnet__sender_create(sockfd, NULL, NULL, 0);
+  iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
   x->x_fd = sockfd;
+
+  /* flush whatever has been sent while we were resolving */
+  if(x->x_pending) {
+    while((chunk = queue_pop_noblock(x->x_pending))) {
+      iemnet__sender_send_owned(x->x_sender, chunk);
+    }
+  }
+  udpsend_pending_free(x);
+
   outlet_float(x->x_obj.ob_outlet, 1);
 }
 
+static void udpsend_connect(t_udpsend *x, t_symbol *hostname,
+                            t_floatarg fportno)
+{
+  if (x->x_sender) {
+    iemnet_log(x, IEMNET_ERROR, "already connected");
+    return;
+  }
+  if (x->x_resolver) {
+    iemnet_log(x, IEMNET_ERROR, "already connecting");
+    return;
+  }
+  x->x_hostname = hostname;
+  x->x_port = fportno;
+
+  /* the hostname is resolved in the background (unless it's cached);
+   * the connection is established in udpsend_resolved() */
+  udpsend_pending_free(x);
+  x->x_pending = queue_create();
+  if(x->x_pending) {
+    queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+  }
+  x->x_resolver = iemnet__resolver_lookup(hostname->s_name, x,
+                                          udpsend_resolved);
+}
+
 static void udpsend_disconnect(t_udpsend *x)
 {
+  iemnet__resolver_cancel(x->x_resolver);
+  x->x_resolver = NULL;
+  udpsend_pending_free(x);
   if(x->x_sender) {
     iemnet__sender_destroy(x->x_sender, 0);
   }
@@ -116,17 +169,46 @@ static void udpsend_send(t_udpsend *x, t_symbol *s, int argc, t_atom *argv)
   (void)s; /* ignore unused variable */
   if(x->x_sender) {
     t_iemnet_chunk*chunk = iemnet__chunk_create_list(argc, argv);
-    int size = iemnet__sender_send(x->x_sender, chunk);
-    iemnet__chunk_destroy(chunk);
+    int size = iemnet__sender_send_owned(x->x_sender, chunk);
     if(size < 1) {
       /* ouch, the "connection" broke */
       udpsend_disconnect(x);
     }
+  } else if(x->x_pending) {
+    /* still resolving: keep the data until we are connected */
+    t_iemnet_chunk*chunk = iemnet__chunk_create_list(argc, argv);
+    if(chunk && queue_push(x->x_pending, chunk) < 0) {
+      udpsend_disconnect(x);
+    }
   } else {
     iemnet_log(x, IEMNET_ERROR, "not connected");
   }
 }
 
+static void udpsend_sendlimit(t_udpsend *x, t_symbol *s, int argc,
+                              t_atom *argv)
+{
+  unsigned long dropchunks = 0, dropbytes = 0;
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    iemnet__sender_getdropped(x->x_sender, &dropchunks, &dropbytes);
+    iemnet_log(x, IEMNET_NORMAL,
+               "sendlimit: %lu bytes (%s); dropped %lu chunks (%lu bytes)",
+               x->x_sendlimit, iemnet__overflow2symbol(x->x_overflow)->s_name,
+               dropchunks, dropbytes);
+    break;
+  case 1:
+    iemnet__sender_setlimit(x->x_sender, x->x_sendlimit, x->x_overflow);
+    if(x->x_pending) {
+      queue_setlimit(x->x_pending, x->x_sendlimit, x->x_overflow);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
 static void udpsend_free(t_udpsend *x)
 {
   udpsend_disconnect(x);
@@ -138,6 +220,12 @@ static void *udpsend_new(void)
   outlet_new(&x->x_obj, gensym("float"));
   x->x_sender = NULL;
   x->x_fd = -1;
+  x->x_resolver = NULL;
+  x->x_hostname = NULL;
+  x->x_port = 0;
+  x->x_pending = NULL;
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
   return (x);
 }
 
@@ -158,7 +246,13 @@ IEMNET_EXTERN void udpsend_setup(void)
   class_addmethod(udpsend_class, (t_method)udpsend_send, gensym("send"),
                   A_GIMME, 0);
   class_addlist(udpsend_class, (t_method)udpsend_send);
+  class_addmethod(udpsend_class, (t_method)udpsend_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
   DEBUGMETHOD(udpsend_class);
+  POOLSTATSMETHOD(udpsend_class);
+  SENDTHREADSMETHOD(udpsend_class);
+  RECEIVETHREADMETHOD(udpsend_class);
+  RESOLVERCACHEMETHOD(udpsend_class);
 }
 
 IEMNET_INITIALIZER(udpsend_setup);
@@ -52,6 +52,15 @@ typedef struct _udpserver_sender {
   double sr_lastseen;
 } t_udpserver_sender;
 
+/* a client that is added once its hostname has been resolved */
+typedef struct _udpserver_pendingclient {
+  struct _udpserver*pc_owner;
+  t_symbol*pc_hostname;
+  unsigned int pc_port;
+  t_iemnet_resolver*pc_resolver;
+  struct _udpserver_pendingclient*pc_next;
+} t_udpserver_pendingclient;
+
 typedef struct _udpserver {
   t_object x_obj;
   t_outlet*x_msgout;
@@ -64,9 +73,17 @@ typedef struct _udpserver {
   unsigned int x_nconnections;
   unsigned int x_maxconnections;
 
+  /* hash table (open addressing) for looking up senders by address */
+  t_udpserver_sender**x_index;
+  unsigned int x_indexsize; /* power of 2, >= 2*x_maxconnections */
+
   int x_connectsocket; /* socket waiting for new connections */
   unsigned short x_port; /* port we are bound to */
   t_symbol*x_ifaddr; /* interface we are bound to */
+  t_iemnet_resolver*x_bindresolver; /* pending lookup of the interface */
+  t_symbol*x_bindifaddr; /* interface we are going to bind to */
+  unsigned short x_bindport; /* port we are going to bind to */
+  t_udpserver_pendingclient*x_pendingclients; /* clients being resolved */
   unsigned char x_accept; /* whether we accept new connections or not */
   double x_timeout; /* timeout after which clients expire */
   double x_lastchecked; /* when the last timeout check was performed */
@@ -76,6 +93,13 @@ typedef struct _udpserver {
   */
   int x_defaulttarget;
 
+  unsigned long x_sendlimit; /* max. bytes in each send buffer (0: unlimited) */
+  t_iemnet_overflow x_overflow; /* what to do if the limit is hit */
+
+  unsigned int x_recvpackets; /* max. packets read per tick (0: default) */
+  unsigned long x_recvbytes; /* max. bytes read per tick (0: unlimited) */
+  unsigned long x_recvbufsize; /* size of the receive buffer (0: default) */
+
   t_iemnet_receiver*x_receiver;
   t_iemnet_floatlist*x_floatlist;
 } t_udpserver;
@@ -114,6 +138,8 @@ static t_udpserver_sender *udpserver_sender_new(t_udpserver *owner,
     x->sr_hostname = gensym(hostname);
 
     x->sr_sender = iemnet__sender_create(owner->x_connectsocket, NULL, NULL, 0);
+    iemnet__sender_setlimit(x->sr_sender,
+                              owner->x_sendlimit, owner->x_overflow);
 
     x->sr_lastseen = clock_getlogicaltime();
   }
@@ -194,22 +220,107 @@ static int equal_addr(unsigned long host1, unsigned short port1,
          );
 }
 
+/* the sender index is a hash table using linear probing;
+ * since it has at least twice as many buckets as there can be senders,
+ * it never fills up and probe sequences stay short.
+ * keys are (host, port): [udpserver] only does IPv4 (so far)
+ */
+static unsigned int udpserver_index_hash(unsigned long host,
+    unsigned short port)
+{
+  uint32_t h = (uint32_t)host * 0x9E3779B1U;
+  h ^= (uint32_t)port * 0x85EBCA6BU;
+  h ^= h >> 15;
+  return h;
+}
+
+static void udpserver_index_add(t_udpserver*x, t_udpserver_sender*sdr)
+{
+  unsigned int mask = x->x_indexsize - 1;
+  unsigned int i = udpserver_index_hash(sdr->sr_host, sdr->sr_port) & mask;
+  while(x->x_index[i]) {
+    i = (i + 1) & mask;
+  }
+  x->x_index[i] = sdr;
+}
+
+static void udpserver_index_remove(t_udpserver*x, t_udpserver_sender*sdr)
+{
+  unsigned int mask = x->x_indexsize - 1;
+  unsigned int i = udpserver_index_hash(sdr->sr_host, sdr->sr_port) & mask;
+  unsigned int j;
+  while(x->x_index[i] != sdr) {
+    if(!x->x_index[i]) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  x->x_index[i] = NULL;
+  /* move entries of the same probe sequence into the gap
+   * (so we don't need tombstones) */
+  for(j = (i + 1) & mask; x->x_index[j]; j = (j + 1) & mask) {
+    t_udpserver_sender*s = x->x_index[j];
+    unsigned int k = udpserver_index_hash(s->sr_host, s->sr_port) & mask;
+    /* the entry can be moved, unless its home bucket lies within (i, j] */
+    if((i < j) ? (k <= i || k > j) : (k <= i && k > j)) {
+      x->x_index[i] = s;
+      x->x_index[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+/* (re)create the index, so it can hold x_maxconnections senders */
+static int udpserver_index_rebuild(t_udpserver*x, unsigned int maxconnections)
+{
+  unsigned int size = 16;
+  unsigned int i;
+  t_udpserver_sender**index;
+  while(size < 2 * maxconnections) {
+    size <<= 1;
+  }
+  if(size == x->x_indexsize) {
+    return 1;
+  }
+  index = (t_udpserver_sender**)getbytes(sizeof(*index) * size);
+  if(!index) {
+    return 0;
+  }
+  if(x->x_index) {
+    freebytes(x->x_index, sizeof(*x->x_index) * x->x_indexsize);
+  }
+  x->x_index = index;
+  x->x_indexsize = size;
+  for(i = 0; i < size; i++) {
+    x->x_index[i] = NULL;
+  }
+  for(i = 0; i < x->x_nconnections; i++) {
+    if(x->x_sr[i]) {
+      udpserver_index_add(x, x->x_sr[i]);
+    }
+  }
+  return 1;
+}
+
 /* called from:
  * - udpserver_sender_add()
  */
-static int udpserver__find_sender(t_udpserver*x, unsigned long host,
-                                  unsigned short port)
+static t_udpserver_sender*udpserver__find_sender(t_udpserver*x,
+    unsigned long host, unsigned short port)
 {
-  unsigned int i = 0;
-  for(i = 0; i<x->x_nconnections; i++) {
-    if(NULL == x->x_sr[i]) {
-      return -1;
-    }
-    if(equal_addr(host, port, x->x_sr[i]->sr_host, x->x_sr[i]->sr_port)) {
-      return i;
+  unsigned int mask = x->x_indexsize - 1;
+  unsigned int i = udpserver_index_hash(host, port) & mask;
+  t_udpserver_sender*sdr;
+  if(!x->x_index) {
+    return NULL;
+  }
+  while((sdr = x->x_index[i])) {
+    if(equal_addr(host, port, sdr->sr_host, sdr->sr_port)) {
+      return sdr;
     }
+    i = (i + 1) & mask;
   }
-  return -1;
+  return NULL;
 }
 
 /**
@@ -222,53 +333,36 @@ static int udpserver__find_sender(t_udpserver*x, unsigned long host,
 static t_udpserver_sender* udpserver_sender_add(t_udpserver*x,
     unsigned long host, unsigned short port )
 {
-  int id = -1;
+  t_udpserver_sender*sdr = NULL;
 
   if(!x->x_accept) {
     return NULL;
   }
 
-  id = udpserver__find_sender(x, host, port);
-  DEBUG("%X:%d -> %d", host, port, id);
-  if(id<0) {
-#if 0
+  sdr = udpserver__find_sender(x, host, port);
+  DEBUG("%X:%d -> %x", host, port, sdr);
+  if(!sdr) {
     /* since udp is a connection-less protocol we have no way of knowing the currently connected clients
-     * the following 3 lines assume, that there is only one client connected (the last we got data from
-     */
-    id = 0;
-    if (x->x_sr[id] == NULL) {
-      x->x_sr[id] = udpserver_sender_new(x, host, port);
-    } else {
-      x->x_sr[id]->sr_port = port;
-      x->x_sr[id]->sr_host = host;
-    }
-
-    x->x_nconnections = 1;
-#else
-    /* this is a more optimistic approach as above:
      * every client that we received data from is added to the list of receivers
      * the idea is to remove the sender, if it's known to not receive any data
      */
-    id = x->x_nconnections;
+    unsigned int id = x->x_nconnections;
     /* an unknown address! add it */
-    if(id < (int)x->x_maxconnections) {
-      x->x_sr[id] = udpserver_sender_new(x, host, port);
-      DEBUG("new sender[%d] = %x", id, x->x_sr[id]);
-      x->x_nconnections++;
-    } else {
-      /* oops, no more senders! */
-      id = -1;
+    if(id < x->x_maxconnections) {
+      sdr = udpserver_sender_new(x, host, port);
+      DEBUG("new sender[%d] = %x", id, sdr);
+      if(sdr) {
+        x->x_sr[id] = sdr;
+        x->x_nconnections++;
+        udpserver_index_add(x, sdr);
+      }
     }
-#endif
+    /* else: oops, no more senders! */
   } else {
-    x->x_sr[id]->sr_lastseen = clock_getlogicaltime();
+    sdr->sr_lastseen = clock_getlogicaltime();
   }
-  DEBUG("sender_add: %d", id);
-  if(id >= 0) {
-    return x->x_sr[id];
-  }
-
-  return NULL;
+  DEBUG("sender_add: %x", sdr);
+  return sdr;
 }
 
 static void udpserver_sender_remove(t_udpserver*x, unsigned int id)
@@ -277,13 +371,14 @@ static void udpserver_sender_remove(t_udpserver*x, unsigned int id)
     unsigned int i;
 
     t_udpserver_sender* sdr = x->x_sr[id];
+    udpserver_index_remove(x, sdr);
     udpserver_sender_free(sdr);
 
     /* close the gap by shifting the remaining connections to the left */
-    for(i = id; i<x->x_nconnections; i++) {
-      x->x_sr[id] = x->x_sr[id+1];
+    for(i = id; i+1<x->x_nconnections; i++) {
+      x->x_sr[i] = x->x_sr[i+1];
     }
-    x->x_sr[id] = NULL;
+    x->x_sr[x->x_nconnections-1] = NULL;
 
     x->x_nconnections--;
   }
@@ -306,6 +401,7 @@ static void udpserver_sender_autoremove(t_udpserver*x)
       continue;
     }
     if (clock_gettimesince(x->x_sr[id]->sr_lastseen) > x->x_timeout) {
+      udpserver_index_remove(x, x->x_sr[id]);
       udpserver_sender_free(x->x_sr[id]);
       x->x_sr[id] = NULL;
       continue;
@@ -331,6 +427,8 @@ static void udpserver_info_client(t_udpserver *x, unsigned int client)
   /*
      "client <id> <socket> <IP> <port>"
      "bufsize <id> <insize> <outsize>"
+     "dropped <id> <chunks> <bytes>"
+     "recvbuf <id> <pending> <buffered> <highwater>"
   */
   static t_atom output_atom[5];
   if(x && client<x->x_maxconnections && x->x_sr[client]) {
@@ -338,6 +436,8 @@ static void udpserver_info_client(t_udpserver *x, unsigned int client)
 
     int insize = iemnet__receiver_getsize(x->x_receiver);
     int outsize = iemnet__sender_getsize(x->x_sr[client]->sr_sender);
+    unsigned long dropchunks = 0, dropbytes = 0;
+    unsigned long pending = 0, buffered = 0, highwater = 0;
 
     SETFLOAT(output_atom+0, client+1);
     SETSYMBOL(output_atom+1, gensym("address"));
@@ -352,6 +452,21 @@ static void udpserver_info_client(t_udpserver *x, unsigned int client)
     SETFLOAT(output_atom+1, insize);
     SETFLOAT(output_atom+2, outsize);
     outlet_anything( x->x_statusout, gensym("bufsize"), 3, output_atom);
+
+    iemnet__sender_getdropped(x->x_sr[client]->sr_sender, &dropchunks,
+                              &dropbytes);
+    SETFLOAT(output_atom+0, client+1);
+    SETFLOAT(output_atom+1, dropchunks);
+    SETFLOAT(output_atom+2, dropbytes);
+    outlet_anything( x->x_statusout, gensym("dropped"), 3, output_atom);
+
+    iemnet__receiver_getstats(x->x_receiver, &pending, &buffered,
+                              &highwater);
+    SETFLOAT(output_atom+0, client+1);
+    SETFLOAT(output_atom+1, pending);
+    SETFLOAT(output_atom+2, buffered);
+    SETFLOAT(output_atom+3, highwater);
+    outlet_anything( x->x_statusout, gensym("recvbuf"), 4, output_atom);
   }
 }
 
@@ -403,6 +518,7 @@ static void udpserver_info_connection(t_udpserver *x, t_udpserver_sender*y)
 
 /* ---------------- main udpserver (send) stuff --------------------- */
 static void udpserver_disconnect(t_udpserver *x, unsigned int client);
+/* sends the chunk to a single client, taking ownership of the chunk */
 static void udpserver_send_bytes(t_udpserver*x, unsigned int client,
                                  t_iemnet_chunk*chunk)
 {
@@ -417,11 +533,15 @@ static void udpserver_send_bytes(t_udpserver*x, unsigned int client,
     t_iemnet_sender*sender = x->x_sr[client]->sr_sender;
     int sockfd = x->x_sr[client]->sr_uniq;
 
-    chunk->addr = x->x_sr[client]->sr_host;
-    chunk->port = x->x_sr[client]->sr_port;
+    if(chunk) {
+      chunk->addr = x->x_sr[client]->sr_host;
+      chunk->port = x->x_sr[client]->sr_port;
+    }
 
     if(sender) {
-      size = iemnet__sender_send(sender, chunk);
+      size = iemnet__sender_send_owned(sender, chunk);
+    } else {
+      iemnet__chunk_destroy(chunk);
     }
 
     SETFLOAT(&output_atom[0], client+1);
@@ -433,6 +553,8 @@ static void udpserver_send_bytes(t_udpserver*x, unsigned int client,
       /* disconnected! */
       udpserver_disconnect(x, client);
     }
+  } else {
+    iemnet__chunk_destroy(chunk);
   }
 }
 
@@ -449,7 +571,7 @@ static void udpserver_send_butclient(t_udpserver *x, unsigned int but,
       client++) {	/* check if connection exists */
     /* socket exists for this client */
     if(client != but) {
-      udpserver_send_bytes(x, client, chunk);
+      udpserver_send_bytes(x, client, iemnet__chunk_share(chunk));
     }
   }
   iemnet__chunk_destroy(chunk);
@@ -460,7 +582,6 @@ static void udpserver_send_toclient(t_udpserver *x, unsigned int client,
 {
   t_iemnet_chunk*chunk = iemnet__chunk_create_list(argc, argv);
   udpserver_send_bytes(x, client, chunk);
-  iemnet__chunk_destroy(chunk);
 }
 
 /* send message to client using client number
@@ -507,7 +628,7 @@ static void udpserver_broadcast(t_udpserver *x, t_symbol *s, int argc,
   for(client = 0; client < x->x_nconnections;
       client++) {	/* check if connection exists */
     /* socket exists for this client */
-    udpserver_send_bytes(x, client, chunk);
+    udpserver_send_bytes(x, client, iemnet__chunk_share(chunk));
   }
   iemnet__chunk_destroy(chunk);
   if(oldconnections != x->x_nconnections) {
@@ -573,25 +694,55 @@ static void udpserver_defaulttarget(t_udpserver *x, t_floatarg f)
 
   x->x_defaulttarget = sockfd;
 }
+/* the hostname of a client has been resolved */
+static void udpserver_add_resolved(void*y, int success, uint32_t addr)
+{
+  t_udpserver_pendingclient*pc = (t_udpserver_pendingclient*)y;
+  t_udpserver*x = pc->pc_owner;
+  t_udpserver_pendingclient**p;
+
+  /* (if we are called from within udpserver_add_client(), pc is not listed) */
+  for(p = &x->x_pendingclients; *p; p = &(*p)->pc_next) {
+    if(*p == pc) {
+      *p = pc->pc_next;
+      break;
+    }
+  }
+
+  if (!success) {
+    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", pc->pc_hostname->s_name);
+  } else if (!udpserver_sender_add(x, addr, pc->pc_port)) {
+    iemnet_log(x, IEMNET_ERROR, "unable to add client %s:%d",
+               pc->pc_hostname->s_name, pc->pc_port);
+  }
+  free(pc);
+}
+
 static void udpserver_add_client(t_udpserver *x, t_symbol*s, t_float f)
 {
-  struct hostent*hp;
-  struct sockaddr_in server;
+  t_udpserver_pendingclient*pc;
+  t_iemnet_resolver*resolver;
   unsigned int port = (unsigned int)f;
   if((int)f<1 || (int)f>=0xFFFF) {
     iemnet_log(x, IEMNET_ERROR, "bad port '%d'?", (int)f);
     return;
   }
-  hp = gethostbyname(s->s_name);
-  if (hp == 0) {
-    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", s->s_name);
+  pc = (t_udpserver_pendingclient*)calloc(1, sizeof(*pc));
+  if(!pc) {
+    iemnet_log(x, IEMNET_ERROR, "unable to add client %s:%d", s->s_name, port);
     return;
   }
-
-  server.sin_family = AF_INET;
-  memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
-  if (!udpserver_sender_add(x, ntohl(server.sin_addr.s_addr), port)) {
-    iemnet_log(x, IEMNET_ERROR, "unable to add client %s:%d", s->s_name, port);
+  pc->pc_owner = x;
+  pc->pc_hostname = s;
+  pc->pc_port = port;
+
+  /* the client is added once the hostname has been resolved
+   * (which might happen right away) */
+  resolver = iemnet__resolver_lookup(s->s_name, pc, udpserver_add_resolved);
+  if(resolver) {
+    pc->pc_resolver = resolver;
+    pc->pc_next = x->x_pendingclients;
+    x->x_pendingclients = pc;
   }
 }
 
@@ -670,20 +821,22 @@ static void udpserver_receive_callback(void *y, t_iemnet_chunk*c)
   if(c) {
     unsigned int conns = x->x_nconnections;
     t_udpserver_sender*sdr = NULL;
+    t_atom*argv = NULL;
     DEBUG("add new sender from %d", c->port);
     sdr = udpserver_sender_add(x, c->addr, c->port);
     DEBUG("added new sender from %d", c->port);
     if(sdr) {
       udpserver_info_connection(x, sdr);
       /* gets destroyed in the dtor */
-      x->x_floatlist = iemnet__chunk2list(c, x->x_floatlist);
+      argv = iemnet__chunk2atoms(c, &x->x_floatlist);
 
       /* here we might have a reentrancy problem */
       if(conns != x->x_nconnections) {
         iemnet__numconnout(x->x_statusout, x->x_connectout, x->x_nconnections);
       }
-      outlet_list(x->x_msgout, gensym("list"), x->x_floatlist->argc,
-                  x->x_floatlist->argv);
+      if(argv) {
+        outlet_list(x->x_msgout, gensym("list"), c->size, argv);
+      }
     }
   } else {
     /* disconnection never happens with a connectionless protocol like UDP */
@@ -693,7 +846,8 @@ static void udpserver_receive_callback(void *y, t_iemnet_chunk*c)
 
 
 
-static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short portno)
+static void udpserver_bind_address(t_udpserver*x, t_symbol*ifaddr,
+                                   unsigned short portno, uint32_t addr)
 {
   static t_atom ap[1];
   struct sockaddr_in server;
@@ -702,9 +856,6 @@ static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short por
   memset(&server, 0, sizeof(server));
 
   SETFLOAT(ap, -1);
-  if(x->x_port == portno && x->x_ifaddr == ifaddr) {
-    return;
-  }
 
   /* cleanup any open ports */
   if(sockfd >= 0) {
@@ -724,19 +875,7 @@ static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short por
   }
 
   server.sin_family = AF_INET;
-
-  /* LATER allow setting of inaddr */
-  if (ifaddr) {
-    struct hostent *hp = gethostbyname(ifaddr->s_name);
-    if(!hp) {
-      iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", ifaddr->s_name);
-      iemnet__closesocket(sockfd, 0);
-      return;
-    }
-    memcpy((char *)&server.sin_addr, (char *)hp->h_addr, hp->h_length);
-  } else {
-    server.sin_addr.s_addr = INADDR_ANY;
-  }
+  server.sin_addr.s_addr = ifaddr ? htonl(addr) : INADDR_ANY;
 
 
   /* assign server port number */
@@ -754,6 +893,8 @@ static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short por
                                           x,
                                           udpserver_receive_callback,
                                           0);
+  iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+  iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
   x->x_connectsocket = sockfd;
   x->x_port = portno;
   x->x_ifaddr = ifaddr;
@@ -769,6 +910,38 @@ static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short por
   outlet_anything(x->x_statusout, gensym("port"), 1, ap);
 }
 
+/* the interface address has been resolved */
+static void udpserver_bind_resolved(void*y, int success, uint32_t addr)
+{
+  t_udpserver*x = (t_udpserver*)y;
+  x->x_bindresolver = NULL;
+  if(!success) {
+    iemnet_log(x, IEMNET_ERROR, "bad host '%s'?", x->x_bindifaddr->s_name);
+    return;
+  }
+  udpserver_bind_address(x, x->x_bindifaddr, x->x_bindport, addr);
+}
+
+static void udpserver_do_bind(t_udpserver*x, t_symbol*ifaddr, unsigned short portno)
+{
+  /* forget about any pending bind */
+  iemnet__resolver_cancel(x->x_bindresolver);
+  x->x_bindresolver = NULL;
+
+  if(x->x_port == portno && x->x_ifaddr == ifaddr) {
+    return;
+  }
+  if(!ifaddr) {
+    udpserver_bind_address(x, ifaddr, portno, 0);
+    return;
+  }
+  /* resolve the interface address in the background (unless it's cached) */
+  x->x_bindifaddr = ifaddr;
+  x->x_bindport = portno;
+  x->x_bindresolver = iemnet__resolver_lookup(ifaddr->s_name, x,
+                      udpserver_bind_resolved);
+}
+
 static void udpserver_port(t_udpserver*x, t_floatarg fportno)
 {
   if(fportno<0 || (int)fportno >= 0xFFFF) {
@@ -816,6 +989,10 @@ static void udpserver_maxconnections(t_udpserver *x, t_floatarg maxconnf)
   if(maxconn == x->x_maxconnections) {
     return;
   }
+  if(!udpserver_index_rebuild(x, maxconn)) {
+    pd_error(x, "failed to set maximum number of connections");
+    return;
+  }
 
   sr = resizebytes(x->x_sr
       , sizeof(*sr) * x->x_maxconnections
@@ -829,6 +1006,68 @@ static void udpserver_maxconnections(t_udpserver *x, t_floatarg maxconnf)
   }
 }
 
+static void udpserver_sendlimit(t_udpserver *x, t_symbol *s, int argc,
+                                t_atom *argv)
+{
+  t_atom ap[2];
+  unsigned int i;
+  switch(iemnet__sendlimit_parse(x, s, argc, argv,
+                                 &x->x_sendlimit, &x->x_overflow)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_sendlimit);
+    SETSYMBOL(ap+1, iemnet__overflow2symbol(x->x_overflow));
+    outlet_anything(x->x_statusout, s, 2, ap);
+    break;
+  case 1:
+    for(i = 0; i < x->x_nconnections; i++) {
+      if(x->x_sr[i]) {
+        iemnet__sender_setlimit(x->x_sr[i]->sr_sender,
+                                x->x_sendlimit, x->x_overflow);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void udpserver_receivebudget(t_udpserver *x, t_symbol *s, int argc,
+                                    t_atom *argv)
+{
+  t_atom ap[3];
+  switch(iemnet__receivebudget_parse(x, s, argc, argv,
+                                     &x->x_recvpackets, &x->x_recvbytes)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvpackets);
+    SETFLOAT(ap+1, x->x_recvbytes);
+    SETFLOAT(ap+2, iemnet__receiver_getexhausted(x->x_receiver));
+    outlet_anything(x->x_statusout, s, 3, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbudget(x->x_receiver, x->x_recvpackets, x->x_recvbytes);
+    break;
+  default:
+    break;
+  }
+}
+
+static void udpserver_recvbufsize(t_udpserver *x, t_symbol *s, int argc,
+                                  t_atom *argv)
+{
+  t_atom ap[1];
+  switch(iemnet__recvbufsize_parse(x, s, argc, argv, &x->x_recvbufsize)) {
+  case 0:
+    SETFLOAT(ap+0, x->x_recvbufsize);
+    outlet_anything(x->x_statusout, s, 1, ap);
+    break;
+  case 1:
+    iemnet__receiver_setbufsize(x->x_receiver, x->x_recvbufsize);
+    break;
+  default:
+    break;
+  }
+}
+
 static void *udpserver_new(t_floatarg fportno)
 {
   t_udpserver*x;
@@ -846,6 +1085,10 @@ static void *udpserver_new(t_floatarg fportno)
 
   x->x_connectsocket = -1;
   x->x_port = -1;
+  x->x_bindresolver = NULL;
+  x->x_bindifaddr = NULL;
+  x->x_bindport = 0;
+  x->x_pendingclients = NULL;
   x->x_nconnections = 0;
   x->x_maxconnections = MAX_CONNECT;
   x->x_sr = (t_udpserver_sender**)getbytes(sizeof(*x->x_sr) * x->x_maxconnections);
@@ -853,8 +1096,16 @@ static void *udpserver_new(t_floatarg fportno)
   for(i = 0; i < x->x_maxconnections; i++) {
     x->x_sr[i] = NULL;
   }
+  x->x_index = NULL;
+  x->x_indexsize = 0;
+  udpserver_index_rebuild(x, x->x_maxconnections);
 
   x->x_defaulttarget = 0;
+  x->x_sendlimit = 0;
+  x->x_overflow = IEMNET_OVERFLOW_DROPNEWEST;
+  x->x_recvpackets = 0;
+  x->x_recvbytes = 0;
+  x->x_recvbufsize = 0;
   x->x_floatlist = iemnet__floatlist_create(1024);
 
   udpserver_port(x, fportno);
@@ -867,6 +1118,14 @@ static void *udpserver_new(t_floatarg fportno)
 static void udpserver_free(t_udpserver *x)
 {
   unsigned int i;
+  iemnet__resolver_cancel(x->x_bindresolver);
+  x->x_bindresolver = NULL;
+  while(x->x_pendingclients) {
+    t_udpserver_pendingclient*pc = x->x_pendingclients;
+    x->x_pendingclients = pc->pc_next;
+    iemnet__resolver_cancel(pc->pc_resolver);
+    free(pc);
+  }
   for(i = 0; i < x->x_maxconnections; i++) {
     if (NULL != x->x_sr[i]) {
       DEBUG("[%s] free %x", objName, x);
@@ -876,6 +1135,10 @@ static void udpserver_free(t_udpserver *x)
   }
   freebytes(x->x_sr, sizeof(*x->x_sr) * x->x_maxconnections);
   x->x_sr = NULL;
+  if(x->x_index) {
+    freebytes(x->x_index, sizeof(*x->x_index) * x->x_indexsize);
+  }
+  x->x_index = NULL;
 
   if(x->x_receiver) {
     iemnet__receiver_destroy(x->x_receiver, 0);
@@ -907,6 +1170,12 @@ IEMNET_EXTERN void udpserver_setup(void)
 
   class_addmethod(udpserver_class, (t_method)udpserver_accept,
                   gensym("accept"), A_FLOAT, 0);
+  class_addmethod(udpserver_class, (t_method)udpserver_sendlimit,
+                  gensym("sendlimit"), A_GIMME, 0);
+  class_addmethod(udpserver_class, (t_method)udpserver_receivebudget,
+                  gensym("receivebudget"), A_GIMME, 0);
+  class_addmethod(udpserver_class, (t_method)udpserver_recvbufsize,
+                  gensym("recvbufsize"), A_GIMME, 0);
   class_addmethod(udpserver_class, (t_method)udpserver_maxconnections,
                   gensym("maxconnections"), A_FLOAT, 0);
   class_addmethod(udpserver_class, (t_method)udpserver_timeout,
@@ -932,6 +1201,12 @@ IEMNET_EXTERN void udpserver_setup(void)
   class_addbang(udpserver_class, (t_method)udpserver_info);
 
   DEBUGMETHOD(udpserver_class);
+
+  POOLSTATSMETHOD(udpserver_class);
+
+  SENDTHREADSMETHOD(udpserver_class);
+  RECEIVETHREADMETHOD(udpserver_class);
+  RESOLVERCACHEMETHOD(udpserver_class);
 }
 
 IEMNET_INITIALIZER(udpserver_setup);